@@ -0,0 +1,241 @@
+/// \file  chrbench.c
+/// \brief chrclass.c against the libc character functions.
+/* -------------------------------------------------------------*
+
+   make chrbench; ./chrbench [-n passes] file [file ...]
+
+   Files (quizzes in the text format) are read into memory
+   first and cut into lines. Each line then gets the work that
+   the parser does on it: trimming, telling what starts it,
+   looking for the tags and "answer", and folding choice
+   identifiers to lower case; once with the ctype.h macros
+   and strcasestr()/strncasecmp() of the C library, once with
+   those of chrclass.h. The best of the passes is kept.
+
+ * -------------------------------------------------------------*/
+
+#define _GNU_SOURCE       // strcasestr()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "chrclass.h"
+
+#define PASSES   5
+#define ID_LEN   10
+
+// Keeps the compiler from dropping the work
+static volatile unsigned long G_sink;
+
+static const char *G_tags[] = {"<pre>", "</pre>", "<block>", "</block>",
+                               NULL};
+
+static char *read_all(const char *name, size_t *sizep) {
+   FILE   *fp;
+   char   *data = NULL;
+   size_t  alloc = 0;
+   size_t  size = 0;
+   size_t  n;
+
+   if ((fp = fopen(name, "r")) == NULL) {
+     perror(name);
+     return NULL;
+   }
+   do {
+     if (size == alloc) {
+       alloc = (alloc ? 2 * alloc : 65536);
+       if ((data = (char *)realloc(data, alloc + 1)) == NULL) {
+         perror("realloc");
+         exit(1);
+       }
+     }
+     n = fread(data + size, 1, alloc - size, fp);
+     size += n;
+   } while (n);
+   fclose(fp);
+   data[size] = '\0';
+   *sizep = size;
+   return data;
+}
+
+static char **cut_lines(char *data, long *cntp) {
+   // Lines of data, NUL-terminated in place
+   char **lines = NULL;
+   long   alloc = 0;
+   long   cnt = 0;
+   char  *p = data;
+   char  *q;
+
+   while (*p) {
+     if (cnt == alloc) {
+       alloc = (alloc ? 2 * alloc : 4096);
+       if ((lines = (char **)realloc(lines, sizeof(char *) * alloc))
+             == NULL) {
+         perror("realloc");
+         exit(1);
+       }
+     }
+     lines[cnt++] = p;
+     if ((q = strchr(p, '\n')) == NULL) {
+       break;
+     }
+     *q = '\0';
+     p = q + 1;
+   }
+   *cntp = cnt;
+   return lines;
+}
+
+static double seconds(void) {
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+static unsigned long scan_libc(char *line) {
+   char           id[ID_LEN];
+   char          *p = line;
+   size_t         len;
+   unsigned long  h = 0;
+   int            i;
+
+   while (isspace((unsigned char)*p)) {
+     p++;
+   }
+   len = strlen(p);
+   while (len && (isspace((unsigned char)p[len - 1])
+                  || ispunct((unsigned char)p[len - 1]))) {
+     len--;
+   }
+   for (i = 0; G_tags[i]; i++) {
+     if (strcasestr(p, G_tags[i]) != NULL) {
+       h += i + 1;
+     }
+   }
+   if (strncasecmp(p, "answer", 6) == 0) {
+     h += 7;
+   }
+   for (i = 0; (i < ID_LEN - 1) && (isdigit((unsigned char)p[i])
+                                    || isalpha((unsigned char)p[i])); i++) {
+     id[i] = (char)tolower((unsigned char)p[i]);
+   }
+   id[i] = '\0';
+   return h + len + (unsigned long)id[0];
+}
+
+static unsigned long scan_cc(char *line) {
+   char           id[ID_LEN];
+   char          *p = line;
+   size_t         len;
+   unsigned long  h = 0;
+   int            i;
+
+   while (CC_ISSPACE(*p)) {
+     p++;
+   }
+   len = strlen(p);
+   while (len && (CC_ISSPACE(p[len - 1]) || CC_ISPUNCT(p[len - 1]))) {
+     len--;
+   }
+   for (i = 0; G_tags[i]; i++) {
+     if (cc_strcasestr(p, G_tags[i]) != NULL) {
+       h += i + 1;
+     }
+   }
+   if (cc_strncasecmp(p, "answer", 6) == 0) {
+     h += 7;
+   }
+   for (i = 0; (i < ID_LEN - 1) && (CC_ISDIGIT(p[i])
+                                    || CC_ISALPHA(p[i])); i++) {
+     id[i] = (char)CC_TOLOWER(p[i]);
+   }
+   id[i] = '\0';
+   return h + len + (unsigned long)id[0];
+}
+
+static double run(char **lines, long cnt, int cc, int passes) {
+   // Best time over the passes, in seconds
+   unsigned long h;
+   double        best = 0;
+   double        t;
+   long          i;
+   int           p;
+
+   for (p = 0; p < passes; p++) {
+     h = 0;
+     t = seconds();
+     for (i = 0; i < cnt; i++) {
+       h += (cc ? scan_cc(lines[i]) : scan_libc(lines[i]));
+     }
+     t = seconds() - t;
+     G_sink ^= h;
+     if ((p == 0) || (t < best)) {
+       best = t;
+     }
+   }
+   return best;
+}
+
+int main(int argc, char **argv) {
+   char   **lines = NULL;
+   char   **file_lines;
+   char    *data;
+   double   total = 0;
+   double   t;
+   size_t   size;
+   long     cnt = 0;
+   long     n;
+   int      passes = PASSES;
+   int      ch;
+   int      i;
+
+   while ((ch = getopt(argc, argv, "n:")) != -1) {
+     switch (ch) {
+       case 'n':
+         if ((passes = atoi(optarg)) < 1) {
+           passes = 1;
+         }
+         break;
+       default:
+         fprintf(stderr, "Usage: %s [-n passes] file [file ...]\n",
+                         argv[0]);
+         return 1;
+     }
+   }
+   if (optind == argc) {
+     fprintf(stderr, "Usage: %s [-n passes] file [file ...]\n", argv[0]);
+     return 1;
+   }
+   for (i = optind; i < argc; i++) {
+     if ((data = read_all(argv[i], &size)) != NULL) {
+       total += (double)size;
+       file_lines = cut_lines(data, &n);
+       if ((lines = (char **)realloc(lines, sizeof(char *) * (cnt + n + 1)))
+             == NULL) {
+         perror("realloc");
+         return 1;
+       }
+       memcpy(lines + cnt, file_lines, sizeof(char *) * n);
+       cnt += n;
+       free(file_lines);
+     }
+   }
+   if (cnt == 0) {
+     fprintf(stderr, "Nothing to scan\n");
+     return 1;
+   }
+   printf("%ld lines, %.1f MB, best of %d\n", cnt, total / 1e6, passes);
+   t = run(lines, cnt, 0, passes);
+   printf("  libc     %8.3f s %8.0f MB/s\n", t, total / 1e6 / t);
+   t = run(lines, cnt, 1, passes);
+   printf("  chrclass %8.3f s %8.0f MB/s\n", t, total / 1e6 / t);
+   // The file data stays allocated until exit
+   free(lines);
+   return 0;
+}
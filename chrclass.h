@@ -0,0 +1,34 @@
+/*
+ *   Locale-independent character classification
+ *
+ *   Only ASCII characters are classified; bytes above 0x7F
+ *   (UTF-8 multibyte sequences) belong to no class and are
+ *   never case-folded, so they go through untouched.
+ */
+#ifndef CHRCLASS_H
+
+#define CHRCLASS_H
+
+#include <stddef.h>
+
+#define CC_SPACE   0x01
+#define CC_PUNCT   0x02
+#define CC_DIGIT   0x04
+#define CC_UPPER   0x08
+#define CC_LOWER   0x10
+
+extern const unsigned char G_cc_class[256];
+extern const unsigned char G_cc_lower[256];
+
+#define CC_ISSPACE(c)  (G_cc_class[(unsigned char)(c)] & CC_SPACE)
+#define CC_ISPUNCT(c)  (G_cc_class[(unsigned char)(c)] & CC_PUNCT)
+#define CC_ISDIGIT(c)  (G_cc_class[(unsigned char)(c)] & CC_DIGIT)
+#define CC_ISALPHA(c)  (G_cc_class[(unsigned char)(c)] & (CC_UPPER|CC_LOWER))
+#define CC_TOLOWER(c)  (G_cc_lower[(unsigned char)(c)])
+
+// ASCII case-insensitive replacements for the libc functions
+extern int   cc_strcasecmp(const char *s1, const char *s2);
+extern int   cc_strncasecmp(const char *s1, const char *s2, size_t n);
+extern char *cc_strcasestr(const char *haystack, const char *needle);
+
+#endif
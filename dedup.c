@@ -0,0 +1,329 @@
+/// \file  dedup.c
+/// \brief On-disk index of question hashes.
+/* -------------------------------------------------------------*
+
+   File layout:
+      header (DEDUP_HDR_T, 32 bytes)
+      capacity slots of DEDUP_KEY_LEN bytes
+
+   An all-zero slot is empty (a key that happens to be all
+   zeroes is stored with its last bit set). Linear probing;
+   the table is rebuilt twice as large in a new file, renamed
+   over the old one, when it gets 70% full.
+
+   The file is locked (flock) while in use, so that two runs
+   sharing an index don't corrupt it. A run waiting for the
+   lock may get it on a file that another run has just
+   replaced by a larger one: it then opens the path again.
+
+   Keys of a run are kept in a table in memory, with the same
+   layout, and only go to the file with dedup_commit(), once
+   the archive is written: if the run fails, its questions
+   aren't taken as already seen by the next one.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "dedup.h"
+
+#define DEDUP_MAGIC        "T2QIDX1"
+#define DEDUP_INIT_SLOTS   (1 << 16)
+#define DEDUP_MAX_LOAD     70      // Percent
+
+typedef struct dedup_hdr {
+          char      magic[8];
+          uint64_t  capacity;
+          uint64_t  count;
+          uint64_t  reserved;
+         } DEDUP_HDR_T;
+
+#define HDR(idx)   ((DEDUP_HDR_T *)((idx)->map))
+#define SLOT(idx, i) ((idx)->map + sizeof(DEDUP_HDR_T) \
+                      + (size_t)(i) * DEDUP_KEY_LEN)
+
+static const unsigned char G_empty_slot[DEDUP_KEY_LEN] = {0};
+
+static size_t file_size(uint64_t capacity) {
+   return sizeof(DEDUP_HDR_T) + (size_t)capacity * DEDUP_KEY_LEN;
+}
+
+static uint64_t key_slot(const unsigned char *key, uint64_t capacity) {
+   uint64_t h;
+
+   memcpy(&h, key, sizeof(h));
+   return h & (capacity - 1);
+}
+
+static int map_file(DEDUP_INDEX_T *idx, int fd, uint64_t capacity,
+                    int init) {
+   // Size (if init) and map fd as an index of capacity slots
+   DEDUP_HDR_T *hdr;
+   size_t       len = file_size(capacity);
+
+   if (init && (ftruncate(fd, (off_t)len) == -1)) {
+     perror("ftruncate");
+     return -1;
+   }
+   idx->map = (unsigned char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED, fd, 0);
+   if (idx->map == MAP_FAILED) {
+     perror("mmap");
+     idx->map = NULL;
+     return -1;
+   }
+   idx->maplen = len;
+   idx->capacity = capacity;
+   idx->fd = fd;
+   hdr = HDR(idx);
+   if (init) {
+     memcpy(hdr->magic, DEDUP_MAGIC, sizeof(hdr->magic));
+     hdr->capacity = capacity;
+     hdr->count = 0;
+   }
+   return 0;
+}
+
+static void unmap_file(DEDUP_INDEX_T *idx) {
+   if (idx->map) {
+     (void)munmap(idx->map, idx->maplen);
+     idx->map = NULL;
+     idx->maplen = 0;
+   }
+}
+
+static unsigned char *find_slot(unsigned char *slots, uint64_t capacity,
+                                const unsigned char *key) {
+   // Slot holding key, or the empty slot where it goes
+   uint64_t i = key_slot(key, capacity);
+
+   while (memcmp(slots + i * DEDUP_KEY_LEN, G_empty_slot, DEDUP_KEY_LEN)
+          && memcmp(slots + i * DEDUP_KEY_LEN, key, DEDUP_KEY_LEN)) {
+     i = (i + 1) & (capacity - 1);
+   }
+   return slots + i * DEDUP_KEY_LEN;
+}
+
+static void insert_key(DEDUP_INDEX_T *idx, const unsigned char *key) {
+   // Key known not to be there yet
+   memcpy(find_slot(SLOT(idx, 0), idx->capacity, key), key, DEDUP_KEY_LEN);
+   (HDR(idx)->count)++;
+}
+
+static void pending_grow(DEDUP_INDEX_T *idx) {
+   // Table of the keys of the run, twice as large
+   unsigned char *old = idx->pending;
+   uint64_t       oldcap = idx->pending_cap;
+   uint64_t       i;
+
+   idx->pending_cap = (oldcap ? 2 * oldcap : DEDUP_INIT_SLOTS);
+   if ((idx->pending = (unsigned char *)calloc(idx->pending_cap,
+                                               DEDUP_KEY_LEN)) == NULL) {
+     perror("calloc");
+     exit(1);
+   }
+   for (i = 0; i < oldcap; i++) {
+     if (memcmp(old + i * DEDUP_KEY_LEN, G_empty_slot, DEDUP_KEY_LEN)) {
+       memcpy(find_slot(idx->pending, idx->pending_cap,
+                        old + i * DEDUP_KEY_LEN),
+              old + i * DEDUP_KEY_LEN, DEDUP_KEY_LEN);
+     }
+   }
+   if (old) {
+     free(old);
+   }
+}
+
+static int grow(DEDUP_INDEX_T *idx) {
+   // Rehash into a file twice as large, then replace the old one
+   DEDUP_INDEX_T  newidx;
+   char          *tmppath;
+   int            fd;
+   uint64_t       i;
+
+   if ((tmppath = (char *)malloc(strlen(idx->path) + 5)) == NULL) {
+     perror("malloc");
+     return -1;
+   }
+   sprintf(tmppath, "%s.new", idx->path);
+   if ((fd = open(tmppath, O_RDWR | O_CREAT | O_TRUNC, 0644)) == -1) {
+     perror(tmppath);
+     free(tmppath);
+     return -1;
+   }
+   (void)flock(fd, LOCK_EX);
+   memset(&newidx, 0, sizeof(newidx));
+   if (map_file(&newidx, fd, 2 * idx->capacity, 1) == -1) {
+     close(fd);
+     (void)unlink(tmppath);
+     free(tmppath);
+     return -1;
+   }
+   for (i = 0; i < idx->capacity; i++) {
+     if (memcmp(SLOT(idx, i), G_empty_slot, DEDUP_KEY_LEN)) {
+       insert_key(&newidx, SLOT(idx, i));
+     }
+   }
+   if (rename(tmppath, idx->path) == -1) {
+     perror("rename");
+     unmap_file(&newidx);
+     close(fd);
+     (void)unlink(tmppath);
+     free(tmppath);
+     return -1;
+   }
+   free(tmppath);
+   unmap_file(idx);
+   close(idx->fd);
+   idx->map = newidx.map;
+   idx->maplen = newidx.maplen;
+   idx->capacity = newidx.capacity;
+   idx->fd = newidx.fd;
+   return 0;
+}
+
+extern DEDUP_INDEX_T *dedup_open(const char *path) {
+   DEDUP_INDEX_T *idx;
+   struct stat    st;
+   struct stat    cur;
+   DEDUP_HDR_T    hdr;
+   int            fd;
+   int            init;
+
+   if (!path) {
+     return NULL;
+   }
+   for (;;) {
+     if ((fd = open(path, O_RDWR | O_CREAT, 0644)) == -1) {
+       perror(path);
+       return NULL;
+     }
+     if (flock(fd, LOCK_EX) == -1) {
+       perror("flock");
+       close(fd);
+       return NULL;
+     }
+     if (fstat(fd, &st) == -1) {
+       perror(path);
+       close(fd);
+       return NULL;
+     }
+     if ((stat(path, &cur) == 0)
+         && (cur.st_dev == st.st_dev)
+         && (cur.st_ino == st.st_ino)) {
+       break;
+     }
+     // Replaced (grown) by another run while we were waiting
+     close(fd);
+   }
+   if ((idx = (DEDUP_INDEX_T *)calloc(1, sizeof(DEDUP_INDEX_T))) == NULL) {
+     perror("calloc");
+     close(fd);
+     return NULL;
+   }
+   idx->path = strdup(path);
+   init = (st.st_size == 0);
+   if (!init) {
+     if ((read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+         || memcmp(hdr.magic, DEDUP_MAGIC, sizeof(hdr.magic))
+         || (hdr.capacity == 0)
+         || (hdr.capacity & (hdr.capacity - 1))
+         || ((off_t)file_size(hdr.capacity) != st.st_size)) {
+       fprintf(stderr, "%s: not a txt2qti duplicate index\n", path);
+       close(fd);
+       free(idx->path);
+       free(idx);
+       return NULL;
+     }
+   }
+   if (map_file(idx, fd, (init ? DEDUP_INIT_SLOTS : hdr.capacity),
+                init) == -1) {
+     close(fd);
+     free(idx->path);
+     free(idx);
+     return NULL;
+   }
+   return idx;
+}
+
+extern int dedup_check_add(DEDUP_INDEX_T *idx, const unsigned char *key) {
+   unsigned char  k[DEDUP_KEY_LEN];
+   unsigned char *slot;
+
+   if (!idx || !idx->map || !key) {
+     return -1;
+   }
+   memcpy(k, key, DEDUP_KEY_LEN);
+   if (!memcmp(k, G_empty_slot, DEDUP_KEY_LEN)) {
+     k[DEDUP_KEY_LEN - 1] = 1;
+   }
+   if (memcmp(find_slot(SLOT(idx, 0), idx->capacity, k), G_empty_slot,
+              DEDUP_KEY_LEN)) {
+     return 1;
+   }
+   if ((idx->pending_cnt + 1) * 100 > idx->pending_cap * DEDUP_MAX_LOAD) {
+     pending_grow(idx);
+   }
+   slot = find_slot(idx->pending, idx->pending_cap, k);
+   if (memcmp(slot, G_empty_slot, DEDUP_KEY_LEN)) {
+     return 1;
+   }
+   memcpy(slot, k, DEDUP_KEY_LEN);
+   idx->pending_cnt++;
+   return 0;
+}
+
+extern int dedup_commit(DEDUP_INDEX_T *idx) {
+   unsigned char *k;
+   uint64_t       i;
+
+   if (!idx || !idx->map) {
+     return -1;
+   }
+   for (i = 0; i < idx->pending_cap; i++) {
+     k = idx->pending + i * DEDUP_KEY_LEN;
+     if (!memcmp(k, G_empty_slot, DEDUP_KEY_LEN)
+         || memcmp(find_slot(SLOT(idx, 0), idx->capacity, k),
+                   G_empty_slot, DEDUP_KEY_LEN)) {
+       continue;
+     }
+     if (((HDR(idx)->count + 1) * 100 > idx->capacity * DEDUP_MAX_LOAD)
+         && (grow(idx) == -1)) {
+       return -1;
+     }
+     insert_key(idx, k);
+   }
+   if (idx->pending) {
+     free(idx->pending);
+   }
+   idx->pending = NULL;
+   idx->pending_cap = 0;
+   idx->pending_cnt = 0;
+   return 0;
+}
+
+extern uint64_t dedup_count(DEDUP_INDEX_T *idx) {
+   return ((idx && idx->map) ? HDR(idx)->count : 0);
+}
+
+extern void dedup_close(DEDUP_INDEX_T *idx) {
+   if (idx) {
+     unmap_file(idx);
+     if (idx->fd != -1) {
+       close(idx->fd);    // Releases the lock
+     }
+     if (idx->pending) {
+       free(idx->pending);
+     }
+     free(idx->path);
+     free(idx);
+   }
+}
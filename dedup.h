@@ -0,0 +1,45 @@
+/*
+ *   Persistent index of question hashes, used to drop
+ *   questions that were already seen (in this run or in
+ *   previous ones).
+ *
+ *   The index is a file holding an open-addressing hash
+ *   table of 128-bit keys. It is mapped in memory, so a
+ *   lookup costs a couple of memory accesses whatever the
+ *   number of questions indexed.
+ */
+#ifndef DEDUP_H
+
+#define DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DEDUP_KEY_LEN   16
+
+typedef struct dedup_index {
+          int            fd;
+          char          *path;
+          unsigned char *map;
+          size_t         maplen;
+          uint64_t       capacity;   // Number of slots, power of 2
+          unsigned char *pending;    // Keys of this run, same layout
+          uint64_t       pending_cap;
+          uint64_t       pending_cnt;
+         } DEDUP_INDEX_T;
+
+// Opens (creating it if needed) and locks an index file.
+// Returns NULL (after printing why) on failure.
+extern DEDUP_INDEX_T *dedup_open(const char *path);
+// Returns 1 if key was already in the index or seen in this
+// run, otherwise notes it and returns 0. -1 on error.
+extern int            dedup_check_add(DEDUP_INDEX_T *idx,
+                                      const unsigned char *key);
+// Adds the keys noted since the last call to the index file,
+// once the archive is safely written. Returns 0 if OK, -1 on
+// error.
+extern int            dedup_commit(DEDUP_INDEX_T *idx);
+extern uint64_t       dedup_count(DEDUP_INDEX_T *idx);
+extern void           dedup_close(DEDUP_INDEX_T *idx);
+
+#endif
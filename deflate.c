@@ -0,0 +1,392 @@
+/// \file  deflate.c
+/// \brief Raw deflate engines for the zip entries.
+/* -------------------------------------------------------------*
+
+   The miniz engine runs tdefl over the whole buffer with a
+   compressor from the pool of mzpool.c, writing through a
+   callback that stops as soon as the output would reach the
+   limit. Fragments are fed to tdefl one after the other; its
+   output is exactly what mz_zip_writer_add_mem() would have
+   produced from the same bytes in one buffer. It can also
+   deflate a stream piece by piece, each piece ending with a
+   sync flush (an empty stored block) instead of the final
+   block.
+
+   libdeflate isn't needed to build: it is opened with dlopen()
+   when selected, and its few entry points are looked up by
+   name (they have been stable since version 1.0). There is no
+   falling back to miniz when it is missing: the output of the
+   two differs, and whoever asked for libdeflate must know
+   that they didn't get it. Compressors are allocated once per
+   thread and level and released when the thread ends.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+#include "miniz.h"
+#include "mzpool.h"
+#include "deflate.h"
+
+#define LIBDEFLATE_SO   "libdeflate.so.0"
+
+// ---------------------------------------------------------- miniz
+
+typedef struct tdefl_out {
+          unsigned char *buf;
+          size_t         len;
+          size_t         max;
+         } TDEFL_OUT_T;
+
+typedef struct tdefl_state {
+          tdefl_compressor *comp;
+          int               level;
+         } TDEFL_STATE_T;
+
+static mz_bool tdefl_put(const void *buf, int len, void *user) {
+   TDEFL_OUT_T *out = (TDEFL_OUT_T *)user;
+
+   if (out->len + (size_t)len > out->max) {
+     return MZ_FALSE;
+   }
+   memcpy(out->buf + out->len, buf, (size_t)len);
+   out->len += (size_t)len;
+   return MZ_TRUE;
+}
+
+static void *miniz_init(int level) {
+   TDEFL_STATE_T *st;
+
+   if ((st = (TDEFL_STATE_T *)malloc(sizeof(TDEFL_STATE_T))) == NULL) {
+     return NULL;
+   }
+   // The compressor itself comes from the pool at each call
+   st->level = level;
+   st->comp = NULL;
+   return st;
+}
+
+static int miniz_compress_part(void *state, const struct iovec *iov,
+                               int cnt, size_t len, void *out,
+                               size_t *outlenp, int last) {
+   // Fragments are fed one after the other, tdefl keeps what
+   // it needs in its dictionary
+   TDEFL_STATE_T *st = (TDEFL_STATE_T *)state;
+   TDEFL_OUT_T    o;
+   tdefl_status   status = TDEFL_STATUS_BAD_PARAM;
+   tdefl_status   expected = (last ? TDEFL_STATUS_DONE : TDEFL_STATUS_OKAY);
+   int            i;
+
+   (void)len;
+   o.buf = (unsigned char *)out;
+   o.len = 0;
+   o.max = *outlenp;
+   if ((st->comp = (tdefl_compressor *)mzpool_alloc(NULL, 1,
+                                     sizeof(tdefl_compressor))) == NULL) {
+     return -1;
+   }
+   if (tdefl_init(st->comp, tdefl_put, &o,
+                  tdefl_create_comp_flags_from_zip_params(st->level, -15,
+                                                   MZ_DEFAULT_STRATEGY))
+         == TDEFL_STATUS_OKAY) {
+     status = TDEFL_STATUS_OKAY;
+     for (i = 0; (i < cnt) && (status == TDEFL_STATUS_OKAY); i++) {
+       status = tdefl_compress_buffer(st->comp, iov[i].iov_base,
+                                      iov[i].iov_len, TDEFL_NO_FLUSH);
+     }
+     if (status == TDEFL_STATUS_OKAY) {
+       status = tdefl_compress_buffer(st->comp, NULL, 0,
+                                      (last ? TDEFL_FINISH
+                                            : TDEFL_SYNC_FLUSH));
+     }
+   }
+   mzpool_free(NULL, st->comp);
+   st->comp = NULL;
+   if (status != expected) {
+     return -1;
+   }
+   *outlenp = o.len;
+   return 0;
+}
+
+static int miniz_compress(void *state, const struct iovec *iov, int cnt,
+                          size_t len, void *out, size_t *outlenp) {
+   return miniz_compress_part(state, iov, cnt, len, out, outlenp, 1);
+}
+
+static size_t miniz_bound(void *state, size_t len) {
+   (void)state;
+   // Stored blocks at worst: 5 bytes per 64 KB block
+   return len + 5 * (len / 65535 + 1) + 16;
+}
+
+static void miniz_finish(void *state) {
+   free(state);
+}
+
+static unsigned int miniz_crc(unsigned int crc, const void *buf,
+                              size_t len) {
+   return (unsigned int)mz_crc32(crc, (const unsigned char *)buf, len);
+}
+
+// ----------------------------------------------------- libdeflate
+
+static void *G_ld_handle = NULL;
+static void *(*G_ld_alloc)(int);
+static size_t (*G_ld_compress)(void *, const void *, size_t, void *,
+                               size_t);
+static size_t (*G_ld_bound)(void *, size_t);
+static void (*G_ld_free)(void *);
+static uint32_t (*G_ld_crc32)(uint32_t, const void *, size_t);
+
+static int libdeflate_load(void) {
+   if (G_ld_handle) {
+     return 0;
+   }
+   if ((G_ld_handle = dlopen(LIBDEFLATE_SO, RTLD_NOW)) == NULL) {
+     fprintf(stderr, "libdeflate: %s\n"
+                     "libdeflate isn't bundled: install it (%s) or use"
+                     " the miniz engine\n", dlerror(), LIBDEFLATE_SO);
+     return -1;
+   }
+   *(void **)&G_ld_alloc = dlsym(G_ld_handle,
+                                 "libdeflate_alloc_compressor");
+   *(void **)&G_ld_compress = dlsym(G_ld_handle,
+                                    "libdeflate_deflate_compress");
+   *(void **)&G_ld_bound = dlsym(G_ld_handle,
+                                 "libdeflate_deflate_compress_bound");
+   *(void **)&G_ld_free = dlsym(G_ld_handle, "libdeflate_free_compressor");
+   *(void **)&G_ld_crc32 = dlsym(G_ld_handle, "libdeflate_crc32");
+   if (!G_ld_alloc || !G_ld_compress || !G_ld_bound
+       || !G_ld_free || !G_ld_crc32) {
+     fprintf(stderr, "libdeflate: %s lacks the expected functions\n",
+                     LIBDEFLATE_SO);
+     dlclose(G_ld_handle);
+     G_ld_handle = NULL;
+     return -1;
+   }
+   return 0;
+}
+
+static void *libdeflate_init(int level) {
+   return G_ld_alloc(level);
+}
+
+static int libdeflate_compress(void *state, const struct iovec *iov,
+                               int cnt, size_t len, void *out,
+                               size_t *outlenp) {
+   // Whole buffers only: fragments are gathered first
+   char   *in;
+   size_t  ofs = 0;
+   size_t  n;
+   int     i;
+
+   if (cnt == 1) {
+     n = G_ld_compress(state, iov[0].iov_base, len, out, *outlenp);
+   } else {
+     if ((in = (char *)malloc(len ? len : 1)) == NULL) {
+       perror("malloc");
+       exit(1);
+     }
+     for (i = 0; i < cnt; i++) {
+       memcpy(in + ofs, iov[i].iov_base, iov[i].iov_len);
+       ofs += iov[i].iov_len;
+     }
+     n = G_ld_compress(state, in, len, out, *outlenp);
+     free(in);
+   }
+   if (n == 0) {
+     return -1;
+   }
+   *outlenp = n;
+   return 0;
+}
+
+static size_t libdeflate_bound(void *state, size_t len) {
+   return G_ld_bound(state, len);
+}
+
+static void libdeflate_finish(void *state) {
+   G_ld_free(state);
+}
+
+static unsigned int libdeflate_crc(unsigned int crc, const void *buf,
+                                   size_t len) {
+   return (unsigned int)G_ld_crc32(crc, buf, len);
+}
+
+// -------------------------------------------------------- engines
+
+static const DEFLATE_ENGINE_T G_engines[] = {
+          {"miniz", miniz_init, miniz_compress, miniz_bound,
+                    miniz_compress_part, miniz_finish, miniz_crc},
+          // Always ends its output with a final block
+          {"libdeflate", libdeflate_init, libdeflate_compress,
+                         libdeflate_bound, NULL, libdeflate_finish,
+                         libdeflate_crc},
+          {NULL, NULL, NULL, NULL, NULL, NULL, NULL}};
+
+static const DEFLATE_ENGINE_T *G_engine = &G_engines[0];
+static pthread_key_t           G_state_key;
+static pthread_once_t          G_state_once = PTHREAD_ONCE_INIT;
+
+typedef struct thread_state {
+          const DEFLATE_ENGINE_T *engine;
+          void                   *state;
+         } THREAD_STATE_T;
+
+static void release_state(void *arg) {
+   THREAD_STATE_T *ts = (THREAD_STATE_T *)arg;
+
+   if (ts->state) {
+     ts->engine->finish(ts->state);
+   }
+   free(ts);
+}
+
+static void make_key(void) {
+   if (pthread_key_create(&G_state_key, release_state)) {
+     perror("pthread_key_create");
+     exit(1);
+   }
+}
+
+static void *thread_state(void) {
+   // Compressor of the selected engine for this thread
+   THREAD_STATE_T *ts;
+
+   (void)pthread_once(&G_state_once, make_key);
+   if ((ts = (THREAD_STATE_T *)pthread_getspecific(G_state_key)) == NULL) {
+     if ((ts = (THREAD_STATE_T *)calloc(1, sizeof(THREAD_STATE_T)))
+           == NULL) {
+       perror("calloc");
+       exit(1);
+     }
+     (void)pthread_setspecific(G_state_key, ts);
+   }
+   if (ts->engine != G_engine) {
+     if (ts->state) {
+       ts->engine->finish(ts->state);
+     }
+     ts->engine = G_engine;
+     if ((ts->state = G_engine->init(DEFLATE_LEVEL)) == NULL) {
+       perror(G_engine->name);
+       exit(1);
+     }
+   }
+   return ts->state;
+}
+
+extern int deflate_select(const char *name) {
+   int i;
+
+   for (i = 0; G_engines[i].name; i++) {
+     if (strcmp(G_engines[i].name, name) == 0) {
+       if ((G_engines[i].init == libdeflate_init)
+           && (libdeflate_load() == -1)) {
+         return -1;
+       }
+       G_engine = &G_engines[i];
+       return 0;
+     }
+   }
+   fprintf(stderr, "Unknown deflate engine %s (use %s)\n",
+                   name, deflate_engines());
+   return -1;
+}
+
+extern const char *deflate_name(void) {
+   return G_engine->name;
+}
+
+extern const char *deflate_engines(void) {
+   return "miniz, libdeflate";
+}
+
+extern void *deflate_iov(const struct iovec *iov, int cnt, size_t max,
+                         size_t *outlenp) {
+   void   *state = thread_state();
+   void   *out;
+   size_t  len = 0;
+   size_t  n;
+   int     i;
+
+   for (i = 0; i < cnt; i++) {
+     len += iov[i].iov_len;
+   }
+   n = G_engine->bound(state, len);
+   if (max && (n >= max)) {
+     n = max - 1;
+   }
+   if ((out = malloc(n ? n : 1)) == NULL) {
+     perror("malloc");
+     exit(1);
+   }
+   if (G_engine->compress(state, iov, cnt, len, out, &n) == -1) {
+     free(out);
+     return NULL;
+   }
+   *outlenp = n;
+   return out;
+}
+
+extern void *deflate_buffer(const void *in, size_t len, size_t max,
+                            size_t *outlenp) {
+   struct iovec iov;
+
+   iov.iov_base = (void *)in;
+   iov.iov_len = len;
+   return deflate_iov(&iov, 1, max, outlenp);
+}
+
+extern void *deflate_part(const struct iovec *iov, int cnt, int last,
+                          size_t *outlenp) {
+   void   *state;
+   void   *out;
+   size_t  len = 0;
+   size_t  n;
+   int     i;
+
+   if (G_engine->compress_part == NULL) {
+     return NULL;
+   }
+   state = thread_state();
+   for (i = 0; i < cnt; i++) {
+     len += iov[i].iov_len;
+   }
+   // Room for the empty stored block of the sync flush
+   n = G_engine->bound(state, len) + 8;
+   if ((out = malloc(n)) == NULL) {
+     perror("malloc");
+     exit(1);
+   }
+   if (G_engine->compress_part(state, iov, cnt, len, out, &n, last) == -1) {
+     free(out);
+     return NULL;
+   }
+   *outlenp = n;
+   return out;
+}
+
+extern int deflate_can_split(void) {
+   return (G_engine->compress_part != NULL);
+}
+
+extern unsigned int deflate_crc32(const void *buf, size_t len) {
+   return G_engine->crc(0, buf, len);
+}
+
+extern unsigned int deflate_crc32_iov(const struct iovec *iov, int cnt) {
+   unsigned int crc = 0;
+   int          i;
+
+   for (i = 0; i < cnt; i++) {
+     crc = G_engine->crc(crc, iov[i].iov_base, iov[i].iov_len);
+   }
+   return crc;
+}
@@ -0,0 +1,68 @@
+/*
+ *   Raw deflate streams for the zip entries.
+ *
+ *   Entries are compressed whole, from a buffer, by one of
+ *   several engines behind the same interface: miniz's tdefl
+ *   (built in, the default) or libdeflate, much faster on
+ *   whole buffers, loaded at run time if the system has it.
+ *   The engine only changes the compressed bytes; the entries
+ *   read back the same.
+ */
+#ifndef DEFLATE_H
+
+#define DEFLATE_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define DEFLATE_LEVEL    6      // As MZ_DEFAULT_LEVEL
+
+typedef struct deflate_engine {
+          const char   *name;
+          // Compressor state, kept by each thread that uses it
+          void       *(*init)(int level);
+          // Raw deflate of the len bytes of the cnt fragments of
+          // iov into out, at most *outlenp bytes. Returns 0 and
+          // the size in *outlenp, -1 if it doesn't fit.
+          int         (*compress)(void *state, const struct iovec *iov,
+                                  int cnt, size_t len, void *out,
+                                  size_t *outlenp);
+          // Largest possible output for len bytes
+          size_t      (*bound)(void *state, size_t len);
+          // As compress, but the output ends on a byte boundary
+          // without closing the stream unless last is set, so that
+          // pieces deflated separately can be put end to end.
+          // NULL if the engine can't.
+          int         (*compress_part)(void *state,
+                                       const struct iovec *iov, int cnt,
+                                       size_t len, void *out,
+                                       size_t *outlenp, int last);
+          void        (*finish)(void *state);
+          unsigned int (*crc)(unsigned int crc, const void *buf,
+                              size_t len);
+         } DEFLATE_ENGINE_T;
+
+// Selects the engine by name. Returns 0 if OK, -1 (after
+// printing why) if it's unknown or can't be loaded.
+extern int          deflate_select(const char *name);
+extern const char  *deflate_name(void);
+// Names of all engines, separated by commas
+extern const char  *deflate_engines(void);
+// Raw deflate of the len bytes of in with the selected engine.
+// Returns a malloc'd buffer and its size in *outlenp, or NULL
+// if the result wouldn't be smaller than max (0: no limit).
+extern void        *deflate_buffer(const void *in, size_t len,
+                                   size_t max, size_t *outlenp);
+// Same for the cnt fragments of iov, taken as one text
+extern void        *deflate_iov(const struct iovec *iov, int cnt,
+                                size_t max, size_t *outlenp);
+// Same for one piece of a stream (see compress_part), NULL if
+// the selected engine can't deflate pieces.
+extern void        *deflate_part(const struct iovec *iov, int cnt,
+                                 int last, size_t *outlenp);
+extern int          deflate_can_split(void);
+// CRC-32 as stored in zip entries, of a buffer or of fragments
+extern unsigned int deflate_crc32(const void *buf, size_t len);
+extern unsigned int deflate_crc32_iov(const struct iovec *iov, int cnt);
+
+#endif
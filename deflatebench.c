@@ -0,0 +1,167 @@
+/// \file  deflatebench.c
+/// \brief Deflate speed of the bundled miniz, level by level.
+/* -------------------------------------------------------------*
+
+   make deflatebench; ./deflatebench [-n passes] file [file ...]
+
+   Meant to be run on what txt2qti actually compresses, for
+   instance an assessment taken out of an archive with
+   unzip -p quiz.zip 'i*.xml' > assessment.xml
+
+   Files are read into memory first; each is deflated whole,
+   with the flags that the zip writer uses, at levels 1 to 9,
+   and the best of the passes is kept. Setting MINIZ_NO_SIMD
+   in the environment times the 8-byte match comparison
+   instead of the vector ones.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "miniz.h"
+
+#define PASSES   3
+
+typedef struct corpus_file {
+          char   *data;
+          size_t  size;
+         } CORPUS_FILE_T;
+
+static char *read_all(const char *name, size_t *sizep) {
+   FILE   *fp;
+   char   *data = NULL;
+   size_t  alloc = 0;
+   size_t  size = 0;
+   size_t  n;
+
+   if ((fp = fopen(name, "r")) == NULL) {
+     perror(name);
+     return NULL;
+   }
+   do {
+     if (size == alloc) {
+       alloc = (alloc ? 2 * alloc : 65536);
+       if ((data = (char *)realloc(data, alloc)) == NULL) {
+         perror("realloc");
+         exit(1);
+       }
+     }
+     n = fread(data + size, 1, alloc - size, fp);
+     size += n;
+   } while (n);
+   fclose(fp);
+   *sizep = size;
+   return data;
+}
+
+static double seconds(void) {
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+static mz_bool count_out(const void *buf, int len, void *user) {
+   // Output is only counted
+   (void)buf;
+   *(size_t *)user += (size_t)len;
+   return MZ_TRUE;
+}
+
+static double run(tdefl_compressor *comp, CORPUS_FILE_T *files, int cnt,
+                  int level, int passes, size_t *outp) {
+   // Best time over the passes, in seconds
+   double best = 0;
+   double t;
+   size_t out;
+   int    p;
+   int    i;
+
+   for (p = 0; p < passes; p++) {
+     out = 0;
+     t = seconds();
+     for (i = 0; i < cnt; i++) {
+       if ((tdefl_init(comp, count_out, &out,
+                       tdefl_create_comp_flags_from_zip_params(level, -15,
+                                                  MZ_DEFAULT_STRATEGY))
+              != TDEFL_STATUS_OKAY)
+           || (tdefl_compress_buffer(comp, files[i].data, files[i].size,
+                                     TDEFL_FINISH) != TDEFL_STATUS_DONE)) {
+         fprintf(stderr, "Deflate failed at level %d\n", level);
+         exit(1);
+       }
+     }
+     t = seconds() - t;
+     if ((p == 0) || (t < best)) {
+       best = t;
+     }
+   }
+   *outp = out;
+   return best;
+}
+
+int main(int argc, char **argv) {
+   CORPUS_FILE_T    *files;
+   tdefl_compressor *comp;
+   double            total = 0;
+   double            t;
+   size_t            out;
+   int               passes = PASSES;
+   int               cnt = 0;
+   int               level;
+   int               ch;
+   int               i;
+
+   while ((ch = getopt(argc, argv, "n:")) != -1) {
+     switch (ch) {
+       case 'n':
+         if ((passes = atoi(optarg)) < 1) {
+           passes = 1;
+         }
+         break;
+       default:
+         fprintf(stderr, "Usage: %s [-n passes] file [file ...]\n",
+                         argv[0]);
+         return 1;
+     }
+   }
+   if (optind == argc) {
+     fprintf(stderr, "Usage: %s [-n passes] file [file ...]\n", argv[0]);
+     return 1;
+   }
+   if (((files = (CORPUS_FILE_T *)calloc(argc - optind,
+                                         sizeof(CORPUS_FILE_T))) == NULL)
+       || ((comp = (tdefl_compressor *)malloc(sizeof(tdefl_compressor)))
+             == NULL)) {
+     perror("malloc");
+     return 1;
+   }
+   for (i = optind; i < argc; i++) {
+     if ((files[cnt].data = read_all(argv[i], &(files[cnt].size)))
+           != NULL) {
+       total += (double)files[cnt].size;
+       cnt++;
+     }
+   }
+   if (total == 0) {
+     fprintf(stderr, "Nothing to deflate\n");
+     return 1;
+   }
+   printf("%d file%s, %.1f MB, best of %d%s\n", cnt, (cnt > 1 ? "s" : ""),
+          total / 1e6, passes,
+          (getenv("MINIZ_NO_SIMD") ? " (MINIZ_NO_SIMD)" : ""));
+   for (level = 1; level <= 9; level++) {
+     t = run(comp, files, cnt, level, passes, &out);
+     printf("  level %d %8.3f s %8.1f MB/s %6.1f %%\n", level, t,
+            total / 1e6 / t, 100.0 * (double)out / total);
+   }
+   for (i = 0; i < cnt; i++) {
+     free(files[i].data);
+   }
+   free(files);
+   free(comp);
+   return 0;
+}
@@ -0,0 +1,206 @@
+/// \file  fasthash.c
+/// \brief Fast 128-bit content hash.
+/* -------------------------------------------------------------*
+
+   Follows the structure of XXH3: input is consumed in 64-byte
+   stripes, each 64-bit lane being mixed with a key word through
+   a 32x32->64 multiply and accumulated; accumulators are
+   scrambled every FH_BLOCK_STRIPES stripes, then folded into
+   two 64-bit halves with a strong avalanche at the end.
+
+   The 32x32 multiply maps on _mm_mul_epu32, so the stripe loop
+   uses SSE2 when the compiler targets it (all x86_64) and plain
+   C otherwise. Both give identical results.
+
+   It is NOT the reference XXH3 (values differ) and must not be
+   used where collisions could be provoked on purpose.
+
+ * -------------------------------------------------------------*/
+
+#include <string.h>
+#include <pthread.h>
+
+#include "fasthash.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define PRIME32_1  0x9E3779B1U
+#define PRIME64_1  0x9E3779B185EBCA87ULL
+#define PRIME64_2  0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3  0x165667B19E3779F9ULL
+#define PRIME64_4  0x85EBCA77C2B2AE63ULL
+
+#define KEY_WORDS  (FH_LANES + FH_BLOCK_STRIPES)
+
+static uint64_t       G_fh_key[KEY_WORDS];
+static pthread_once_t G_fh_key_once = PTHREAD_ONCE_INIT;
+
+static uint64_t avalanche(uint64_t h) {
+   h ^= h >> 37;
+   h *= 0x165667919E3779F9ULL;
+   h ^= h >> 32;
+   return h;
+}
+
+static void init_key(void) {
+   // Key words from splitmix64 - fixed, so hashes are stable
+   uint64_t s = PRIME64_3;
+   uint64_t z;
+   int      i;
+
+   for (i = 0; i < KEY_WORDS; i++) {
+     z = (s += 0x9E3779B97F4A7C15ULL);
+     z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+     z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+     G_fh_key[i] = z ^ (z >> 31);
+   }
+}
+
+#ifndef __SSE2__
+static uint64_t read64(const unsigned char *p) {
+   uint64_t v;
+
+   memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+   v = __builtin_bswap64(v);
+#endif
+   return v;
+}
+#endif
+
+static void accumulate_stripe(uint64_t *acc,
+                              const unsigned char *p,
+                              const uint64_t *key) {
+#ifdef __SSE2__
+   int i;
+
+   for (i = 0; i < FH_LANES; i += 2) {
+     __m128i a = _mm_loadu_si128((const __m128i *)(void *)&acc[i]);
+     __m128i d = _mm_loadu_si128((const __m128i *)(const void *)(p + 8 * i));
+     __m128i k = _mm_loadu_si128((const __m128i *)(const void *)&key[i]);
+     __m128i dk = _mm_xor_si128(d, k);
+     __m128i prod = _mm_mul_epu32(dk, _mm_srli_epi64(dk, 32));
+     // Add the data of the neighbour lane (swap the two 64-bit halves)
+     __m128i sw = _mm_shuffle_epi32(d, _MM_SHUFFLE(1, 0, 3, 2));
+
+     a = _mm_add_epi64(a, _mm_add_epi64(prod, sw));
+     _mm_storeu_si128((__m128i *)(void *)&acc[i], a);
+   }
+#else
+   uint64_t d[FH_LANES];
+   uint64_t dk;
+   int      i;
+
+   for (i = 0; i < FH_LANES; i++) {
+     d[i] = read64(p + 8 * i);
+   }
+   for (i = 0; i < FH_LANES; i++) {
+     dk = d[i] ^ key[i];
+     acc[i] += (dk & 0xFFFFFFFFULL) * (dk >> 32) + d[i ^ 1];
+   }
+#endif
+}
+
+static void scramble(uint64_t *acc) {
+   int i;
+
+   for (i = 0; i < FH_LANES; i++) {
+     acc[i] ^= acc[i] >> 47;
+     acc[i] ^= G_fh_key[KEY_WORDS - 1 - i];
+     acc[i] *= PRIME32_1;
+   }
+}
+
+static void consume_stripe(FH128_CTX *ctx, const unsigned char *p) {
+   accumulate_stripe(ctx->acc, p, &(G_fh_key[ctx->stripes]));
+   if (++(ctx->stripes) == FH_BLOCK_STRIPES) {
+     scramble(ctx->acc);
+     ctx->stripes = 0;
+   }
+}
+
+extern void FH128_Init(FH128_CTX *ctx) {
+   // Media workers and the parser hash at the same time
+   (void)pthread_once(&G_fh_key_once, init_key);
+   ctx->acc[0] = PRIME32_1;
+   ctx->acc[1] = PRIME64_1;
+   ctx->acc[2] = PRIME64_2;
+   ctx->acc[3] = PRIME64_3;
+   ctx->acc[4] = PRIME64_4;
+   ctx->acc[5] = PRIME32_1 ^ PRIME64_2;
+   ctx->acc[6] = PRIME64_1 ^ PRIME64_4;
+   ctx->acc[7] = PRIME64_3 + PRIME32_1;
+   ctx->buffered = 0;
+   ctx->stripes = 0;
+   ctx->total_len = 0;
+}
+
+extern void FH128_Update(FH128_CTX *ctx, const void *data, unsigned long size) {
+   const unsigned char *p = (const unsigned char *)data;
+   unsigned long        n;
+
+   ctx->total_len += size;
+   if (ctx->buffered) {
+     n = FH_STRIPE_LEN - ctx->buffered;
+     if (n > size) {
+       n = size;
+     }
+     memcpy(&(ctx->buffer[ctx->buffered]), p, n);
+     ctx->buffered += n;
+     p += n;
+     size -= n;
+     if (ctx->buffered < FH_STRIPE_LEN) {
+       return;
+     }
+     consume_stripe(ctx, ctx->buffer);
+     ctx->buffered = 0;
+   }
+   while (size >= FH_STRIPE_LEN) {
+     consume_stripe(ctx, p);
+     p += FH_STRIPE_LEN;
+     size -= FH_STRIPE_LEN;
+   }
+   if (size) {
+     memcpy(ctx->buffer, p, size);
+     ctx->buffered = (unsigned int)size;
+   }
+}
+
+extern void FH128_Final(unsigned char *result, FH128_CTX *ctx) {
+   uint64_t lo;
+   uint64_t hi;
+   int      i;
+
+   if (ctx->buffered) {
+     // Last partial stripe, zero-padded (length goes in below)
+     memset(&(ctx->buffer[ctx->buffered]), 0,
+            FH_STRIPE_LEN - ctx->buffered);
+     accumulate_stripe(ctx->acc, ctx->buffer, &(G_fh_key[ctx->stripes]));
+   }
+   scramble(ctx->acc);
+   lo = ctx->total_len * PRIME64_1;
+   hi = ~(ctx->total_len * PRIME64_4);
+   for (i = 0; i < FH_LANES; i += 2) {
+     lo += (ctx->acc[i] ^ G_fh_key[i]) * (ctx->acc[i + 1] | 1);
+     hi += (ctx->acc[i + 1] ^ G_fh_key[i + 1]) * (ctx->acc[i] | 1);
+     lo = (lo << 31) | (lo >> 33);
+     hi = (hi << 27) | (hi >> 37);
+   }
+   lo = avalanche(lo ^ (hi >> 29));
+   hi = avalanche(hi + lo * PRIME64_2);
+   for (i = 0; i < 8; i++) {
+     result[i] = (unsigned char)(lo >> (56 - 8 * i));
+     result[8 + i] = (unsigned char)(hi >> (56 - 8 * i));
+   }
+   memset(ctx, 0, sizeof(*ctx));
+}
+
+extern void fh128(const void *data, unsigned long size, unsigned char *result) {
+   FH128_CTX ctx;
+
+   FH128_Init(&ctx);
+   FH128_Update(&ctx, data, size);
+   FH128_Final(result, &ctx);
+}
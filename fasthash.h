@@ -0,0 +1,36 @@
+/*
+ *   Fast non-cryptographic 128-bit hash (xxh3-style)
+ *
+ *   Meant for content identifiers, cache keys and duplicate
+ *   detection, where MD5 is needlessly slow. Same calling
+ *   sequence as the MD5 functions in md5.h. The result only
+ *   depends on the bytes hashed, not on how they were split
+ *   across FH128_Update() calls, and is the same with or
+ *   without SSE2.
+ */
+#ifndef FASTHASH_H
+
+#define FASTHASH_H
+
+#include <stdint.h>
+
+#define FH_LANES          8
+#define FH_STRIPE_LEN    64    // FH_LANES * 8 bytes
+#define FH_BLOCK_STRIPES 16    // Scramble after this many stripes
+
+typedef struct {
+        uint64_t      acc[FH_LANES];
+        unsigned char buffer[FH_STRIPE_LEN];
+        unsigned int  buffered;
+        unsigned int  stripes;    // Stripes in current block
+        uint64_t      total_len;
+       } FH128_CTX;
+
+extern void FH128_Init(FH128_CTX *ctx);
+extern void FH128_Update(FH128_CTX *ctx, const void *data, unsigned long size);
+extern void FH128_Final(unsigned char *result, FH128_CTX *ctx);
+
+// One-shot convenience: 16 bytes into result
+extern void fh128(const void *data, unsigned long size, unsigned char *result);
+
+#endif
@@ -0,0 +1,155 @@
+/// \file  frags.c
+/// \brief Lists of output fragments.
+/* -------------------------------------------------------------*
+
+   A growable array of struct iovec with an ownership flag for
+   each entry. Questions moved to the spill file are borrowed
+   from it. Nothing is ever copied, except by frags_gather()
+   for the few uses (--verify) that want a single string.
+   Lists are joined by copying descriptors (16 bytes for a
+   question), never what they point to.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "frags.h"
+#include "spill.h"
+
+#define FRAGS_CHUNK  256
+
+// Values of the ownership flag
+#define FRAG_BORROWED  0
+#define FRAG_OWNED     1
+#define FRAG_COUNTED   2     // Owned, and counted by spill.c
+
+static void frags_room(FRAGS_T *f) {
+   if (f->cnt == f->alloc) {
+     f->alloc = (f->alloc ? 2 * f->alloc : FRAGS_CHUNK);
+     if (((f->iov = (struct iovec *)realloc(f->iov,
+                                     sizeof(struct iovec) * f->alloc))
+            == NULL)
+         || ((f->owned = (char *)realloc(f->owned, f->alloc)) == NULL)) {
+       perror("realloc");
+       exit(1);
+     }
+   }
+}
+
+extern void frags_init(FRAGS_T *f) {
+   memset(f, 0, sizeof(FRAGS_T));
+}
+
+extern void frags_add(FRAGS_T *f, const char *s, size_t len) {
+   if (len == 0) {
+     return;
+   }
+   frags_room(f);
+   f->iov[f->cnt].iov_base = (void *)s;
+   f->iov[f->cnt].iov_len = len;
+   f->owned[f->cnt] = FRAG_BORROWED;
+   f->cnt++;
+   f->len += len;
+}
+
+extern void frags_take(FRAGS_T *f, char *s, size_t len) {
+   if (len == 0) {
+     free(s);
+     return;
+   }
+   frags_add(f, s, len);
+   f->owned[f->cnt - 1] = FRAG_OWNED;
+}
+
+extern void frags_keep(FRAGS_T *f, char *s, size_t len) {
+   char spilled;
+
+   if (len == 0) {
+     free(s);
+     return;
+   }
+   s = spill_keep(s, len, &spilled);
+   frags_add(f, s, len);
+   if (!spilled) {
+     f->owned[f->cnt - 1] = FRAG_COUNTED;
+   }
+}
+
+static void frag_free(FRAGS_T *f, int i) {
+   if (f->owned[i] == FRAG_COUNTED) {
+     spill_release(f->iov[i].iov_len);
+   }
+   if (f->owned[i] != FRAG_BORROWED) {
+     free(f->iov[i].iov_base);
+   }
+}
+
+extern void frags_replace(FRAGS_T *f, int i, char *s, size_t len) {
+   frag_free(f, i);
+   f->len -= f->iov[i].iov_len;
+   f->iov[i].iov_base = s;
+   f->iov[i].iov_len = len;
+   f->owned[i] = FRAG_OWNED;
+   f->len += len;
+}
+
+extern void frags_append(FRAGS_T *f, FRAGS_T *g, int first, int cnt) {
+   int i;
+
+   for (i = first; i < first + cnt; i++) {
+     frags_add(f, (const char *)g->iov[i].iov_base, g->iov[i].iov_len);
+   }
+}
+
+extern void frags_splice(FRAGS_T *f, FRAGS_T *g) {
+   FRAGS_T tmp;
+
+   if (f->cnt == 0) {
+     tmp = *f;
+     *f = *g;
+     *g = tmp;
+     return;
+   }
+   frags_append(f, g, 0, g->cnt);
+   memcpy(f->owned + f->cnt - g->cnt, g->owned, g->cnt);
+   g->cnt = 0;
+   g->len = 0;
+}
+
+extern char *frags_gather(FRAGS_T *f) {
+   char   *s;
+   size_t  ofs = 0;
+   int     i;
+
+   if ((s = (char *)malloc(f->len + 1)) == NULL) {
+     perror("malloc");
+     exit(1);
+   }
+   for (i = 0; i < f->cnt; i++) {
+     memcpy(s + ofs, f->iov[i].iov_base, f->iov[i].iov_len);
+     ofs += f->iov[i].iov_len;
+   }
+   s[ofs] = '\0';
+   return s;
+}
+
+extern void frags_clear(FRAGS_T *f) {
+   int i;
+
+   for (i = 0; i < f->cnt; i++) {
+     frag_free(f, i);
+   }
+   f->cnt = 0;
+   f->len = 0;
+}
+
+extern void frags_dispose(FRAGS_T *f) {
+   frags_clear(f);
+   if (f->iov) {
+     free(f->iov);
+     free(f->owned);
+   }
+   frags_init(f);
+}
@@ -0,0 +1,50 @@
+/*
+ *   Output built as a list of fragments instead of one string.
+ *
+ *   Each question is generated once, as its own string, and
+ *   then only referenced: the list of a file, the body of the
+ *   assessment and the archive entry point to the same bytes,
+ *   with header and footer around them, and the list is fed
+ *   as it is to the compressor. A fragment is either owned by
+ *   the list (freed with it) or borrowed (a literal, or
+ *   something owned by another list that outlives this one).
+ *
+ *   Fragments are struct iovec, as taken by writev().
+ */
+#ifndef FRAGS_H
+
+#define FRAGS_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+typedef struct frags {
+          struct iovec *iov;
+          char         *owned;   // Flag per fragment
+          int           cnt;
+          int           alloc;
+          size_t        len;     // Total
+         } FRAGS_T;
+
+extern void   frags_init(FRAGS_T *f);
+// Appends len bytes at s, borrowed
+extern void   frags_add(FRAGS_T *f, const char *s, size_t len);
+// Appends the malloc'd s, which is freed with the list
+extern void   frags_take(FRAGS_T *f, char *s, size_t len);
+// Same for a question, counted against --memory-limit: past
+// it, s is moved to the spill file (see spill.h)
+extern void   frags_keep(FRAGS_T *f, char *s, size_t len);
+// Replaces fragment i by the malloc'd s
+extern void   frags_replace(FRAGS_T *f, int i, char *s, size_t len);
+// Appends (borrows) fragments first to first + cnt - 1 of g
+extern void   frags_append(FRAGS_T *f, FRAGS_T *g, int first, int cnt);
+// Moves the fragments of g, owned ones included, to the end
+// of f, leaving g empty. Only descriptors are copied, and
+// nothing at all if f is empty (the arrays change hands).
+extern void   frags_splice(FRAGS_T *f, FRAGS_T *g);
+// Copy of the whole, NUL-terminated, for what needs one string
+extern char  *frags_gather(FRAGS_T *f);
+extern void   frags_clear(FRAGS_T *f);
+extern void   frags_dispose(FRAGS_T *f);
+
+#endif
@@ -0,0 +1,151 @@
+/// \file  hashbench.c
+/// \brief MD5 against the fast content hash, over a corpus.
+/* -------------------------------------------------------------*
+
+   make hashbench; ./hashbench [-n passes] file [file ...]
+
+   Files are read into memory first, so that only hashing is
+   timed; each of them is hashed whole, as content identifiers
+   and dedup keys are, and the best of the passes is kept.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "fasthash.h"
+
+#define PASSES   5
+
+// Keeps the compiler from dropping the work
+static volatile unsigned char G_sink;
+
+typedef struct corpus_file {
+          char   *data;
+          size_t  size;
+         } CORPUS_FILE_T;
+
+static char *read_all(const char *name, size_t *sizep) {
+   FILE   *fp;
+   char   *data = NULL;
+   size_t  alloc = 0;
+   size_t  size = 0;
+   size_t  n;
+
+   if ((fp = fopen(name, "r")) == NULL) {
+     perror(name);
+     return NULL;
+   }
+   do {
+     if (size == alloc) {
+       alloc = (alloc ? 2 * alloc : 65536);
+       if ((data = (char *)realloc(data, alloc)) == NULL) {
+         perror("realloc");
+         exit(1);
+       }
+     }
+     n = fread(data + size, 1, alloc - size, fp);
+     size += n;
+   } while (n);
+   fclose(fp);
+   *sizep = size;
+   return data;
+}
+
+static double seconds(void) {
+   struct timespec t;
+
+   clock_gettime(CLOCK_MONOTONIC, &t);
+   return (double)t.tv_sec + (double)t.tv_nsec / 1e9;
+}
+
+static double run(CORPUS_FILE_T *files, int cnt, int md5, int passes) {
+   // Best time over the passes, in seconds
+   MD5_CTX       ctx;
+   unsigned char digest[16];
+   double        best = 0;
+   double        t;
+   int           p;
+   int           i;
+
+   for (p = 0; p < passes; p++) {
+     t = seconds();
+     for (i = 0; i < cnt; i++) {
+       if (md5) {
+         MD5_Init(&ctx);
+         MD5_Update(&ctx, files[i].data, (unsigned long)files[i].size);
+         MD5_Final(digest, &ctx);
+       } else {
+         fh128(files[i].data, (unsigned long)files[i].size, digest);
+       }
+       G_sink ^= digest[0];
+     }
+     t = seconds() - t;
+     if ((p == 0) || (t < best)) {
+       best = t;
+     }
+   }
+   return best;
+}
+
+int main(int argc, char **argv) {
+   CORPUS_FILE_T *files;
+   double         total = 0;
+   double         t;
+   int            passes = PASSES;
+   int            cnt = 0;
+   int            ch;
+   int            i;
+
+   while ((ch = getopt(argc, argv, "n:")) != -1) {
+     switch (ch) {
+       case 'n':
+         if ((passes = atoi(optarg)) < 1) {
+           passes = 1;
+         }
+         break;
+       default:
+         fprintf(stderr, "Usage: %s [-n passes] file [file ...]\n",
+                         argv[0]);
+         return 1;
+     }
+   }
+   if (optind == argc) {
+     fprintf(stderr, "Usage: %s [-n passes] file [file ...]\n", argv[0]);
+     return 1;
+   }
+   if ((files = (CORPUS_FILE_T *)calloc(argc - optind,
+                                        sizeof(CORPUS_FILE_T))) == NULL) {
+     perror("calloc");
+     return 1;
+   }
+   for (i = optind; i < argc; i++) {
+     if ((files[cnt].data = read_all(argv[i], &(files[cnt].size)))
+           != NULL) {
+       total += (double)files[cnt].size;
+       cnt++;
+     }
+   }
+   if (total == 0) {
+     fprintf(stderr, "Nothing to hash\n");
+     return 1;
+   }
+   printf("%d file%s, %.1f MB, best of %d\n", cnt, (cnt > 1 ? "s" : ""),
+          total / 1e6, passes);
+   t = run(files, cnt, 1, passes);
+   printf("  MD5     %8.3f s %8.0f MB/s\n", t, total / 1e6 / t);
+   t = run(files, cnt, 0, passes);
+#ifdef __SSE2__
+   printf("  fh128   %8.3f s %8.0f MB/s (SSE2)\n", t, total / 1e6 / t);
+#else
+   printf("  fh128   %8.3f s %8.0f MB/s\n", t, total / 1e6 / t);
+#endif
+   for (i = 0; i < cnt; i++) {
+     free(files[i].data);
+   }
+   free(files);
+   return 0;
+}
@@ -0,0 +1,474 @@
+/// \file  infiles.c
+/// \brief Batched reading of input files (io_uring, or pread).
+/* -------------------------------------------------------------*
+
+   io_uring is used through its raw system calls (no liburing
+   needed). For each file, an openat and a statx are submitted
+   together; once both are back, a read of the whole file
+   follows (more reads if the file turns out to be larger, or
+   isn't a regular file), then an asynchronous close.
+
+   Up to IN_WINDOW files beyond the one being parsed are kept
+   in flight, which bounds memory while hiding latency. All
+   ring operations happen in the calling thread: completions
+   are reaped when the parser asks for the next file.
+
+   If the ring can't be set up, or an operation isn't
+   supported by the kernel, files are read synchronously with
+   open/fstat/pread. Setting TXT2QTI_NO_URING in the
+   environment forces this.
+
+ * -------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "infiles.h"
+
+#define IN_CHUNK       65536     // First read when size unknown
+#define RING_ENTRIES   (4 * IN_WINDOW)
+
+// What a completion is about (low bits of user_data)
+#define OP_OPEN        0
+#define OP_STAT        1
+#define OP_READ        2
+#define OP_CLOSE       3
+#define OP_BITS        2
+
+typedef struct ring {
+          int                  fd;
+          unsigned            *sq_head;
+          unsigned            *sq_tail;
+          unsigned            *sq_mask;
+          unsigned            *sq_array;
+          unsigned             sq_entries;
+          struct io_uring_sqe *sqes;
+          unsigned            *cq_head;
+          unsigned            *cq_tail;
+          unsigned            *cq_mask;
+          struct io_uring_cqe *cqes;
+          void                *sq_ptr;
+          size_t               sq_len;
+          void                *cq_ptr;
+          size_t               cq_len;
+          size_t               sqes_len;
+          unsigned             to_submit;
+          int                  inflight;
+         } RING_T;
+
+static RING_T *ring_setup(void) {
+   struct io_uring_params p;
+   RING_T                *r;
+   int                    fd;
+
+   memset(&p, 0, sizeof(p));
+   if ((fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &p)) < 0) {
+     return NULL;
+   }
+   if ((r = (RING_T *)calloc(1, sizeof(RING_T))) == NULL) {
+     perror("calloc");
+     exit(1);
+   }
+   r->fd = fd;
+   r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+   r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+   if (p.features & IORING_FEAT_SINGLE_MMAP) {
+     if (r->cq_len > r->sq_len) {
+       r->sq_len = r->cq_len;
+     }
+   }
+   r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+   if (r->sq_ptr == MAP_FAILED) {
+     close(fd);
+     free(r);
+     return NULL;
+   }
+   if (p.features & IORING_FEAT_SINGLE_MMAP) {
+     r->cq_ptr = r->sq_ptr;
+     r->cq_len = 0;
+   } else {
+     r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+     if (r->cq_ptr == MAP_FAILED) {
+       munmap(r->sq_ptr, r->sq_len);
+       close(fd);
+       free(r);
+       return NULL;
+     }
+   }
+   r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+   r->sqes = (struct io_uring_sqe *)mmap(NULL, r->sqes_len,
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_SQES);
+   if (r->sqes == MAP_FAILED) {
+     if (r->cq_len) {
+       munmap(r->cq_ptr, r->cq_len);
+     }
+     munmap(r->sq_ptr, r->sq_len);
+     close(fd);
+     free(r);
+     return NULL;
+   }
+   r->sq_head = (unsigned *)((char *)r->sq_ptr + p.sq_off.head);
+   r->sq_tail = (unsigned *)((char *)r->sq_ptr + p.sq_off.tail);
+   r->sq_mask = (unsigned *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+   r->sq_array = (unsigned *)((char *)r->sq_ptr + p.sq_off.array);
+   r->sq_entries = p.sq_entries;
+   r->cq_head = (unsigned *)((char *)r->cq_ptr + p.cq_off.head);
+   r->cq_tail = (unsigned *)((char *)r->cq_ptr + p.cq_off.tail);
+   r->cq_mask = (unsigned *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+   r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+   return r;
+}
+
+static void ring_free(RING_T *r) {
+   munmap(r->sqes, r->sqes_len);
+   if (r->cq_len) {
+     munmap(r->cq_ptr, r->cq_len);
+   }
+   munmap(r->sq_ptr, r->sq_len);
+   close(r->fd);
+   free(r);
+}
+
+static struct io_uring_sqe *ring_sqe(RING_T *r, int idx, int op) {
+   // Only this thread touches the tail; the kernel moves the head
+   unsigned             tail = *(r->sq_tail);
+   unsigned             i = tail & *(r->sq_mask);
+   struct io_uring_sqe *sqe = &(r->sqes[i]);
+
+   memset(sqe, 0, sizeof(*sqe));
+   sqe->user_data = ((unsigned long long)idx << OP_BITS) | op;
+   r->sq_array[i] = i;
+   __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+   r->to_submit++;
+   r->inflight++;
+   return sqe;
+}
+
+static int ring_enter(RING_T *r, unsigned wait) {
+   int ret;
+
+   do {
+     ret = (int)syscall(__NR_io_uring_enter, r->fd, r->to_submit, wait,
+                        (wait ? IORING_ENTER_GETEVENTS : 0), NULL, 0);
+   } while ((ret < 0) && (errno == EINTR));
+   if (ret >= 0) {
+     r->to_submit -= (unsigned)ret;
+   }
+   return ret;
+}
+
+static char read_sync(IN_FILE_T *f) {
+   // The pread path; also used when io_uring can't do it
+   struct stat st;
+   ssize_t     n;
+   int         fd;
+
+   if ((fd = open(f->name, O_RDONLY | O_CLOEXEC)) == -1) {
+     f->err = errno;
+     f->stat_ok = (stat(f->name, &st) == 0);
+     return 1;
+   }
+   f->stat_ok = 1;
+   f->size = 0;
+   f->alloc = ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode)
+               ? (size_t)st.st_size + 1 : IN_CHUNK);
+   for (;;) {
+     if ((f->data = (char *)realloc(f->data, f->alloc)) == NULL) {
+       perror("realloc");
+       exit(1);
+     }
+     n = pread(fd, f->data + f->size, f->alloc - 1 - f->size,
+               (off_t)f->size);
+     if (n < 0) {
+       if (errno == EINTR) {
+         continue;
+       }
+       if (errno == ESPIPE) {
+         // Not seekable after all (pipe given as a file name)
+         n = read(fd, f->data + f->size, f->alloc - 1 - f->size);
+       }
+       if (n < 0) {
+         f->err = errno;
+         break;
+       }
+     }
+     if (n == 0) {
+       break;
+     }
+     f->size += n;
+     if (f->size == f->alloc - 1) {
+       f->alloc *= 2;
+     }
+   }
+   close(fd);
+   if (f->data) {
+     f->data[f->size] = '\0';
+   }
+   f->done = 1;
+   return 1;
+}
+
+static void submit_read(RING_T *r, IN_FILES_T *in, int idx) {
+   IN_FILE_T           *f = &(in->files[idx]);
+   struct io_uring_sqe *sqe;
+
+   if (f->size + 1 >= f->alloc) {
+     f->alloc = (f->alloc ? f->alloc * 2 : IN_CHUNK);
+     if ((f->data = (char *)realloc(f->data, f->alloc)) == NULL) {
+       perror("realloc");
+       exit(1);
+     }
+   }
+   sqe = ring_sqe(r, idx, OP_READ);
+   sqe->opcode = IORING_OP_READ;
+   sqe->fd = f->fd;
+   sqe->addr = (unsigned long long)(unsigned long)(f->data + f->size);
+   sqe->len = (unsigned)(f->alloc - 1 - f->size > 0x40000000
+                         ? 0x40000000 : f->alloc - 1 - f->size);
+   sqe->off = f->size;
+   f->pending++;
+}
+
+static void finish(RING_T *r, IN_FILE_T *f, int idx) {
+   struct io_uring_sqe *sqe;
+
+   if (f->fd >= 0) {
+     sqe = ring_sqe(r, idx, OP_CLOSE);
+     sqe->opcode = IORING_OP_CLOSE;
+     sqe->fd = f->fd;
+     f->fd = -1;
+   }
+   if (f->data) {
+     f->data[f->size] = '\0';
+   }
+   f->done = 1;
+}
+
+static void start_file(IN_FILES_T *in, int idx) {
+   RING_T              *r = (RING_T *)in->ring;
+   IN_FILE_T           *f = &(in->files[idx]);
+   struct io_uring_sqe *sqe;
+
+   if ((f->stx = calloc(1, sizeof(struct statx))) == NULL) {
+     perror("calloc");
+     exit(1);
+   }
+   sqe = ring_sqe(r, idx, OP_OPEN);
+   sqe->opcode = IORING_OP_OPENAT;
+   sqe->fd = AT_FDCWD;
+   sqe->addr = (unsigned long long)(unsigned long)f->name;
+   sqe->open_flags = O_RDONLY | O_CLOEXEC;
+   sqe = ring_sqe(r, idx, OP_STAT);
+   sqe->opcode = IORING_OP_STATX;
+   sqe->fd = AT_FDCWD;
+   sqe->addr = (unsigned long long)(unsigned long)f->name;
+   sqe->len = STATX_TYPE | STATX_SIZE;
+   sqe->off = (unsigned long long)(unsigned long)f->stx;
+   f->pending = 2;
+}
+
+static void completed(IN_FILES_T *in, int idx, int op, int res) {
+   RING_T      *r = (RING_T *)in->ring;
+   IN_FILE_T   *f = &(in->files[idx]);
+   struct statx *stx = (struct statx *)f->stx;
+
+   if (op == OP_CLOSE) {
+     return;
+   }
+   f->pending--;
+   switch (op) {
+     case OP_OPEN:
+          if (res >= 0) {
+            f->fd = res;
+          } else {
+            f->err = -res;
+          }
+          break;
+     case OP_STAT:
+          if (res == 0) {
+            f->stat_ok = 1;
+            if (S_ISREG(stx->stx_mode)) {
+              f->sized = 1;
+              f->alloc = (size_t)stx->stx_size + 1;
+            }
+          } else if ((res == -EINVAL) || (res == -EOPNOTSUPP)) {
+            f->err = -res;
+          }
+          break;
+     case OP_READ:
+          if (res > 0) {
+            f->size += res;
+            if (f->sized && (f->size + 1 == f->alloc)) {
+              // Whole file read, no need to wait for EOF
+              finish(r, f, idx);
+            } else {
+              submit_read(r, in, idx);
+            }
+          } else if (res == 0) {
+            finish(r, f, idx);
+          } else {
+            f->err = -res;
+            finish(r, f, idx);
+          }
+          return;
+     default:
+          return;
+   }
+   if (f->pending == 0) {
+     // Open and stat both back
+     if ((f->err == EINVAL) || (f->err == EOPNOTSUPP)) {
+       // Operation unknown to this kernel
+       if (f->fd >= 0) {
+         close(f->fd);
+         f->fd = -1;
+       }
+       f->err = 0;
+       (void)read_sync(f);
+     } else if (f->fd < 0) {
+       f->done = 1;
+     } else {
+       if (f->sized && (f->alloc == 1)) {
+         // Empty file
+         finish(r, f, idx);
+         return;
+       }
+       if ((f->data = (char *)malloc(f->alloc ? f->alloc : IN_CHUNK))
+              == NULL) {
+         perror("malloc");
+         exit(1);
+       }
+       if (!f->alloc) {
+         f->alloc = IN_CHUNK;
+       }
+       submit_read(r, in, idx);
+     }
+   }
+}
+
+static void reap(IN_FILES_T *in, unsigned wait) {
+   RING_T              *r = (RING_T *)in->ring;
+   unsigned             head;
+   unsigned             tail;
+   struct io_uring_cqe *cqe;
+
+   if (ring_enter(r, wait) < 0) {
+     perror("io_uring_enter");
+     exit(1);
+   }
+   head = *(r->cq_head);
+   tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+   while (head != tail) {
+     cqe = &(r->cqes[head & *(r->cq_mask)]);
+     r->inflight--;
+     completed(in, (int)(cqe->user_data >> OP_BITS),
+               (int)(cqe->user_data & ((1 << OP_BITS) - 1)), cqe->res);
+     head++;
+     __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+     tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+   }
+}
+
+extern void infiles_open(IN_FILES_T *in, char **names, int cnt) {
+   int i;
+
+   memset(in, 0, sizeof(IN_FILES_T));
+   if ((in->files = (IN_FILE_T *)calloc(cnt ? cnt : 1,
+                                        sizeof(IN_FILE_T))) == NULL) {
+     perror("calloc");
+     exit(1);
+   }
+   in->cnt = cnt;
+   for (i = 0; i < cnt; i++) {
+     in->files[i].name = names[i];
+     in->files[i].fd = -1;
+   }
+   if (!getenv("TXT2QTI_NO_URING")) {
+     in->ring = ring_setup();
+   }
+}
+
+extern IN_FILE_T *infiles_next(IN_FILES_T *in) {
+   IN_FILE_T *f;
+   RING_T    *r = (RING_T *)in->ring;
+
+   if (in->next >= in->cnt) {
+     return NULL;
+   }
+   f = &(in->files[in->next]);
+   if (r == NULL) {
+     (void)read_sync(f);
+   } else {
+     for (;;) {
+       // Keep the window full (each file needs at most
+       // two operations and a close at once)
+       while ((in->started < in->cnt)
+              && (in->started <= in->next + IN_WINDOW)
+              && (r->inflight + 3 <= (int)r->sq_entries)) {
+         start_file(in, in->started++);
+       }
+       if (f->done) {
+         if (r->to_submit) {
+           reap(in, 0);
+         }
+         break;
+       }
+       reap(in, 1);
+     }
+     if (f->stx) {
+       free(f->stx);
+       f->stx = NULL;
+     }
+   }
+   in->next++;
+   return f;
+}
+
+extern void infiles_release(IN_FILE_T *f) {
+   if (f && f->data) {
+     free(f->data);
+     f->data = NULL;
+     f->alloc = 0;
+   }
+}
+
+extern void infiles_close(IN_FILES_T *in) {
+   RING_T *r = (RING_T *)in->ring;
+   int     i;
+
+   if (r) {
+     // Wait for what is still in flight (closes, files not
+     // asked for), so that no buffer is freed under the kernel
+     while (r->inflight > 0) {
+       reap(in, 1);
+     }
+     ring_free(r);
+   }
+   for (i = 0; i < in->cnt; i++) {
+     if (in->files[i].fd >= 0) {
+       close(in->files[i].fd);
+     }
+     if (in->files[i].stx) {
+       free(in->files[i].stx);
+     }
+     infiles_release(&(in->files[i]));
+   }
+   free(in->files);
+   memset(in, 0, sizeof(IN_FILES_T));
+}
+
+extern const char *infiles_method(IN_FILES_T *in) {
+   return (in->ring ? "io_uring" : "pread");
+}
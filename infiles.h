@@ -0,0 +1,55 @@
+/*
+ *   Reading of the input files, many at a time.
+ *
+ *   Files are read whole, ahead of the parser: with io_uring,
+ *   opens, stats and reads for a window of files are all in
+ *   flight at once, so that a run over thousands of small
+ *   files isn't a long succession of syscall round trips.
+ *   Without io_uring (old kernel, seccomp ...), files are
+ *   read one by one with pread.
+ *
+ *   Files are handed back in the order they were given.
+ */
+#ifndef INFILES_H
+
+#define INFILES_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define IN_WINDOW    64      // Files read ahead
+
+typedef struct in_file {
+          char   *name;
+          char   *data;      // Content, NUL-terminated
+          size_t  size;
+          size_t  alloc;
+          int     err;       // errno value if unreadable
+          char    stat_ok;   // As stat() on the name
+          // io_uring progress
+          int     fd;
+          short   pending;   // Operations in flight
+          char    sized;     // Size known (regular file)
+          char    done;
+          void   *stx;       // statx() result
+         } IN_FILE_T;
+
+typedef struct in_files {
+          IN_FILE_T *files;
+          int        cnt;
+          int        next;      // Next one to hand back
+          int        started;   // Files submitted
+          void      *ring;      // NULL: pread
+         } IN_FILES_T;
+
+// Starts reading (all or part of) the cnt files of names.
+extern void       infiles_open(IN_FILES_T *in, char **names, int cnt);
+// Next file in order, once completely read; NULL after the last.
+// Its data can be freed with infiles_release().
+extern IN_FILE_T *infiles_next(IN_FILES_T *in);
+extern void       infiles_release(IN_FILE_T *f);
+extern void       infiles_close(IN_FILES_T *in);
+// "io_uring" or "pread"
+extern const char *infiles_method(IN_FILES_T *in);
+
+#endif
@@ -0,0 +1,822 @@
+/// \file  media.c
+/// \brief Local media files packaged with the quiz.
+/* -------------------------------------------------------------*
+
+   As references are found in questions, files are queued;
+   a pool of threads reads them, computes their content hash
+   and deflates them, so that by the time the questions have
+   been parsed most of the work is done.
+
+   Sizes go from a few KB to hundreds of MB: files are given
+   to the workers largest first (from a stat() when they are
+   queued), and the worker that reads a file larger than two
+   pieces doesn't deflate it alone. It splits the work into
+   MEDIA_PIECE pieces (and the CRC), deflated separately as
+   zip entries are (see deflate_part()), that idle workers
+   steal from it (see wsched.h); whoever finishes the last
+   one puts them end to end. Pieces depend on the size only,
+   so the archive doesn't depend on -j.
+
+   A file whose content was already seen (under another path)
+   isn't compressed again and shares the archive name of the
+   first one. Formats that are already compressed (images,
+   video, sound) are stored as they are: deflate wouldn't gain
+   anything on them and would burn CPU.
+
+   Which of two identical files is hashed first depends on
+   thread timing, but the list of files to store is built
+   afterwards from the markers, in order of first reference,
+   so that the archive doesn't. Files whose references have
+   gone (a question edited under --watch) aren't stored.
+
+   Under --watch, files are known by path for as long as the
+   program runs. Before each rebuild, media_refresh() stats
+   them again and sends those that changed back to the
+   workers, where they are read and hashed as new; since
+   markers hold indexes, questions that weren't parsed again
+   get the new content too.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "chrclass.h"
+#include "fasthash.h"
+#include "miniz.h"
+#include "deflate.h"
+#include "media.h"
+
+#define MEDIA_ALLOC       64
+#define MEDIA_INIT_SLOTS  256     // Power of 2
+#define MEDIA_EXT_LEN     10
+#define MEDIA_ZIP_HEADERS 76      // Local + central, without names
+#define MEDIA_PIECE       (1024 * 1024)   // Deflated separately
+#define MEDIA_TASK_FILE   -2      // Otherwise a piece, or -1: the CRC
+
+// Tags whose src attribute designates a file to package
+static const char *G_media_tags[] = {"img", "video", "audio",
+                                     "source", "embed", NULL};
+// Already compressed formats
+static const char *G_media_stored[] = {"png", "jpg", "jpeg", "gif",
+                                       "mp4", "m4v", "webm", "webp",
+                                       "mp3", "ogg", NULL};
+
+static uint64_t key64(const unsigned char *h) {
+   uint64_t k;
+
+   memcpy(&k, h, sizeof(k));
+   return k;
+}
+
+static long *content_slot(MEDIA_SET_T *m, long *table,
+                          const unsigned char *hash) {
+   // Linear probing; returns the slot holding the file with
+   // this content, or the empty slot where to put it.
+   long mask = m->slots - 1;
+   long i = (long)(key64(hash) & (uint64_t)mask);
+
+   while (table[i]
+          && memcmp(m->files[table[i] - 1]->hash, hash, 16)) {
+     i = (i + 1) & mask;
+   }
+   return &(table[i]);
+}
+
+static long *path_slot(MEDIA_SET_T *m, long *table,
+                       uint64_t key, const char *path) {
+   long mask = m->slots - 1;
+   long i = (long)(key & (uint64_t)mask);
+
+   while (table[i]
+          && ((m->files[table[i] - 1]->path_key != key)
+              || strcmp(m->files[table[i] - 1]->path, path))) {
+     i = (i + 1) & mask;
+   }
+   return &(table[i]);
+}
+
+static void tables_grow(MEDIA_SET_T *m) {
+   // Called with the lock held
+   long          *old_path = m->by_path;
+   long          *old_content = m->by_content;
+   long           old_slots = m->slots;
+   long           i;
+   MEDIA_FILE_T  *f;
+
+   m->slots = (old_slots ? old_slots * 2 : MEDIA_INIT_SLOTS);
+   if (((m->by_path = (long *)calloc(m->slots, sizeof(long))) == NULL)
+       || ((m->by_content = (long *)calloc(m->slots, sizeof(long)))
+               == NULL)) {
+     perror("calloc");
+     exit(1);
+   }
+   for (i = 0; i < old_slots; i++) {
+     if (old_path[i]) {
+       f = m->files[old_path[i] - 1];
+       *path_slot(m, m->by_path, f->path_key, f->path) = old_path[i];
+     }
+     if (old_content[i]) {
+       f = m->files[old_content[i] - 1];
+       *content_slot(m, m->by_content, f->hash) = old_content[i];
+     }
+   }
+   if (old_path) {
+     free(old_path);
+     free(old_content);
+   }
+}
+
+static char is_stored(const char *name) {
+   const char *ext = strrchr(name, '.');
+   int         i;
+
+   if (ext && !strchr(ext, '/')) {
+     ext++;
+     for (i = 0; G_media_stored[i]; i++) {
+       if (strcmp(ext, G_media_stored[i]) == 0) {
+         return 1;
+       }
+     }
+   }
+   return 0;
+}
+
+static void set_name(MEDIA_FILE_T *f) {
+   // media/<hash>.<extension in lowercase>
+   const char *ext;
+   char       *p;
+   int         i;
+
+   strcpy(f->name, MEDIA_DIR);
+   p = f->name + strlen(MEDIA_DIR);
+   for (i = 0; i < 16; i++) {
+     sprintf(p, "%02x", f->hash[i]);
+     p += 2;
+   }
+   if (((ext = strrchr(f->path, '.')) != NULL)
+       && !strchr(ext, '/')
+       && (strlen(ext) <= MEDIA_EXT_LEN)) {
+     for (i = 0; ext[i] && (CC_ISALPHA(ext[i])
+                            || CC_ISDIGIT(ext[i])
+                            || (i == 0)); i++) {
+       *p++ = CC_TOLOWER(ext[i]);
+     }
+   }
+   *p = '\0';
+}
+
+static int read_file(MEDIA_FILE_T *f) {
+   int          fd;
+   struct stat  st;
+   size_t       done = 0;
+   ssize_t      n;
+
+   if ((fd = open(f->path, O_RDONLY)) == -1) {
+     return -1;
+   }
+   if ((fstat(fd, &st) == -1) || !S_ISREG(st.st_mode)) {
+     close(fd);
+     errno = EINVAL;
+     return -1;
+   }
+   f->orig_size = (size_t)st.st_size;
+   f->mtime = st.st_mtime;
+   f->ino = st.st_ino;
+   if ((f->data = malloc(f->orig_size ? f->orig_size : 1)) == NULL) {
+     perror("malloc");
+     exit(1);
+   }
+   while (done < f->orig_size) {
+     if ((n = read(fd, (char *)f->data + done,
+                   f->orig_size - done)) <= 0) {
+       if ((n == -1) && (errno == EINTR)) {
+         continue;
+       }
+       free(f->data);
+       f->data = NULL;
+       close(fd);
+       if (n == 0) {
+         errno = EIO;   // Shrunk while reading
+       }
+       return -1;
+     }
+     done += n;
+   }
+   close(fd);
+   f->size = f->orig_size;
+   return 0;
+}
+
+static void compress_file(MEDIA_FILE_T *f) {
+   void   *out;
+   size_t  out_len;
+
+   if (f->stored || (f->orig_size == 0)) {
+     f->stored = 1;
+     return;
+   }
+   // Only kept if smaller
+   out = deflate_buffer(f->data, f->orig_size, f->orig_size, &out_len);
+   if (out) {
+     f->crc = deflate_crc32(f->data, f->orig_size);
+     free(f->data);
+     f->data = out;
+     f->size = out_len;
+   } else {
+     // Incompressible after all
+     f->stored = 1;
+   }
+}
+
+static void join_parts(MEDIA_FILE_T *f) {
+   // All pieces are deflated: put end to end, unless they are
+   // no smaller than the file
+   size_t  len = 0;
+   char   *out;
+   int     k;
+
+   for (k = 0; k < f->part_cnt; k++) {
+     if (f->parts[k] == NULL) {
+       break;
+     }
+     len += f->part_lens[k];
+   }
+   if (k < f->part_cnt) {
+     // Shouldn't happen, the engine can split
+     len = 0;
+   } else if (len < f->orig_size) {
+     if ((out = (char *)malloc(len)) == NULL) {
+       perror("malloc");
+       exit(1);
+     }
+     len = 0;
+     for (k = 0; k < f->part_cnt; k++) {
+       memcpy(out + len, f->parts[k], f->part_lens[k]);
+       len += f->part_lens[k];
+     }
+     free(f->data);
+     f->data = out;
+     f->size = len;
+   } else {
+     f->stored = 1;
+   }
+   for (k = 0; k < f->part_cnt; k++) {
+     if (f->parts[k]) {
+       free(f->parts[k]);
+     }
+   }
+   free(f->parts);
+   free(f->part_lens);
+   f->parts = NULL;
+   f->part_lens = NULL;
+   f->part_cnt = 0;
+   if (len == 0) {
+     compress_file(f);
+   }
+}
+
+static void deflate_piece(MEDIA_SET_T *m, MEDIA_FILE_T *f, int k) {
+   // Piece k of a large file, or its CRC if k is -1
+   struct iovec iov;
+   size_t       ofs = (size_t)k * MEDIA_PIECE;
+   int          left;
+
+   if (k == -1) {
+     f->crc = deflate_crc32(f->data, f->orig_size);
+   } else {
+     iov.iov_base = (char *)f->data + ofs;
+     iov.iov_len = (ofs + MEDIA_PIECE < f->orig_size ? MEDIA_PIECE
+                                                     : f->orig_size - ofs);
+     f->parts[k] = deflate_part(&iov, 1, (k == f->part_cnt - 1),
+                                &(f->part_lens[k]));
+   }
+   pthread_mutex_lock(&(m->lock));
+   left = --(f->parts_left);
+   pthread_mutex_unlock(&(m->lock));
+   if (left == 0) {
+     join_parts(f);
+     pthread_mutex_lock(&(m->lock));
+     f->status = MEDIA_READY;
+     pthread_mutex_unlock(&(m->lock));
+   }
+}
+
+static void load_file(MEDIA_SET_T *m, MEDIA_FILE_T *f, int worker) {
+   // Reads, hashes and, unless its content was already seen,
+   // deflates the file (or splits deflating into pieces)
+   long *slot;
+   int   k;
+
+   if (read_file(f) == -1) {
+     fprintf(stderr, "*** WARNING *** %s: %s - reference kept as is\n",
+                     f->path, strerror(errno));
+     pthread_mutex_lock(&(m->lock));
+     f->status = MEDIA_FAILED;
+     pthread_mutex_unlock(&(m->lock));
+     return;
+   }
+   fh128(f->data, (unsigned long)f->orig_size, f->hash);
+   set_name(f);
+   f->stored = is_stored(f->name);
+   pthread_mutex_lock(&(m->lock));
+   slot = content_slot(m, m->by_content, f->hash);
+   if (*slot) {
+     f->status = MEDIA_SAME;
+     f->same_as = *slot - 1;
+     pthread_mutex_unlock(&(m->lock));
+     free(f->data);
+     f->data = NULL;
+     return;
+   }
+   *slot = f->index + 1;
+   pthread_mutex_unlock(&(m->lock));
+   if (!f->stored
+       && (f->orig_size > 2 * MEDIA_PIECE)
+       && deflate_can_split()) {
+     f->part_cnt = (int)((f->orig_size + MEDIA_PIECE - 1) / MEDIA_PIECE);
+     f->parts_left = f->part_cnt + 1;
+     if (((f->parts = (void **)calloc(f->part_cnt, sizeof(void *)))
+            == NULL)
+         || ((f->part_lens = (size_t *)calloc(f->part_cnt,
+                                              sizeof(size_t))) == NULL)) {
+       perror("calloc");
+       exit(1);
+     }
+     // This worker takes them back from the first piece,
+     // thieves from the last one
+     ws_spawn(&(m->sched), worker, f, -1);
+     for (k = f->part_cnt - 1; k >= 0; k--) {
+       ws_spawn(&(m->sched), worker, f, k);
+     }
+     return;
+   }
+   compress_file(f);
+   pthread_mutex_lock(&(m->lock));
+   f->status = MEDIA_READY;
+   pthread_mutex_unlock(&(m->lock));
+}
+
+static void media_task(WSCHED_T *ws, int worker, WS_TASK_T *t) {
+   MEDIA_SET_T  *m = (MEDIA_SET_T *)ws->ctx;
+   MEDIA_FILE_T *f = (MEDIA_FILE_T *)t->obj;
+
+   if (t->arg == MEDIA_TASK_FILE) {
+     load_file(m, f, worker);
+   } else {
+     deflate_piece(m, f, (int)t->arg);
+   }
+}
+
+extern void media_init(MEDIA_SET_T *m, int nthreads) {
+   if (m) {
+     memset(m, 0, sizeof(MEDIA_SET_T));
+     pthread_mutex_init(&(m->lock), NULL);
+     ws_init(&(m->sched), nthreads, media_task, m);
+   }
+}
+
+static long media_add(MEDIA_SET_T *m, const char *path, const char *ref,
+                      size_t ref_len) {
+   MEDIA_FILE_T  *f;
+   unsigned char  h[16];
+   uint64_t       key;
+   long          *slot;
+   struct stat    st;
+   size_t         size;
+
+   fh128(path, (unsigned long)strlen(path), h);
+   key = key64(h);
+   pthread_mutex_lock(&(m->lock));
+   if ((m->cnt + 1) * 10 > m->slots * 7) {
+     tables_grow(m);
+   }
+   slot = path_slot(m, m->by_path, key, path);
+   if (*slot) {
+     pthread_mutex_unlock(&(m->lock));
+     return *slot - 1;
+   }
+   if (m->cnt == m->alloc) {
+     if ((m->files = (MEDIA_FILE_T **)realloc(m->files,
+                  sizeof(MEDIA_FILE_T *) * (m->alloc + MEDIA_ALLOC)))
+            == NULL) {
+       perror("realloc");
+       exit(1);
+     }
+     m->alloc += MEDIA_ALLOC;
+   }
+   if (((f = (MEDIA_FILE_T *)calloc(1, sizeof(MEDIA_FILE_T))) == NULL)
+       || ((f->path = strdup(path)) == NULL)
+       || ((f->ref = (char *)malloc(ref_len + 1)) == NULL)) {
+     perror("malloc");
+     exit(1);
+   }
+   memcpy(f->ref, ref, ref_len);
+   f->ref[ref_len] = '\0';
+   f->path_key = key;
+   f->status = MEDIA_PENDING;
+   f->index = m->cnt;
+   m->files[m->cnt] = f;
+   *slot = ++(m->cnt);
+   // First file (or first since media_finish()), start the workers
+   ws_start(&(m->sched), 0);
+   pthread_mutex_unlock(&(m->lock));
+   // Largest first: a large file started last would keep one
+   // worker busy long after the others are done
+   size = ((stat(path, &st) == 0) ? (size_t)st.st_size : 0);
+   ws_submit(&(m->sched), f, MEDIA_TASK_FILE, size);
+   return f->index;
+}
+
+static char is_local(const char *v, size_t len) {
+   // Not a URL (scheme: or //host), not a fragment, not empty
+   size_t i;
+
+   if ((len == 0) || (*v == '#') || ((len > 1) && (v[0] == '/')
+                                     && (v[1] == '/'))) {
+     return 0;
+   }
+   for (i = 0; (i < len) && (v[i] != '/'); i++) {
+     if ((v[i] == ':') || (v[i] == '?')) {
+       return 0;
+     }
+   }
+   return 1;
+}
+
+static int media_tag(const char *s, const char *end) {
+   // Length of the tag name after '<' if it is one of ours
+   int    i;
+   size_t len;
+
+   for (i = 0; G_media_tags[i]; i++) {
+     len = strlen(G_media_tags[i]);
+     if ((s + len < end)
+         && (cc_strncasecmp(s, G_media_tags[i], len) == 0)
+         && (CC_ISSPACE(s[len]))) {
+       return (int)len;
+     }
+   }
+   return 0;
+}
+
+extern void media_rewrite(MEDIA_SET_T *m, STRBUF *sp,
+                          char *s, size_t len, const char *fname) {
+   char        *end = s + len;
+   char        *from = s;
+   char        *p = s;
+   char        *v;
+   char        *vend;
+   char         quote;
+   char         mark[32];
+   const char  *slash;
+   size_t       dirlen;
+   char        *path;
+   long         idx;
+
+   if (!m || !sp || !s) {
+     return;
+   }
+   slash = (fname ? strrchr(fname, '/') : NULL);
+   dirlen = (slash ? (size_t)(slash - fname) + 1 : 0);
+   while ((p = memchr(p, '<', end - p)) != NULL) {
+     p++;
+     if (media_tag(p, end) == 0) {
+       continue;
+     }
+     // Look for src= up to the end of the tag
+     quote = 0;
+     while ((p < end) && (quote || (*p != '>'))) {
+       if (quote) {
+         if (*p == quote) {
+           quote = 0;
+         }
+         p++;
+       } else if ((*p == '"') || (*p == '\'')) {
+         quote = *p++;
+       } else if (CC_ISSPACE(p[-1])
+                  && (p + 3 < end)
+                  && (cc_strncasecmp(p, "src", 3) == 0)) {
+         v = p + 3;
+         while ((v < end) && CC_ISSPACE(*v)) {
+           v++;
+         }
+         if ((v == end) || (*v != '=')) {
+           p = v;
+           continue;
+         }
+         v++;
+         while ((v < end) && CC_ISSPACE(*v)) {
+           v++;
+         }
+         if ((v < end) && ((*v == '"') || (*v == '\''))) {
+           quote = *v++;
+           vend = v;
+           while ((vend < end) && (*vend != quote)) {
+             vend++;
+           }
+         } else {
+           vend = v;
+           while ((vend < end) && !CC_ISSPACE(*vend) && (*vend != '>')) {
+             vend++;
+           }
+         }
+         if (is_local(v, vend - v)) {
+           if ((path = (char *)malloc(dirlen + (vend - v) + 1)) == NULL) {
+             perror("malloc");
+             exit(1);
+           }
+           if (*v == '/') {
+             dirlen = 0;
+           }
+           memcpy(path, fname, dirlen);
+           memcpy(path + dirlen, v, vend - v);
+           path[dirlen + (vend - v)] = '\0';
+           idx = media_add(m, path, v, vend - v);
+           free(path);
+           strbuf_nadd(sp, from, v - from);
+           sprintf(mark, "%c%ld%c", MEDIA_MARK, idx, MEDIA_MARK);
+           strbuf_add(sp, mark);
+           from = vend;
+           dirlen = (slash ? (size_t)(slash - fname) + 1 : 0);
+         }
+         p = vend;
+       } else {
+         p++;
+       }
+     }
+   }
+   strbuf_nadd(sp, from, end - from);
+}
+
+extern long media_finish(MEDIA_SET_T *m) {
+   long  i;
+   long  failed = 0;
+
+   if (!m) {
+     return 0;
+   }
+   ws_stop(&(m->sched));
+   for (i = 0; i < m->cnt; i++) {
+     if (m->files[i]->status == MEDIA_FAILED) {
+       failed++;
+     }
+   }
+   return failed;
+}
+
+static char changed_on_disk(MEDIA_FILE_T *f) {
+   struct stat st;
+
+   return ((stat(f->path, &st) == -1)
+           || ((size_t)st.st_size != f->orig_size)
+           || (st.st_mtime != f->mtime)
+           || (st.st_ino != f->ino));
+}
+
+extern long media_refresh(MEDIA_SET_T *m, const char *stale,
+                          long stale_cnt) {
+   MEDIA_FILE_T *f;
+   struct stat   st;
+   char         *reload;
+   long          cnt = 0;
+   long          i;
+
+   if (!m || (m->cnt == 0)) {
+     return 0;
+   }
+   ws_stop(&(m->sched));
+   if ((reload = (char *)calloc(m->cnt, 1)) == NULL) {
+     perror("calloc");
+     exit(1);
+   }
+   for (i = 0; i < m->cnt; i++) {
+     f = m->files[i];
+     if ((stale && (i < stale_cnt) && stale[i])
+         || (f->status == MEDIA_FAILED)
+         || changed_on_disk(f)) {
+       reload[i] = 1;
+       cnt++;
+     }
+   }
+   if (cnt) {
+     // Copies of a file that changed have to be read now,
+     // the first one may no longer be the same
+     for (i = 0; i < m->cnt; i++) {
+       f = m->files[i];
+       if (!reload[i] && (f->status == MEDIA_SAME) && reload[f->same_as]) {
+         reload[i] = 1;
+         cnt++;
+       }
+     }
+     memset(m->by_content, 0, sizeof(long) * m->slots);
+     for (i = 0; i < m->cnt; i++) {
+       f = m->files[i];
+       if (reload[i]) {
+         if (f->data) {
+           free(f->data);
+           f->data = NULL;
+         }
+         f->size = 0;
+         f->orig_size = 0;
+         f->crc = 0;
+         f->stored = 0;
+         f->same_as = 0;
+         f->status = MEDIA_PENDING;
+       } else if (f->status == MEDIA_READY) {
+         *content_slot(m, m->by_content, f->hash) = i + 1;
+       }
+     }
+     ws_start(&(m->sched), 0);
+     for (i = 0; i < m->cnt; i++) {
+       if (reload[i]) {
+         f = m->files[i];
+         ws_submit(&(m->sched), f, MEDIA_TASK_FILE,
+                   ((stat(f->path, &st) == 0) ? (size_t)st.st_size : 0));
+       }
+     }
+   }
+   free(reload);
+   return cnt;
+}
+
+static long marker(MEDIA_SET_T *m, const char *p, const char *end,
+                   const char **nextp) {
+   // Index of the file in the marker at p, -1 if not a marker
+   long idx = 0;
+   const char *q = p + 1;
+
+   while ((q < end) && CC_ISDIGIT(*q)) {
+     idx = idx * 10 + (*q - '0');
+     q++;
+   }
+   if ((q == p + 1) || (q >= end) || (*q != MEDIA_MARK)
+       || !m || (idx >= m->cnt)) {
+     // Not one of ours - shouldn't happen
+     *nextp = p + 1;
+     return -1;
+   }
+   *nextp = q + 1;
+   return idx;
+}
+
+static void scan(MEDIA_SET_T *m, const char *s, size_t len, STRBUF *out,
+                 char *listed, long *list, long *cntp) {
+   // Markers in len bytes of s: replaced in out (if not NULL),
+   // files not listed yet added to list (if not NULL)
+   const char   *end = s + len;
+   const char   *p;
+   const char   *next;
+   long          idx;
+   long          c;
+   MEDIA_FILE_T *f;
+
+   while ((p = memchr(s, MEDIA_MARK, end - s)) != NULL) {
+     if (out) {
+       strbuf_nadd(out, (char *)s, p - s);
+     }
+     if ((idx = marker(m, p, end, &next)) == -1) {
+       if (out) {
+         strbuf_addc(out, *p);
+       }
+       s = next;
+       continue;
+     }
+     f = m->files[idx];
+     if (f->status == MEDIA_FAILED) {
+       if (out) {
+         strbuf_add(out, f->ref);
+       }
+     } else {
+       if (out) {
+         strbuf_add(out, f->name);
+       }
+       c = (f->status == MEDIA_SAME ? f->same_as : idx);
+       if (listed && !listed[c]) {
+         listed[c] = 1;
+         list[(*cntp)++] = c;
+       }
+     }
+     s = next;
+   }
+   if (out) {
+     strbuf_nadd(out, (char *)s, end - s);
+   }
+}
+
+extern long *media_list(MEDIA_SET_T *m, const struct iovec *iov, int cnt,
+                        long *cntp) {
+   char *listed;
+   long *list;
+   int   i;
+
+   *cntp = 0;
+   if (((listed = (char *)calloc(m->cnt + 1, 1)) == NULL)
+       || ((list = (long *)malloc(sizeof(long) * (m->cnt + 1))) == NULL)) {
+     perror("malloc");
+     exit(1);
+   }
+   for (i = 0; i < cnt; i++) {
+     scan(m, (const char *)iov[i].iov_base, iov[i].iov_len, NULL,
+          listed, list, cntp);
+   }
+   free(listed);
+   return list;
+}
+
+extern void media_select(MEDIA_SET_T *m, const struct iovec *iov, int cnt) {
+   if (m->distinct) {
+     free(m->distinct);
+   }
+   m->distinct = media_list(m, iov, cnt, &(m->distinct_cnt));
+}
+
+extern char *media_resolve(MEDIA_SET_T *m, const char *s, size_t len,
+                           size_t *lenp) {
+   STRBUF b;
+
+   if (memchr(s, MEDIA_MARK, len) == NULL) {
+     return NULL;
+   }
+   strbuf_init(&b);
+   scan(m, s, len, &b, NULL, NULL, NULL);
+   if (b.s == NULL) {
+     strbuf_add(&b, "");
+   }
+   *lenp = b.curlen;
+   return b.s;
+}
+
+extern size_t media_size(MEDIA_SET_T *m, const char *s, size_t len,
+                         long *seen, long mark) {
+   const char   *end = s + len;
+   const char   *p;
+   const char   *next;
+   size_t        size = 0;
+   long          idx;
+   long          c;
+   MEDIA_FILE_T *f;
+
+   while ((p = memchr(s, MEDIA_MARK, end - s)) != NULL) {
+     idx = marker(m, p, end, &next);
+     s = next;
+     if (idx == -1) {
+       continue;
+     }
+     f = m->files[idx];
+     if (f->status == MEDIA_FAILED) {
+       size += strlen(f->ref);
+       continue;
+     }
+     size += strlen(f->name);
+     c = (f->status == MEDIA_SAME ? f->same_as : idx);
+     if (seen[c] != mark) {
+       seen[c] = mark;
+       // Data, and local and central headers
+       size += m->files[c]->size + MEDIA_ZIP_HEADERS
+               + 2 * strlen(m->files[c]->name);
+     }
+   }
+   return size;
+}
+
+extern MEDIA_FILE_T *media_entry(MEDIA_SET_T *m, long n) {
+   if (m && m->distinct && (n >= 0) && (n < m->distinct_cnt)) {
+     return m->files[m->distinct[n]];
+   }
+   return NULL;
+}
+
+extern void media_dispose(MEDIA_SET_T *m) {
+   long i;
+
+   if (m) {
+     (void)media_finish(m);
+     for (i = 0; i < m->cnt; i++) {
+       free(m->files[i]->path);
+       free(m->files[i]->ref);
+       if (m->files[i]->data) {
+         free(m->files[i]->data);
+       }
+       free(m->files[i]);
+     }
+     if (m->files) {
+       free(m->files);
+     }
+     if (m->by_path) {
+       free(m->by_path);
+       free(m->by_content);
+     }
+     if (m->distinct) {
+       free(m->distinct);
+     }
+     ws_dispose(&(m->sched));
+     pthread_mutex_destroy(&(m->lock));
+     memset(m, 0, sizeof(MEDIA_SET_T));
+   }
+}
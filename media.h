@@ -0,0 +1,117 @@
+/*
+ *   Local media files (images, videos ...) referenced by
+ *   questions, to be packaged with the quiz.
+ *
+ *   References are replaced in the text by a marker as they
+ *   are found, and files are read, hashed and compressed by
+ *   worker threads while parsing goes on, the largest first;
+ *   large files are deflated in pieces shared among the
+ *   threads. Files are stored
+ *   once per content, under a name derived from their hash;
+ *   markers are turned into these names at the end.
+ */
+#ifndef MEDIA_H
+
+#define MEDIA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "strbuf.h"
+#include "wsched.h"
+
+#define MEDIA_MARK       '\001'   // Not allowed in XML, never in text
+#define MEDIA_DIR        "media/"
+#define MEDIA_NAME_LEN   64
+
+#define MEDIA_PENDING    0
+#define MEDIA_READY      1
+#define MEDIA_SAME       2        // Same content as another file
+#define MEDIA_FAILED     3
+
+typedef struct media_file {
+          char          *path;        // To read the file
+          char          *ref;         // As written in the question
+          uint64_t       path_key;
+          unsigned char  hash[16];
+          char           name[MEDIA_NAME_LEN];  // Name in the archive
+          void          *data;        // Deflated, or as is if stored
+          size_t         size;
+          size_t         orig_size;
+          time_t         mtime;       // When read, to spot changes
+          ino_t          ino;
+          unsigned int   crc;
+          char           stored;      // Already compressed format
+          char           status;
+          long           same_as;     // When status is MEDIA_SAME
+          long           index;       // In the set
+          // While deflated in pieces
+          void         **parts;
+          size_t        *part_lens;
+          int            part_cnt;
+          int            parts_left;  // Pieces and CRC to go
+         } MEDIA_FILE_T;
+
+typedef struct media_set {
+          MEDIA_FILE_T  **files;
+          long            cnt;
+          long            alloc;
+          long           *by_path;    // Hash tables of indexes + 1
+          long           *by_content;
+          long            slots;      // Size of each table
+          long           *distinct;   // Files to store, in order
+          long            distinct_cnt;
+          WSCHED_T        sched;      // Workers
+          pthread_mutex_t lock;
+         } MEDIA_SET_T;
+
+extern void  media_init(MEDIA_SET_T *m, int nthreads);
+// Copies len bytes of HTML text s to sp, replacing references
+// (src attributes) to local files by markers. Relative paths
+// are relative to the directory of the file fname.
+extern void  media_rewrite(MEDIA_SET_T *m, STRBUF *sp,
+                           char *s, size_t len, const char *fname);
+// Waits for all files to be processed. Returns the number
+// of files that couldn't be read. Files can be added again
+// afterwards (workers restart).
+extern long  media_finish(MEDIA_SET_T *m);
+// Reads again the files that changed on disk since they were
+// read (other size, modification time or inode), those that
+// couldn't be read and the first stale_cnt files for which
+// stale[] is set, as well as files found identical to one of
+// them. Markers keep pointing to the same files.
+// Returns the number of files read again.
+extern long  media_refresh(MEDIA_SET_T *m, const char *stale,
+                           long stale_cnt);
+// Indexes of the files to store for the cnt fragments of iov,
+// in order of first reference (*cntp of them; to free). Can
+// be called from several threads once media_finish() has
+// returned.
+extern long *media_list(MEDIA_SET_T *m, const struct iovec *iov, int cnt,
+                        long *cntp);
+// Lists the files referenced in the fragments as the ones to
+// store.
+extern void  media_select(MEDIA_SET_T *m, const struct iovec *iov,
+                          int cnt);
+// Copy of the len bytes of s with markers replaced by archive
+// names (or by the original reference if the file was
+// unreadable), its length in *lenp; NULL if s has no marker.
+// Thread-safe as media_list().
+extern char *media_resolve(MEDIA_SET_T *m, const char *s, size_t len,
+                           size_t *lenp);
+// Bytes that the references in len bytes of s add to an
+// archive: names in the text and, for each file whose
+// seen[] entry (one per file) isn't mark yet, its data and
+// zip headers. Sets seen[] to mark for these files.
+extern size_t media_size(MEDIA_SET_T *m, const char *s, size_t len,
+                         long *seen, long mark);
+// n-th file (0-based) to store after media_select(),
+// in order of first reference. NULL past the last one.
+extern MEDIA_FILE_T *media_entry(MEDIA_SET_T *m, long n);
+extern void  media_dispose(MEDIA_SET_T *m);
+
+#endif
@@ -140,7 +140,8 @@
      possibility that the archive's central directory could be lost with this method if anything goes wrong, though.
 
      - ZIP archive support limitations:
-     No zip64 or spanning support. Extraction functions can only handle unencrypted, stored or deflated files.
+     No spanning support. Zip64 archives are read, and written when an entry, an offset or the number of entries needs it (all the writers, including
+     mz_zip_writer_add_file() and mz_zip_writer_add_from_zip_reader()). Extraction functions can only handle unencrypted, stored or deflated files.
      Requires streams capable of seeking.
 
    * This is a header file library, like stb_image.c. To get only a header file, either cut and paste the
@@ -195,7 +196,8 @@
   #define MINIZ_NO_TIME
 #endif
 
-#if !defined(MINIZ_NO_TIME) && !defined(MINIZ_NO_ARCHIVE_APIS)
+#if !defined(MINIZ_NO_ARCHIVE_APIS)
+  // Also for the time_t argument of the writers, ignored with MINIZ_NO_TIME
   #include <time.h>
 #endif
 
@@ -643,6 +645,10 @@ mz_bool mz_zip_writer_init_from_reader(mz_zip_archive *pZip, const char *pFilena
 // level_and_flags - compression level (0-10, see MZ_BEST_SPEED, MZ_BEST_COMPRESSION, etc.) logically OR'd with zero or more mz_zip_flags, or just set to MZ_DEFAULT_COMPRESSION.
 mz_bool mz_zip_writer_add_mem(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, mz_uint level_and_flags);
 mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32);
+// Same as mz_zip_writer_add_mem_ex(), but stamps the entry with *last_modified instead of the current time (if last_modified isn't NULL; ignored, and no time stored, with MINIZ_NO_TIME).
+mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, time_t *last_modified);
+// Same as mz_zip_writer_add_mem_ex_v2(), with the data in part_cnt parts written one after the other. More than one part requires MZ_ZIP_FLAG_COMPRESSED_DATA.
+mz_bool mz_zip_writer_add_parts(mz_zip_archive *pZip, const char *pArchive_name, const void * const *pParts, const size_t *pPart_sizes, mz_uint part_cnt, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, time_t *last_modified);
 
 #ifndef MINIZ_NO_STDIO
 // Adds the contents of a disk file to an archive. This function also records the disk file's modified time into the archive.
@@ -959,6 +965,7 @@ typedef unsigned char mz_validate_uint64[sizeof(mz_uint64)==8 ? 1 : -1];
   #define MZ_READ_LE16(p) ((mz_uint32)(((const mz_uint8 *)(p))[0]) | ((mz_uint32)(((const mz_uint8 *)(p))[1]) << 8U))
   #define MZ_READ_LE32(p) ((mz_uint32)(((const mz_uint8 *)(p))[0]) | ((mz_uint32)(((const mz_uint8 *)(p))[1]) << 8U) | ((mz_uint32)(((const mz_uint8 *)(p))[2]) << 16U) | ((mz_uint32)(((const mz_uint8 *)(p))[3]) << 24U))
 #endif
+#define MZ_READ_LE64(p) (((mz_uint64)MZ_READ_LE32(p)) | (((mz_uint64)MZ_READ_LE32((const mz_uint8 *)(p) + sizeof(mz_uint32))) << 32U))
 
 #ifdef _MSC_VER
   #define MZ_FORCEINLINE __forceinline
@@ -2260,6 +2267,71 @@ static int tdefl_flush_block(tdefl_compressor *d, int flush)
   return d->m_output_flush_remaining;
 }
 
+#if MINIZ_USE_UNALIGNED_LOADS_AND_STORES && MINIZ_LITTLE_ENDIAN && MINIZ_HAS_64BIT_REGISTERS && defined(__GNUC__)
+#define TDEFL_WIDE_MATCH_LEN 1
+// Match length extension: number of equal leading bytes of p and q, up to TDEFL_MAX_MATCH_LEN.
+// Compares 64-bit words (or 16/32 bytes at a time with SSE2/AVX2, chosen at runtime by
+// tdefl_init()) instead of 16-bit words; the result, and so the output, is the same.
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+typedef mz_uint (*tdefl_match_len_func)(const mz_uint8 *p, const mz_uint8 *q);
+static mz_uint tdefl_match_len_tail(const mz_uint8 *p, const mz_uint8 *q, mz_uint i)
+{
+  while ((i < TDEFL_MAX_MATCH_LEN) && (p[i] == q[i])) i++;
+  return i;
+}
+static mz_uint tdefl_match_len_words(const mz_uint8 *p, const mz_uint8 *q)
+{
+  mz_uint i; mz_uint64 x;
+  for (i = 0; i + 8 <= TDEFL_MAX_MATCH_LEN; i += 8)
+  {
+    if ((x = *(const mz_uint64 *)(p + i) ^ *(const mz_uint64 *)(q + i)) != 0) return i + ((mz_uint)__builtin_ctzll(x) >> 3);
+  }
+  return tdefl_match_len_tail(p, q, i);
+}
+#ifdef __SSE2__
+static mz_uint tdefl_match_len_sse2(const mz_uint8 *p, const mz_uint8 *q)
+{
+  mz_uint i; int m;
+  for (i = 0; i + 16 <= TDEFL_MAX_MATCH_LEN; i += 16)
+  {
+    m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(const void *)(p + i)), _mm_loadu_si128((const __m128i *)(const void *)(q + i)))) ^ 0xFFFF;
+    if (m) return i + (mz_uint)__builtin_ctz((unsigned int)m);
+  }
+  return tdefl_match_len_tail(p, q, i);
+}
+#endif
+#if defined(__x86_64__) && !defined(__clang__)
+#include <immintrin.h>
+#define TDEFL_HAS_AVX2_MATCH_LEN 1
+__attribute__((target("avx2"))) static mz_uint tdefl_match_len_avx2(const mz_uint8 *p, const mz_uint8 *q)
+{
+  mz_uint i; unsigned int m;
+  for (i = 0; i + 32 <= TDEFL_MAX_MATCH_LEN; i += 32)
+  {
+    m = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(const void *)(p + i)), _mm256_loadu_si256((const __m256i *)(const void *)(q + i)))) ^ 0xFFFFFFFFU;
+    if (m) return i + (mz_uint)__builtin_ctz(m);
+  }
+  return tdefl_match_len_tail(p, q, i);
+}
+#endif
+static tdefl_match_len_func tdefl_match_len = tdefl_match_len_words;
+static void tdefl_select_match_len(void)
+{
+#ifdef TDEFL_HAS_AVX2_MATCH_LEN
+  if (getenv("MINIZ_NO_SIMD") == NULL)
+  {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) { tdefl_match_len = tdefl_match_len_avx2; return; }
+  }
+#endif
+#ifdef __SSE2__
+  if (getenv("MINIZ_NO_SIMD") == NULL) tdefl_match_len = tdefl_match_len_sse2;
+#endif
+}
+#endif // MINIZ_USE_UNALIGNED_LOADS_AND_STORES && MINIZ_LITTLE_ENDIAN && MINIZ_HAS_64BIT_REGISTERS && __GNUC__
+
 #if MINIZ_USE_UNALIGNED_LOADS_AND_STORES
 #define TDEFL_READ_UNALIGNED_WORD(p) *(const mz_uint16*)(p)
 static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahead_pos, mz_uint max_dist, mz_uint max_match_len, mz_uint *pMatch_dist, mz_uint *pMatch_len)
@@ -2281,7 +2353,16 @@ static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahe
         if (TDEFL_READ_UNALIGNED_WORD(&d->m_dict[probe_pos + match_len - 1]) == c01) break;
       TDEFL_PROBE; TDEFL_PROBE; TDEFL_PROBE;
     }
-    if (!dist) break; q = (const mz_uint16*)(d->m_dict + probe_pos); if (TDEFL_READ_UNALIGNED_WORD(q) != s01) continue; p = s; probe_len = 32;
+    if (!dist) break; q = (const mz_uint16*)(d->m_dict + probe_pos); if (TDEFL_READ_UNALIGNED_WORD(q) != s01) continue;
+#ifdef TDEFL_WIDE_MATCH_LEN
+    (void)p; probe_len = tdefl_match_len((const mz_uint8 *)s, (const mz_uint8 *)q);
+    if (probe_len == TDEFL_MAX_MATCH_LEN)
+    {
+      *pMatch_dist = dist; *pMatch_len = MZ_MIN(max_match_len, TDEFL_MAX_MATCH_LEN); break;
+    }
+    else if (probe_len > match_len)
+#else
+    p = s; probe_len = 32;
     do { } while ( (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) && (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) &&
                    (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) && (TDEFL_READ_UNALIGNED_WORD(++p) == TDEFL_READ_UNALIGNED_WORD(++q)) && (--probe_len > 0) );
     if (!probe_len)
@@ -2289,6 +2370,7 @@ static MZ_FORCEINLINE void tdefl_find_match(tdefl_compressor *d, mz_uint lookahe
       *pMatch_dist = dist; *pMatch_len = MZ_MIN(max_match_len, TDEFL_MAX_MATCH_LEN); break;
     }
     else if ((probe_len = ((mz_uint)(p - s) * 2) + (mz_uint)(*(const mz_uint8*)p == *(const mz_uint8*)q)) > match_len)
+#endif
     {
       *pMatch_dist = dist; if ((*pMatch_len = match_len = MZ_MIN(max_match_len, probe_len)) == max_match_len) break;
       c01 = TDEFL_READ_UNALIGNED_WORD(&d->m_dict[pos + match_len - 1]);
@@ -2366,6 +2448,11 @@ static mz_bool tdefl_compress_fast(tdefl_compressor *d)
 
       if (((cur_match_dist = (mz_uint16)(lookahead_pos - probe_pos)) <= dict_size) && ((*(const mz_uint32 *)(d->m_dict + (probe_pos &= TDEFL_LZ_DICT_SIZE_MASK)) & 0xFFFFFF) == first_trigram))
       {
+#ifdef TDEFL_WIDE_MATCH_LEN
+        cur_match_len = tdefl_match_len(pCur_dict, d->m_dict + probe_pos);
+        if ((cur_match_len == TDEFL_MAX_MATCH_LEN) && (!cur_match_dist))
+          cur_match_len = 0;
+#else
         const mz_uint16 *p = (const mz_uint16 *)pCur_dict;
         const mz_uint16 *q = (const mz_uint16 *)(d->m_dict + probe_pos);
         mz_uint32 probe_len = 32;
@@ -2374,6 +2461,7 @@ static mz_bool tdefl_compress_fast(tdefl_compressor *d)
         cur_match_len = ((mz_uint)(p - (const mz_uint16 *)pCur_dict) * 2) + (mz_uint)(*(const mz_uint8 *)p == *(const mz_uint8 *)q);
         if (!probe_len)
           cur_match_len = cur_match_dist ? TDEFL_MAX_MATCH_LEN : 0;
+#endif
 
         if ((cur_match_len < TDEFL_MIN_MATCH_LEN) || ((cur_match_len == TDEFL_MIN_MATCH_LEN) && (cur_match_dist >= 8U*1024U)))
         {
@@ -2511,6 +2599,25 @@ static mz_bool tdefl_compress_normal(tdefl_compressor *d)
       const mz_uint8 *pSrc_end = pSrc + num_bytes_to_process;
       src_buf_left -= num_bytes_to_process;
       d->m_lookahead_size += num_bytes_to_process;
+#ifdef TDEFL_WIDE_MATCH_LEN
+      // Copy the bytes in at most two runs (the dictionary wraps), then insert them in the hash chains
+      {
+        mz_uint n = MZ_MIN(TDEFL_LZ_DICT_SIZE - dst_pos, num_bytes_to_process), k = 0;
+        while (n)
+        {
+          memcpy(d->m_dict + dst_pos, pSrc + k, n);
+          if (dst_pos < (TDEFL_MAX_MATCH_LEN - 1))
+            memcpy(d->m_dict + TDEFL_LZ_DICT_SIZE + dst_pos, pSrc + k, MZ_MIN(n, (TDEFL_MAX_MATCH_LEN - 1) - dst_pos));
+          k += n; dst_pos = (dst_pos + n) & TDEFL_LZ_DICT_SIZE_MASK; n = num_bytes_to_process - k;
+        }
+      }
+      while (pSrc != pSrc_end)
+      {
+        mz_uint ins = ins_pos & TDEFL_LZ_DICT_SIZE_MASK;
+        hash = ((hash << TDEFL_LZ_HASH_SHIFT) ^ *pSrc++) & (TDEFL_LZ_HASH_SIZE - 1);
+        d->m_next[ins] = d->m_hash[hash]; d->m_hash[hash] = (mz_uint16)(ins_pos); ins_pos++;
+      }
+#else
       while (pSrc != pSrc_end)
       {
         mz_uint8 c = *pSrc++; d->m_dict[dst_pos] = c; if (dst_pos < (TDEFL_MAX_MATCH_LEN - 1)) d->m_dict[TDEFL_LZ_DICT_SIZE + dst_pos] = c;
@@ -2518,6 +2625,7 @@ static mz_bool tdefl_compress_normal(tdefl_compressor *d)
         d->m_next[ins_pos & TDEFL_LZ_DICT_SIZE_MASK] = d->m_hash[hash]; d->m_hash[hash] = (mz_uint16)(ins_pos);
         dst_pos = (dst_pos + 1) & TDEFL_LZ_DICT_SIZE_MASK; ins_pos++;
       }
+#endif
     }
     else
     {
@@ -2696,6 +2804,10 @@ tdefl_status tdefl_compress_buffer(tdefl_compressor *d, const void *pIn_buf, siz
 
 tdefl_status tdefl_init(tdefl_compressor *d, tdefl_put_buf_func_ptr pPut_buf_func, void *pPut_buf_user, int flags)
 {
+#ifdef TDEFL_WIDE_MATCH_LEN
+  static int match_len_selected = 0;
+  if (!match_len_selected) { tdefl_select_match_len(); match_len_selected = 1; }
+#endif
   d->m_pPut_buf_func = pPut_buf_func; d->m_pPut_buf_user = pPut_buf_user;
   d->m_flags = (mz_uint)(flags); d->m_max_probes[0] = 1 + ((flags & 0xFFF) + 2) / 3; d->m_greedy_parsing = (flags & TDEFL_GREEDY_PARSING_FLAG) != 0;
   d->m_max_probes[1] = 1 + (((flags & 0xFFF) >> 2) + 2) / 3;
@@ -2964,8 +3076,25 @@ enum
   // End of central directory offsets
   MZ_ZIP_ECDH_SIG_OFS = 0, MZ_ZIP_ECDH_NUM_THIS_DISK_OFS = 4, MZ_ZIP_ECDH_NUM_DISK_CDIR_OFS = 6, MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS = 8,
   MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS = 10, MZ_ZIP_ECDH_CDIR_SIZE_OFS = 12, MZ_ZIP_ECDH_CDIR_OFS_OFS = 16, MZ_ZIP_ECDH_COMMENT_SIZE_OFS = 20,
+  // Zip64 records (written when sizes, offsets or the number of entries don't fit the classic fields)
+  MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG = 0x06064b50, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG = 0x07064b50,
+  MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE = 56, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE = 20,
+  MZ_ZIP64_EXTRA_FIELD_ID = 0x0001, MZ_ZIP64_LOCAL_EXTRA_SIZE = 20, MZ_ZIP64_VERSION_NEEDED = 45,
+  // Zip64 end of central directory offsets
+  MZ_ZIP64_ECDH_SIG_OFS = 0, MZ_ZIP64_ECDH_SIZE_OF_RECORD_OFS = 4, MZ_ZIP64_ECDH_VERSION_MADE_BY_OFS = 12, MZ_ZIP64_ECDH_VERSION_NEEDED_OFS = 14,
+  MZ_ZIP64_ECDH_NUM_THIS_DISK_OFS = 16, MZ_ZIP64_ECDH_NUM_DISK_CDIR_OFS = 20, MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS = 24,
+  MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS = 32, MZ_ZIP64_ECDH_CDIR_SIZE_OFS = 40, MZ_ZIP64_ECDH_CDIR_OFS_OFS = 48,
+  // Zip64 end of central directory locator offsets
+  MZ_ZIP64_ECDL_SIG_OFS = 0, MZ_ZIP64_ECDL_NUM_DISK_CDIR_OFS = 4, MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS = 8, MZ_ZIP64_ECDL_TOTAL_NUMBER_OF_DISKS_OFS = 16,
 };
 
+// Sizes and offsets from this value on are stored in zip64 extra fields
+#define MZ_ZIP64_MAX_32     0xFFFFFFFFU
+#define MZ_ZIP64_MAX_16     0xFFFFU
+// Entries whose uncompressed size reaches this get a zip64 local header up front, since the
+// header size must be known before compressing (leaves room for deflate expanding the data).
+#define MZ_ZIP64_LOCAL_THRESHOLD  0xFF000000U
+
 typedef struct
 {
   void *m_p;
@@ -3165,10 +3294,50 @@ static void mz_zip_reader_sort_central_dir_offsets_by_filename(mz_zip_archive *p
   }
 }
 
+// Sizes and local header offset of a central directory record. Those that don't fit in 32 bits are in its zip64 extra field, in this order.
+static mz_bool mz_zip_reader_cdh_sizes(const mz_uint8 *p, mz_uint64 *pComp_size, mz_uint64 *pUncomp_size, mz_uint64 *pLocal_header_ofs)
+{
+  const mz_uint8 *pExtra = p + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+  mz_uint extra_len = MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS);
+  *pComp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+  *pUncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+  *pLocal_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+  if ((*pComp_size != MZ_ZIP64_MAX_32) && (*pUncomp_size != MZ_ZIP64_MAX_32) && (*pLocal_header_ofs != MZ_ZIP64_MAX_32))
+    return MZ_TRUE;
+  while (extra_len >= 4)
+  {
+    mz_uint field_id = MZ_READ_LE16(pExtra), field_size = MZ_READ_LE16(pExtra + 2);
+    if ((field_size + 4U) > extra_len)
+      return MZ_FALSE;
+    if (field_id == MZ_ZIP64_EXTRA_FIELD_ID)
+    {
+      const mz_uint8 *pField = pExtra + 4;
+      if (*pUncomp_size == MZ_ZIP64_MAX_32)
+      {
+        if (field_size < 8) return MZ_FALSE;
+        *pUncomp_size = MZ_READ_LE64(pField); pField += 8; field_size -= 8;
+      }
+      if (*pComp_size == MZ_ZIP64_MAX_32)
+      {
+        if (field_size < 8) return MZ_FALSE;
+        *pComp_size = MZ_READ_LE64(pField); pField += 8; field_size -= 8;
+      }
+      if (*pLocal_header_ofs == MZ_ZIP64_MAX_32)
+      {
+        if (field_size < 8) return MZ_FALSE;
+        *pLocal_header_ofs = MZ_READ_LE64(pField);
+      }
+      return MZ_TRUE;
+    }
+    pExtra += 4 + field_size; extra_len -= 4 + field_size;
+  }
+  return MZ_FALSE;
+}
+
 static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 flags)
 {
-  mz_uint cdir_size, num_this_disk, cdir_disk_index;
-  mz_uint64 cdir_ofs;
+  mz_uint num_this_disk, cdir_disk_index;
+  mz_uint64 cdir_ofs, cdir_size, total_files;
   mz_int64 cur_file_ofs;
   const mz_uint8 *p;
   mz_uint32 buf_u32[4096 / sizeof(mz_uint32)]; mz_uint8 *pBuf = (mz_uint8 *)buf_u32;
@@ -3199,7 +3368,7 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 fl
   if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs, pBuf, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE)
     return MZ_FALSE;
   if ((MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_SIG_OFS) != MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG) ||
-      ((pZip->m_total_files = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS)) != MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS)))
+      ((total_files = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS)) != MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS)))
     return MZ_FALSE;
 
   num_this_disk = MZ_READ_LE16(pBuf + MZ_ZIP_ECDH_NUM_THIS_DISK_OFS);
@@ -3207,11 +3376,39 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 fl
   if (((num_this_disk | cdir_disk_index) != 0) && ((num_this_disk != 1) || (cdir_disk_index != 1)))
     return MZ_FALSE;
 
-  if ((cdir_size = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_SIZE_OFS)) < pZip->m_total_files * MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)
+  cdir_size = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_SIZE_OFS);
+  cdir_ofs = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_OFS_OFS);
+
+  // A zip64 locator just before the record points to the zip64 end of central directory, which holds the real values.
+  if (cur_file_ofs >= (MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE))
+  {
+    mz_uint64 zip64_ofs;
+    if (pZip->m_pRead(pZip->m_pIO_opaque, cur_file_ofs - MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE, pBuf, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE)
+      return MZ_FALSE;
+    if (MZ_READ_LE32(pBuf + MZ_ZIP64_ECDL_SIG_OFS) == MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG)
+    {
+      zip64_ofs = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS);
+      if ((zip64_ofs + MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) > pZip->m_archive_size)
+        return MZ_FALSE;
+      if (pZip->m_pRead(pZip->m_pIO_opaque, zip64_ofs, pBuf, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE) != MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE)
+        return MZ_FALSE;
+      if ((MZ_READ_LE32(pBuf + MZ_ZIP64_ECDH_SIG_OFS) != MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG) ||
+          ((total_files = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS)) != MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS)))
+        return MZ_FALSE;
+      cdir_size = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_SIZE_OFS);
+      cdir_ofs = MZ_READ_LE64(pBuf + MZ_ZIP64_ECDH_CDIR_OFS_OFS);
+    }
+  }
+
+  // The central directory is read in memory, with 32-bit offsets
+  if ((total_files >= MZ_ZIP64_MAX_32) || (cdir_size >= MZ_ZIP64_MAX_32))
     return MZ_FALSE;
+  pZip->m_total_files = (mz_uint32)total_files;
 
-  cdir_ofs = MZ_READ_LE32(pBuf + MZ_ZIP_ECDH_CDIR_OFS_OFS);
-  if ((cdir_ofs + (mz_uint64)cdir_size) > pZip->m_archive_size)
+  if (cdir_size < (mz_uint64)pZip->m_total_files * MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)
+    return MZ_FALSE;
+
+  if ((cdir_ofs + cdir_size) > pZip->m_archive_size)
     return MZ_FALSE;
 
   pZip->m_central_directory_file_ofs = cdir_ofs;
@@ -3221,7 +3418,7 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 fl
      mz_uint i, n;
 
     // Read the entire central directory into a heap block, and allocate another heap block to hold the unsorted central dir file record offsets, and another to hold the sorted indices.
-    if ((!mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir, cdir_size, MZ_FALSE)) ||
+    if ((!mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir, (size_t)cdir_size, MZ_FALSE)) ||
         (!mz_zip_array_resize(pZip, &pZip->m_pState->m_central_dir_offsets, pZip->m_total_files, MZ_FALSE)))
       return MZ_FALSE;
 
@@ -3231,29 +3428,30 @@ static mz_bool mz_zip_reader_read_central_dir(mz_zip_archive *pZip, mz_uint32 fl
         return MZ_FALSE;
     }
 
-    if (pZip->m_pRead(pZip->m_pIO_opaque, cdir_ofs, pZip->m_pState->m_central_dir.m_p, cdir_size) != cdir_size)
+    if (pZip->m_pRead(pZip->m_pIO_opaque, cdir_ofs, pZip->m_pState->m_central_dir.m_p, (size_t)cdir_size) != cdir_size)
       return MZ_FALSE;
 
-    // Now create an index into the central directory file records, do some basic sanity checking on each record, and check for zip64 entries (which are not yet supported).
+    // Now create an index into the central directory file records, and do some basic sanity checking on each record (zip64 values included).
     p = (const mz_uint8 *)pZip->m_pState->m_central_dir.m_p;
-    for (n = cdir_size, i = 0; i < pZip->m_total_files; ++i)
+    for (n = (mz_uint)cdir_size, i = 0; i < pZip->m_total_files; ++i)
     {
-      mz_uint total_header_size, comp_size, decomp_size, disk_index;
+      mz_uint total_header_size, disk_index;
+      mz_uint64 comp_size, decomp_size, local_header_ofs;
       if ((n < MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) || (MZ_READ_LE32(p) != MZ_ZIP_CENTRAL_DIR_HEADER_SIG))
         return MZ_FALSE;
       MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_central_dir_offsets, mz_uint32, i) = (mz_uint32)(p - (const mz_uint8 *)pZip->m_pState->m_central_dir.m_p);
       if (sort_central_dir)
         MZ_ZIP_ARRAY_ELEMENT(&pZip->m_pState->m_sorted_central_dir_offsets, mz_uint32, i) = i;
-      comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-      decomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
-      if (((!MZ_READ_LE32(p + MZ_ZIP_CDH_METHOD_OFS)) && (decomp_size != comp_size)) || (decomp_size && !comp_size) || (decomp_size == 0xFFFFFFFF) || (comp_size == 0xFFFFFFFF))
+      if ((total_header_size = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS)) > n)
+        return MZ_FALSE;
+      if (!mz_zip_reader_cdh_sizes(p, &comp_size, &decomp_size, &local_header_ofs))
+        return MZ_FALSE;
+      if (((!MZ_READ_LE32(p + MZ_ZIP_CDH_METHOD_OFS)) && (decomp_size != comp_size)) || (decomp_size && !comp_size))
         return MZ_FALSE;
       disk_index = MZ_READ_LE16(p + MZ_ZIP_CDH_DISK_START_OFS);
       if ((disk_index != num_this_disk) && (disk_index != 1))
         return MZ_FALSE;
-      if (((mz_uint64)MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS) + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + comp_size) > pZip->m_archive_size)
-        return MZ_FALSE;
-      if ((total_header_size = MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_EXTRA_LEN_OFS) + MZ_READ_LE16(p + MZ_ZIP_CDH_COMMENT_LEN_OFS)) > n)
+      if ((local_header_ofs + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + comp_size) > pZip->m_archive_size)
         return MZ_FALSE;
       n -= total_header_size; p += total_header_size;
     }
@@ -3414,11 +3612,10 @@ mz_bool mz_zip_reader_file_stat(mz_zip_archive *pZip, mz_uint file_index, mz_zip
   pStat->m_time = mz_zip_dos_to_time_t(MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_TIME_OFS), MZ_READ_LE16(p + MZ_ZIP_CDH_FILE_DATE_OFS));
 #endif
   pStat->m_crc32 = MZ_READ_LE32(p + MZ_ZIP_CDH_CRC32_OFS);
-  pStat->m_comp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
-  pStat->m_uncomp_size = MZ_READ_LE32(p + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+  if (!mz_zip_reader_cdh_sizes(p, &pStat->m_comp_size, &pStat->m_uncomp_size, &pStat->m_local_header_ofs))
+    return MZ_FALSE;
   pStat->m_internal_attr = MZ_READ_LE16(p + MZ_ZIP_CDH_INTERNAL_ATTR_OFS);
   pStat->m_external_attr = MZ_READ_LE32(p + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS);
-  pStat->m_local_header_ofs = MZ_READ_LE32(p + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
 
   // Copy as much of the filename and comment as possible.
   n = MZ_READ_LE16(p + MZ_ZIP_CDH_FILENAME_LEN_OFS); n = MZ_MIN(n, MZ_ZIP_MAX_ARCHIVE_FILENAME_SIZE - 1);
@@ -3968,6 +4165,9 @@ static void mz_write_le16(mz_uint8 *p, mz_uint16 v) { p[0] = (mz_uint8)v; p[1] =
 static void mz_write_le32(mz_uint8 *p, mz_uint32 v) { p[0] = (mz_uint8)v; p[1] = (mz_uint8)(v >> 8); p[2] = (mz_uint8)(v >> 16); p[3] = (mz_uint8)(v >> 24); }
 #define MZ_WRITE_LE16(p, v) mz_write_le16((mz_uint8 *)(p), (mz_uint16)(v))
 #define MZ_WRITE_LE32(p, v) mz_write_le32((mz_uint8 *)(p), (mz_uint32)(v))
+static void mz_write_le64(mz_uint8 *p, mz_uint64 v) { mz_write_le32(p, (mz_uint32)v); mz_write_le32(p + 4, (mz_uint32)(v >> 32)); }
+#define MZ_WRITE_LE64(p, v) mz_write_le64((mz_uint8 *)(p), (mz_uint64)(v))
+#define MZ_CLAMP32(v) (((mz_uint64)(v) >= MZ_ZIP64_MAX_32) ? MZ_ZIP64_MAX_32 : (mz_uint32)(v))
 
 mz_bool mz_zip_writer_init(mz_zip_archive *pZip, mz_uint64 existing_size)
 {
@@ -4159,14 +4359,14 @@ static mz_bool mz_zip_writer_create_local_dir_header(mz_zip_archive *pZip, mz_ui
   (void)pZip;
   memset(pDst, 0, MZ_ZIP_LOCAL_DIR_HEADER_SIZE);
   MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_SIG_OFS, MZ_ZIP_LOCAL_DIR_HEADER_SIG);
-  MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_VERSION_NEEDED_OFS, method ? 20 : 0);
+  MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_VERSION_NEEDED_OFS, ((comp_size >= MZ_ZIP64_MAX_32) || (uncomp_size >= MZ_ZIP64_MAX_32)) ? MZ_ZIP64_VERSION_NEEDED : (method ? 20 : 0));
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_BIT_FLAG_OFS, bit_flags);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_METHOD_OFS, method);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILE_TIME_OFS, dos_time);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILE_DATE_OFS, dos_date);
   MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_CRC32_OFS, uncomp_crc32);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS, comp_size);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS, uncomp_size);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_COMPRESSED_SIZE_OFS, MZ_CLAMP32(comp_size));
+  MZ_WRITE_LE32(pDst + MZ_ZIP_LDH_DECOMPRESSED_SIZE_OFS, MZ_CLAMP32(uncomp_size));
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_FILENAME_LEN_OFS, filename_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_LDH_EXTRA_LEN_OFS, extra_size);
   return MZ_TRUE;
@@ -4177,19 +4377,19 @@ static mz_bool mz_zip_writer_create_central_dir_header(mz_zip_archive *pZip, mz_
   (void)pZip;
   memset(pDst, 0, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_SIG_OFS, MZ_ZIP_CENTRAL_DIR_HEADER_SIG);
-  MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, method ? 20 : 0);
+  MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_VERSION_NEEDED_OFS, ((comp_size >= MZ_ZIP64_MAX_32) || (uncomp_size >= MZ_ZIP64_MAX_32) || (local_header_ofs >= MZ_ZIP64_MAX_32)) ? MZ_ZIP64_VERSION_NEEDED : (method ? 20 : 0));
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_BIT_FLAG_OFS, bit_flags);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_METHOD_OFS, method);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_TIME_OFS, dos_time);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILE_DATE_OFS, dos_date);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_CRC32_OFS, uncomp_crc32);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, comp_size);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, uncomp_size);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS, MZ_CLAMP32(comp_size));
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS, MZ_CLAMP32(uncomp_size));
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_FILENAME_LEN_OFS, filename_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_EXTRA_LEN_OFS, extra_size);
   MZ_WRITE_LE16(pDst + MZ_ZIP_CDH_COMMENT_LEN_OFS, comment_size);
   MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS, ext_attributes);
-  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_header_ofs);
+  MZ_WRITE_LE32(pDst + MZ_ZIP_CDH_LOCAL_HEADER_OFS, MZ_CLAMP32(local_header_ofs));
   return MZ_TRUE;
 }
 
@@ -4199,16 +4399,30 @@ static mz_bool mz_zip_writer_add_to_central_dir(mz_zip_archive *pZip, const char
   mz_uint32 central_dir_ofs = (mz_uint32)pState->m_central_dir.m_size;
   size_t orig_central_dir_size = pState->m_central_dir.m_size;
   mz_uint8 central_dir_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
+  mz_uint8 zip64_extra[4 + 3 * sizeof(mz_uint64)];
+  mz_uint16 zip64_extra_size = 0;
 
-  // No zip64 support yet
-  if ((local_header_ofs > 0xFFFFFFFF) || (((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + extra_size + comment_size) > 0xFFFFFFFF))
+  // Values that don't fit in 32 bits go, in this order, to a zip64 extra field
+  if ((uncomp_size >= MZ_ZIP64_MAX_32) || (comp_size >= MZ_ZIP64_MAX_32) || (local_header_ofs >= MZ_ZIP64_MAX_32))
+  {
+    zip64_extra_size = 4;
+    if (uncomp_size >= MZ_ZIP64_MAX_32) { MZ_WRITE_LE64(zip64_extra + zip64_extra_size, uncomp_size); zip64_extra_size += 8; }
+    if (comp_size >= MZ_ZIP64_MAX_32) { MZ_WRITE_LE64(zip64_extra + zip64_extra_size, comp_size); zip64_extra_size += 8; }
+    if (local_header_ofs >= MZ_ZIP64_MAX_32) { MZ_WRITE_LE64(zip64_extra + zip64_extra_size, local_header_ofs); zip64_extra_size += 8; }
+    MZ_WRITE_LE16(zip64_extra, MZ_ZIP64_EXTRA_FIELD_ID);
+    MZ_WRITE_LE16(zip64_extra + 2, zip64_extra_size - 4);
+  }
+
+  // The central directory itself is kept in memory, with 32-bit offsets
+  if ((((mz_uint64)pState->m_central_dir.m_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size + zip64_extra_size + extra_size + comment_size) > 0xFFFFFFFF) || (extra_size + zip64_extra_size > 0xFFFF))
     return MZ_FALSE;
 
-  if (!mz_zip_writer_create_central_dir_header(pZip, central_dir_header, filename_size, extra_size, comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_header_ofs, ext_attributes))
+  if (!mz_zip_writer_create_central_dir_header(pZip, central_dir_header, filename_size, (mz_uint16)(zip64_extra_size + extra_size), comment_size, uncomp_size, comp_size, uncomp_crc32, method, bit_flags, dos_time, dos_date, local_header_ofs, ext_attributes))
     return MZ_FALSE;
 
   if ((!mz_zip_array_push_back(pZip, &pState->m_central_dir, central_dir_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pFilename, filename_size)) ||
+      (!mz_zip_array_push_back(pZip, &pState->m_central_dir, zip64_extra, zip64_extra_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pExtra, extra_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir, pComment, comment_size)) ||
       (!mz_zip_array_push_back(pZip, &pState->m_central_dir_offsets, &central_dir_ofs, 1)))
@@ -4260,38 +4474,61 @@ static mz_bool mz_zip_writer_write_zeros(mz_zip_archive *pZip, mz_uint64 cur_fil
 
 mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32)
 {
+  return mz_zip_writer_add_mem_ex_v2(pZip, pArchive_name, pBuf, buf_size, pComment, comment_size, level_and_flags, uncomp_size, uncomp_crc32, NULL);
+}
+
+mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, time_t *last_modified)
+{
+  return mz_zip_writer_add_parts(pZip, pArchive_name, &pBuf, &buf_size, 1, pComment, comment_size, level_and_flags, uncomp_size, uncomp_crc32, last_modified);
+}
+
+mz_bool mz_zip_writer_add_parts(mz_zip_archive *pZip, const char *pArchive_name, const void * const *pParts, const size_t *pPart_sizes, mz_uint part_cnt, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, time_t *last_modified)
+{
+  const void *pBuf = (part_cnt ? pParts[0] : NULL);
+  size_t buf_size = 0;
+  mz_uint i;
   mz_uint16 method = 0, dos_time = 0, dos_date = 0;
   mz_uint level, ext_attributes = 0, num_alignment_padding_bytes;
   mz_uint64 local_dir_header_ofs = pZip->m_archive_size, cur_archive_file_ofs = pZip->m_archive_size, comp_size = 0;
   size_t archive_name_size;
   mz_uint8 local_dir_header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
+  mz_uint8 local_zip64_extra[MZ_ZIP64_LOCAL_EXTRA_SIZE];
   tdefl_compressor *pComp = NULL;
-  mz_bool store_data_uncompressed;
+  mz_bool store_data_uncompressed, zip64;
   mz_zip_internal_state *pState;
 
+  for (i = 0; i < part_cnt; i++)
+    buf_size += pPart_sizes[i];
   if ((int)level_and_flags < 0)
     level_and_flags = MZ_DEFAULT_LEVEL;
   level = level_and_flags & 0xF;
   store_data_uncompressed = ((!level) || (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA));
 
-  if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || ((buf_size) && (!pBuf)) || (!pArchive_name) || ((comment_size) && (!pComment)) || (pZip->m_total_files == 0xFFFF) || (level > MZ_UBER_COMPRESSION))
+  // Parts can only be copied as they are
+  if ((part_cnt > 1) && (!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)))
+    return MZ_FALSE;
+  if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING) || ((buf_size) && (!pBuf)) || (!pArchive_name) || ((comment_size) && (!pComment)) || (pZip->m_total_files == MZ_ZIP64_MAX_32) || (level > MZ_UBER_COMPRESSION))
     return MZ_FALSE;
 
   pState = pZip->m_pState;
 
   if ((!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)) && (uncomp_size))
     return MZ_FALSE;
-  // No zip64 support yet
-  if ((buf_size > 0xFFFFFFFF) || (uncomp_size > 0xFFFFFFFF))
-    return MZ_FALSE;
+  // Large entries get both sizes in a zip64 extra field of the local header
+  zip64 = ((buf_size >= MZ_ZIP64_LOCAL_THRESHOLD) || (uncomp_size >= MZ_ZIP64_LOCAL_THRESHOLD));
   if (!mz_zip_writer_validate_archive_name(pArchive_name))
     return MZ_FALSE;
 
 #ifndef MINIZ_NO_TIME
+  if (last_modified)
+    mz_zip_time_to_dos_time(*last_modified, &dos_time, &dos_date);
+  else
   {
     time_t cur_time; time(&cur_time);
     mz_zip_time_to_dos_time(cur_time, &dos_time, &dos_date);
   }
+#else
+  (void)last_modified;
 #endif // #ifndef MINIZ_NO_TIME
 
   archive_name_size = strlen(pArchive_name);
@@ -4300,10 +4537,6 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
 
   num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-  // no zip64 support yet
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + comment_size + archive_name_size) > 0xFFFFFFFF))
-    return MZ_FALSE;
-
   if ((archive_name_size) && (pArchive_name[archive_name_size - 1] == '/'))
   {
     // Set DOS Subdirectory attribute bit.
@@ -4314,7 +4547,7 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
   }
 
   // Try to do any allocations before writing to the archive, so if an allocation fails the file remains unmodified. (A good idea if we're doing an in-place modification.)
-  if ((!mz_zip_array_ensure_room(pZip, &pState->m_central_dir, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + archive_name_size + comment_size)) || (!mz_zip_array_ensure_room(pZip, &pState->m_central_dir_offsets, 1)))
+  if ((!mz_zip_array_ensure_room(pZip, &pState->m_central_dir, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + archive_name_size + 4 + 3 * sizeof(mz_uint64) + comment_size)) || (!mz_zip_array_ensure_room(pZip, &pState->m_central_dir_offsets, 1)))
     return MZ_FALSE;
 
   if ((!store_data_uncompressed) && (buf_size))
@@ -4340,6 +4573,17 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
   }
   cur_archive_file_ofs += archive_name_size;
 
+  if (zip64)
+  {
+    // Filled in once the compressed size is known
+    if (!mz_zip_writer_write_zeros(pZip, cur_archive_file_ofs, MZ_ZIP64_LOCAL_EXTRA_SIZE))
+    {
+      pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
+      return MZ_FALSE;
+    }
+    cur_archive_file_ofs += MZ_ZIP64_LOCAL_EXTRA_SIZE;
+  }
+
   if (!(level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA))
   {
     uncomp_crc32 = (mz_uint32)mz_crc32(MZ_CRC32_INIT, (const mz_uint8*)pBuf, buf_size);
@@ -4353,13 +4597,15 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
 
   if (store_data_uncompressed)
   {
-    if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, pBuf, buf_size) != buf_size)
+    for (i = 0; i < part_cnt; i++)
     {
-      pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
-      return MZ_FALSE;
+      if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_archive_file_ofs, pParts[i], pPart_sizes[i]) != pPart_sizes[i])
+      {
+        pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
+        return MZ_FALSE;
+      }
+      cur_archive_file_ofs += pPart_sizes[i];
     }
-
-    cur_archive_file_ofs += buf_size;
     comp_size = buf_size;
 
     if (level_and_flags & MZ_ZIP_FLAG_COMPRESSED_DATA)
@@ -4389,11 +4635,22 @@ mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name
   pZip->m_pFree(pZip->m_pAlloc_opaque, pComp);
   pComp = NULL;
 
-  // no zip64 support yet
-  if ((comp_size > 0xFFFFFFFF) || (cur_archive_file_ofs > 0xFFFFFFFF))
+  // Only possible if deflate expanded the data past the threshold margin
+  if ((!zip64) && (comp_size >= MZ_ZIP64_MAX_32))
     return MZ_FALSE;
 
-  if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, 0, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date))
+  if (zip64)
+  {
+    if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, MZ_ZIP64_LOCAL_EXTRA_SIZE, MZ_ZIP64_MAX_32, MZ_ZIP64_MAX_32, uncomp_crc32, method, 0, dos_time, dos_date))
+      return MZ_FALSE;
+    MZ_WRITE_LE16(local_zip64_extra, MZ_ZIP64_EXTRA_FIELD_ID);
+    MZ_WRITE_LE16(local_zip64_extra + 2, MZ_ZIP64_LOCAL_EXTRA_SIZE - 4);
+    MZ_WRITE_LE64(local_zip64_extra + 4, uncomp_size);
+    MZ_WRITE_LE64(local_zip64_extra + 12, comp_size);
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs + sizeof(local_dir_header) + archive_name_size, local_zip64_extra, sizeof(local_zip64_extra)) != sizeof(local_zip64_extra))
+      return MZ_FALSE;
+  }
+  else if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, 0, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date))
     return MZ_FALSE;
 
   if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
@@ -4416,6 +4673,8 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
   mz_uint64 local_dir_header_ofs = pZip->m_archive_size, cur_archive_file_ofs = pZip->m_archive_size, uncomp_size = 0, comp_size = 0;
   size_t archive_name_size;
   mz_uint8 local_dir_header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
+  mz_uint8 local_zip64_extra[MZ_ZIP64_LOCAL_EXTRA_SIZE];
+  mz_bool zip64;
   MZ_FILE *pSrc_file = NULL;
 
   if ((int)level_and_flags < 0)
@@ -4435,8 +4694,8 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 
   num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-  // no zip64 support yet
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + comment_size + archive_name_size) > 0xFFFFFFFF))
+  // Offsets past 4 GB and more than 65535 entries go to zip64 records (see mz_zip_writer_add_to_central_dir() and mz_zip_writer_finalize_archive())
+  if (pZip->m_total_files == MZ_ZIP64_MAX_32)
     return MZ_FALSE;
 
   if (!mz_zip_get_file_modified_time(pSrc_filename, &dos_time, &dos_date))
@@ -4449,12 +4708,8 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
   uncomp_size = MZ_FTELL64(pSrc_file);
   MZ_FSEEK64(pSrc_file, 0, SEEK_SET);
 
-  if (uncomp_size > 0xFFFFFFFF)
-  {
-    // No zip64 support yet
-    MZ_FCLOSE(pSrc_file);
-    return MZ_FALSE;
-  }
+  // Large files get both sizes in a zip64 extra field of the local header
+  zip64 = (uncomp_size >= MZ_ZIP64_LOCAL_THRESHOLD);
   if (uncomp_size <= 3)
     level = 0;
 
@@ -4475,6 +4730,17 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
   }
   cur_archive_file_ofs += archive_name_size;
 
+  if (zip64)
+  {
+    // Filled in once the compressed size is known
+    if (!mz_zip_writer_write_zeros(pZip, cur_archive_file_ofs, MZ_ZIP64_LOCAL_EXTRA_SIZE))
+    {
+      MZ_FCLOSE(pSrc_file);
+      return MZ_FALSE;
+    }
+    cur_archive_file_ofs += MZ_ZIP64_LOCAL_EXTRA_SIZE;
+  }
+
   if (uncomp_size)
   {
     mz_uint64 uncomp_remaining = uncomp_size;
@@ -4567,11 +4833,22 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 
   MZ_FCLOSE(pSrc_file); pSrc_file = NULL;
 
-  // no zip64 support yet
-  if ((comp_size > 0xFFFFFFFF) || (cur_archive_file_ofs > 0xFFFFFFFF))
+  // Only possible if deflate expanded the data past the threshold margin
+  if ((!zip64) && (comp_size >= MZ_ZIP64_MAX_32))
     return MZ_FALSE;
 
-  if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, 0, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date))
+  if (zip64)
+  {
+    if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, MZ_ZIP64_LOCAL_EXTRA_SIZE, MZ_ZIP64_MAX_32, MZ_ZIP64_MAX_32, uncomp_crc32, method, 0, dos_time, dos_date))
+      return MZ_FALSE;
+    MZ_WRITE_LE16(local_zip64_extra, MZ_ZIP64_EXTRA_FIELD_ID);
+    MZ_WRITE_LE16(local_zip64_extra + 2, MZ_ZIP64_LOCAL_EXTRA_SIZE - 4);
+    MZ_WRITE_LE64(local_zip64_extra + 4, uncomp_size);
+    MZ_WRITE_LE64(local_zip64_extra + 12, comp_size);
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs + sizeof(local_dir_header) + archive_name_size, local_zip64_extra, sizeof(local_zip64_extra)) != sizeof(local_zip64_extra))
+      return MZ_FALSE;
+  }
+  else if (!mz_zip_writer_create_local_dir_header(pZip, local_dir_header, (mz_uint16)archive_name_size, 0, uncomp_size, comp_size, uncomp_crc32, method, 0, dos_time, dos_date))
     return MZ_FALSE;
 
   if (pZip->m_pWrite(pZip->m_pIO_opaque, local_dir_header_ofs, local_dir_header, sizeof(local_dir_header)) != sizeof(local_dir_header))
@@ -4587,11 +4864,53 @@ mz_bool mz_zip_writer_add_file(mz_zip_archive *pZip, const char *pArchive_name,
 }
 #endif // #ifndef MINIZ_NO_STDIO
 
+static mz_bool mz_zip_writer_add_zip64_clone_to_central_dir(mz_zip_archive *pZip, const mz_uint8 *pSrc_central_header, mz_uint64 comp_size, mz_uint64 uncomp_size, mz_uint64 local_header_ofs)
+{
+  // Central directory record of a cloned entry, without the zip64 field of the source: mz_zip_writer_add_to_central_dir() adds the one that this archive needs.
+  mz_zip_internal_state *pState = pZip->m_pState;
+  size_t record_ofs = pState->m_central_dir.m_size;
+  mz_uint16 filename_size = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+  mz_uint16 extra_size = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_EXTRA_LEN_OFS);
+  mz_uint16 comment_size = MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_COMMENT_LEN_OFS);
+  const mz_uint8 *pExtra = pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE + filename_size;
+  const mz_uint8 *pField = pExtra;
+  mz_uint8 *pCopy;
+  mz_uint16 copy_size = 0;
+  mz_uint field_size;
+  mz_bool status;
+
+  if (NULL == (pCopy = (mz_uint8 *)pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, extra_size + 1)))
+    return MZ_FALSE;
+  while (pField + 4 <= pExtra + extra_size)
+  {
+    field_size = 4 + MZ_READ_LE16(pField + 2);
+    if (pField + field_size > pExtra + extra_size)
+      break;
+    if (MZ_READ_LE16(pField) != MZ_ZIP64_EXTRA_FIELD_ID)
+    {
+      memcpy(pCopy + copy_size, pField, field_size);
+      copy_size = (mz_uint16)(copy_size + field_size);
+    }
+    pField += field_size;
+  }
+  status = mz_zip_writer_add_to_central_dir(pZip, (const char *)pSrc_central_header + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE, filename_size, pCopy, copy_size, pExtra + extra_size, comment_size, uncomp_size, comp_size,
+                                            MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_CRC32_OFS), (mz_uint16)MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_METHOD_OFS), (mz_uint16)MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_BIT_FLAG_OFS),
+                                            (mz_uint16)MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILE_TIME_OFS), (mz_uint16)MZ_READ_LE16(pSrc_central_header + MZ_ZIP_CDH_FILE_DATE_OFS), local_header_ofs, MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS));
+  pZip->m_pFree(pZip->m_pAlloc_opaque, pCopy);
+  if (!status)
+    return MZ_FALSE;
+  // Fields that mz_zip_writer_add_to_central_dir() leaves to zero
+  memcpy((mz_uint8 *)pState->m_central_dir.m_p + record_ofs + MZ_ZIP_CDH_VERSION_MADE_BY_OFS, pSrc_central_header + MZ_ZIP_CDH_VERSION_MADE_BY_OFS, 2);
+  memcpy((mz_uint8 *)pState->m_central_dir.m_p + record_ofs + MZ_ZIP_CDH_INTERNAL_ATTR_OFS, pSrc_central_header + MZ_ZIP_CDH_INTERNAL_ATTR_OFS, 2);
+  return MZ_TRUE;
+}
+
 mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *pSource_zip, mz_uint file_index)
 {
   mz_uint n, bit_flags, num_alignment_padding_bytes;
   mz_uint64 comp_bytes_remaining, local_dir_header_ofs;
   mz_uint64 cur_src_file_ofs, cur_dst_file_ofs;
+  mz_uint64 comp_size, uncomp_size, src_local_header_ofs;
   mz_uint32 local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) / sizeof(mz_uint32)]; mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
   mz_uint8 central_header[MZ_ZIP_CENTRAL_DIR_HEADER_SIZE];
   size_t orig_central_dir_size;
@@ -4606,11 +4925,14 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
 
   num_alignment_padding_bytes = mz_zip_writer_compute_padding_needed_for_file_alignment(pZip);
 
-  // no zip64 support yet
-  if ((pZip->m_total_files == 0xFFFF) || ((pZip->m_archive_size + num_alignment_padding_bytes + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE) > 0xFFFFFFFF))
+  // Offsets past 4 GB and more than 65535 entries go to zip64 records, as for the other writers
+  if (pZip->m_total_files == MZ_ZIP64_MAX_32)
+    return MZ_FALSE;
+  // The source entry may itself be in zip64 format
+  if (!mz_zip_reader_cdh_sizes(pSrc_central_header, &comp_size, &uncomp_size, &src_local_header_ofs))
     return MZ_FALSE;
 
-  cur_src_file_ofs = MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+  cur_src_file_ofs = src_local_header_ofs;
   cur_dst_file_ofs = pZip->m_archive_size;
 
   if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) != MZ_ZIP_LOCAL_DIR_HEADER_SIZE)
@@ -4630,9 +4952,9 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
   cur_dst_file_ofs += MZ_ZIP_LOCAL_DIR_HEADER_SIZE;
 
   n = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) + MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
-  comp_bytes_remaining = n + MZ_READ_LE32(pSrc_central_header + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+  comp_bytes_remaining = n + comp_size;
 
-  if (NULL == (pBuf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)MZ_MAX(sizeof(mz_uint32) * 4, MZ_MIN(MZ_ZIP_MAX_IO_BUF_SIZE, comp_bytes_remaining)))))
+  if (NULL == (pBuf = pZip->m_pAlloc(pZip->m_pAlloc_opaque, 1, (size_t)MZ_MAX(sizeof(mz_uint32) * 6, MZ_MIN(MZ_ZIP_MAX_IO_BUF_SIZE, comp_bytes_remaining)))))
     return MZ_FALSE;
 
   while (comp_bytes_remaining)
@@ -4658,14 +4980,15 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
   bit_flags = MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_BIT_FLAG_OFS);
   if (bit_flags & 8)
   {
-    // Copy data descriptor
-    if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pBuf, sizeof(mz_uint32) * 4) != sizeof(mz_uint32) * 4)
+    // Copy data descriptor (with 64-bit sizes for a zip64 entry)
+    mz_uint desc_size = ((comp_size >= MZ_ZIP64_MAX_32) || (uncomp_size >= MZ_ZIP64_MAX_32)) ? 5 : 3;
+    if (pSource_zip->m_pRead(pSource_zip->m_pIO_opaque, cur_src_file_ofs, pBuf, sizeof(mz_uint32) * (desc_size + 1)) != sizeof(mz_uint32) * (desc_size + 1))
     {
       pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
       return MZ_FALSE;
     }
 
-    n = sizeof(mz_uint32) * ((MZ_READ_LE32(pBuf) == 0x08074b50) ? 4 : 3);
+    n = sizeof(mz_uint32) * ((MZ_READ_LE32(pBuf) == 0x08074b50) ? desc_size + 1 : desc_size);
     if (pZip->m_pWrite(pZip->m_pIO_opaque, cur_dst_file_ofs, pBuf, n) != n)
     {
       pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
@@ -4677,14 +5000,20 @@ mz_bool mz_zip_writer_add_from_zip_reader(mz_zip_archive *pZip, mz_zip_archive *
   }
   pZip->m_pFree(pZip->m_pAlloc_opaque, pBuf);
 
-  // no zip64 support yet
-  if (cur_dst_file_ofs > 0xFFFFFFFF)
-    return MZ_FALSE;
-
   orig_central_dir_size = pState->m_central_dir.m_size;
 
+  // A record that has or needs a zip64 field is made again for this archive
+  if ((comp_size >= MZ_ZIP64_MAX_32) || (uncomp_size >= MZ_ZIP64_MAX_32) || (src_local_header_ofs >= MZ_ZIP64_MAX_32) || (local_dir_header_ofs >= MZ_ZIP64_MAX_32))
+  {
+    if (!mz_zip_writer_add_zip64_clone_to_central_dir(pZip, pSrc_central_header, comp_size, uncomp_size, local_dir_header_ofs))
+      return MZ_FALSE;
+    pZip->m_total_files++;
+    pZip->m_archive_size = cur_dst_file_ofs;
+    return MZ_TRUE;
+  }
+
   memcpy(central_header, pSrc_central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE);
-  MZ_WRITE_LE32(central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, local_dir_header_ofs);
+  MZ_WRITE_LE32(central_header + MZ_ZIP_CDH_LOCAL_HEADER_OFS, (mz_uint32)local_dir_header_ofs);
   if (!mz_zip_array_push_back(pZip, &pState->m_central_dir, central_header, MZ_ZIP_CENTRAL_DIR_HEADER_SIZE))
     return MZ_FALSE;
 
@@ -4715,16 +5044,13 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
   mz_zip_internal_state *pState;
   mz_uint64 central_dir_ofs, central_dir_size;
   mz_uint8 hdr[MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE];
+  mz_uint8 hdr64[MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIZE];
 
   if ((!pZip) || (!pZip->m_pState) || (pZip->m_zip_mode != MZ_ZIP_MODE_WRITING))
     return MZ_FALSE;
 
   pState = pZip->m_pState;
 
-  // no zip64 support yet
-  if ((pZip->m_total_files > 0xFFFF) || ((pZip->m_archive_size + pState->m_central_dir.m_size + MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIZE) > 0xFFFFFFFF))
-    return MZ_FALSE;
-
   central_dir_ofs = 0;
   central_dir_size = 0;
   if (pZip->m_total_files)
@@ -4738,13 +5064,34 @@ mz_bool mz_zip_writer_finalize_archive(mz_zip_archive *pZip)
     pZip->m_archive_size += central_dir_size;
   }
 
+  if ((pZip->m_total_files >= MZ_ZIP64_MAX_16) || (central_dir_ofs >= MZ_ZIP64_MAX_32) || (central_dir_size >= MZ_ZIP64_MAX_32))
+  {
+    // Zip64 end of central directory record and its locator,
+    // the classic record below then only holds "see zip64" values
+    MZ_CLEAR_OBJ(hdr64);
+    MZ_WRITE_LE32(hdr64 + MZ_ZIP64_ECDH_SIG_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIG);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_SIZE_OF_RECORD_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE - 12);
+    MZ_WRITE_LE16(hdr64 + MZ_ZIP64_ECDH_VERSION_MADE_BY_OFS, MZ_ZIP64_VERSION_NEEDED);
+    MZ_WRITE_LE16(hdr64 + MZ_ZIP64_ECDH_VERSION_NEEDED_OFS, MZ_ZIP64_VERSION_NEEDED);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS, pZip->m_total_files);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_CDIR_TOTAL_ENTRIES_OFS, pZip->m_total_files);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_CDIR_SIZE_OFS, central_dir_size);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_ECDH_CDIR_OFS_OFS, central_dir_ofs);
+    MZ_WRITE_LE32(hdr64 + MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP64_ECDL_SIG_OFS, MZ_ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG);
+    MZ_WRITE_LE64(hdr64 + MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP64_ECDL_REL_OFS_TO_ZIP64_ECDR_OFS, pZip->m_archive_size);
+    MZ_WRITE_LE32(hdr64 + MZ_ZIP64_END_OF_CENTRAL_DIR_HEADER_SIZE + MZ_ZIP64_ECDL_TOTAL_NUMBER_OF_DISKS_OFS, 1);
+    if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, hdr64, sizeof(hdr64)) != sizeof(hdr64))
+      return MZ_FALSE;
+    pZip->m_archive_size += sizeof(hdr64);
+  }
+
   // Write end of central directory record
   MZ_CLEAR_OBJ(hdr);
   MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_SIG_OFS, MZ_ZIP_END_OF_CENTRAL_DIR_HEADER_SIG);
-  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS, pZip->m_total_files);
-  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS, pZip->m_total_files);
-  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_SIZE_OFS, central_dir_size);
-  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_OFS_OFS, central_dir_ofs);
+  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_NUM_ENTRIES_ON_DISK_OFS, MZ_MIN(pZip->m_total_files, MZ_ZIP64_MAX_16));
+  MZ_WRITE_LE16(hdr + MZ_ZIP_ECDH_CDIR_TOTAL_ENTRIES_OFS, MZ_MIN(pZip->m_total_files, MZ_ZIP64_MAX_16));
+  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_SIZE_OFS, MZ_CLAMP32(central_dir_size));
+  MZ_WRITE_LE32(hdr + MZ_ZIP_ECDH_CDIR_OFS_OFS, MZ_CLAMP32(central_dir_ofs));
 
   if (pZip->m_pWrite(pZip->m_pIO_opaque, pZip->m_archive_size, hdr, sizeof(hdr)) != sizeof(hdr))
     return MZ_FALSE;
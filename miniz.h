@@ -37,7 +37,8 @@
   #define MINIZ_NO_TIME
 #endif
 
-#if !defined(MINIZ_NO_TIME) && !defined(MINIZ_NO_ARCHIVE_APIS)
+#if !defined(MINIZ_NO_ARCHIVE_APIS)
+  // Also for the time_t argument of the writers, ignored with MINIZ_NO_TIME
   #include <time.h>
 #endif
 
@@ -485,6 +486,10 @@ mz_bool mz_zip_writer_init_from_reader(mz_zip_archive *pZip, const char *pFilena
 // level_and_flags - compression level (0-10, see MZ_BEST_SPEED, MZ_BEST_COMPRESSION, etc.) logically OR'd with zero or more mz_zip_flags, or just set to MZ_DEFAULT_COMPRESSION.
 mz_bool mz_zip_writer_add_mem(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, mz_uint level_and_flags);
 mz_bool mz_zip_writer_add_mem_ex(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32);
+// Same as mz_zip_writer_add_mem_ex(), but stamps the entry with *last_modified instead of the current time (if last_modified isn't NULL; ignored, and no time stored, with MINIZ_NO_TIME).
+mz_bool mz_zip_writer_add_mem_ex_v2(mz_zip_archive *pZip, const char *pArchive_name, const void *pBuf, size_t buf_size, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, time_t *last_modified);
+// Same as mz_zip_writer_add_mem_ex_v2(), with the data in part_cnt parts written one after the other. More than one part requires MZ_ZIP_FLAG_COMPRESSED_DATA.
+mz_bool mz_zip_writer_add_parts(mz_zip_archive *pZip, const char *pArchive_name, const void * const *pParts, const size_t *pPart_sizes, mz_uint part_cnt, const void *pComment, mz_uint16 comment_size, mz_uint level_and_flags, mz_uint64 uncomp_size, mz_uint32 uncomp_crc32, time_t *last_modified);
 
 #ifndef MINIZ_NO_STDIO
 // Adds the contents of a disk file to an archive. This function also records the disk file's modified time into the archive.
@@ -0,0 +1,156 @@
+/// \file  mzpool.c
+/// \brief Per-thread reuse of the large blocks allocated by miniz.
+/* -------------------------------------------------------------*
+
+   Every block has a small header recording its capacity.
+   Blocks under MZPOOL_MIN go straight to malloc() and free().
+   Larger ones, when freed, go to a per-thread cache of
+   MZPOOL_SLOTS blocks (thread-specific data, released when
+   the thread ends); an allocation takes a cached block whose
+   capacity is at least the size asked for but no more than
+   twice as large. When the cache is full, its oldest block
+   goes back to the heap.
+
+   There is no locking on the blocks themselves: only counters
+   are shared, updated atomically.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "mzpool.h"
+
+typedef union pool_hdr {
+          size_t      cap;
+          long double align;     // Keeps the data suitably aligned
+         } POOL_HDR_T;
+
+typedef struct pool_cache {
+          POOL_HDR_T *blocks[MZPOOL_SLOTS];   // Oldest first
+          int         cnt;
+         } POOL_CACHE_T;
+
+static pthread_key_t      G_pool_key;
+static pthread_once_t     G_pool_once = PTHREAD_ONCE_INIT;
+static MZPOOL_STATS_T     G_pool_stats;
+
+static void release_cache(void *arg) {
+   POOL_CACHE_T *c = (POOL_CACHE_T *)arg;
+   int           i;
+
+   for (i = 0; i < c->cnt; i++) {
+     free(c->blocks[i]);
+   }
+   free(c);
+}
+
+static void make_key(void) {
+   if (pthread_key_create(&G_pool_key, release_cache)) {
+     perror("pthread_key_create");
+     exit(1);
+   }
+}
+
+static POOL_CACHE_T *thread_cache(void) {
+   POOL_CACHE_T *c;
+
+   (void)pthread_once(&G_pool_once, make_key);
+   if ((c = (POOL_CACHE_T *)pthread_getspecific(G_pool_key)) == NULL) {
+     if ((c = (POOL_CACHE_T *)calloc(1, sizeof(POOL_CACHE_T))) == NULL) {
+       return NULL;
+     }
+     (void)pthread_setspecific(G_pool_key, c);
+   }
+   return c;
+}
+
+extern void *mzpool_alloc(void *opaque, size_t items, size_t size) {
+   POOL_CACHE_T *c;
+   POOL_HDR_T   *h;
+   size_t        n = items * size;
+   int           i;
+
+   (void)opaque;
+   if ((n >= MZPOOL_MIN) && ((c = thread_cache()) != NULL)) {
+     __atomic_add_fetch(&(G_pool_stats.allocs), 1, __ATOMIC_RELAXED);
+     for (i = c->cnt - 1; i >= 0; i--) {
+       h = c->blocks[i];
+       if ((h->cap >= n) && (h->cap / 2 <= n)) {
+         c->cnt--;
+         memmove(&(c->blocks[i]), &(c->blocks[i + 1]),
+                 (c->cnt - i) * sizeof(POOL_HDR_T *));
+         __atomic_add_fetch(&(G_pool_stats.reused), 1, __ATOMIC_RELAXED);
+         __atomic_add_fetch(&(G_pool_stats.bytes_reused), n,
+                            __ATOMIC_RELAXED);
+         return (void *)(h + 1);
+       }
+     }
+     __atomic_add_fetch(&(G_pool_stats.bytes_new), n, __ATOMIC_RELAXED);
+   }
+   if ((h = (POOL_HDR_T *)malloc(sizeof(POOL_HDR_T) + n)) == NULL) {
+     return NULL;
+   }
+   h->cap = n;
+   return (void *)(h + 1);
+}
+
+extern void mzpool_free(void *opaque, void *p) {
+   POOL_CACHE_T *c;
+   POOL_HDR_T   *h;
+
+   (void)opaque;
+   if (p == NULL) {
+     return;
+   }
+   h = (POOL_HDR_T *)p - 1;
+   if ((h->cap < MZPOOL_MIN) || ((c = thread_cache()) == NULL)) {
+     free(h);
+     return;
+   }
+   if (c->cnt == MZPOOL_SLOTS) {
+     free(c->blocks[0]);
+     c->cnt--;
+     memmove(&(c->blocks[0]), &(c->blocks[1]),
+             c->cnt * sizeof(POOL_HDR_T *));
+   }
+   c->blocks[c->cnt++] = h;
+}
+
+extern void *mzpool_realloc(void *opaque, void *p, size_t items,
+                            size_t size) {
+   POOL_HDR_T *h;
+   size_t      n = items * size;
+
+   (void)opaque;
+   if (p == NULL) {
+     return mzpool_alloc(NULL, items, size);
+   }
+   h = (POOL_HDR_T *)p - 1;
+   if (n <= h->cap) {
+     return p;
+   }
+   if ((h = (POOL_HDR_T *)realloc(h, sizeof(POOL_HDR_T) + n)) == NULL) {
+     return NULL;
+   }
+   h->cap = n;
+   return (void *)(h + 1);
+}
+
+extern void mzpool_use(mz_zip_archive *pzip) {
+   pzip->m_pAlloc = mzpool_alloc;
+   pzip->m_pFree = mzpool_free;
+   pzip->m_pRealloc = mzpool_realloc;
+   pzip->m_pAlloc_opaque = NULL;
+}
+
+extern void mzpool_stats(MZPOOL_STATS_T *st) {
+   st->allocs = __atomic_load_n(&(G_pool_stats.allocs), __ATOMIC_RELAXED);
+   st->reused = __atomic_load_n(&(G_pool_stats.reused), __ATOMIC_RELAXED);
+   st->bytes_new = __atomic_load_n(&(G_pool_stats.bytes_new),
+                                   __ATOMIC_RELAXED);
+   st->bytes_reused = __atomic_load_n(&(G_pool_stats.bytes_reused),
+                                      __ATOMIC_RELAXED);
+}
@@ -0,0 +1,44 @@
+/*
+ *   Reuse of the large blocks allocated by miniz.
+ *
+ *   Each compressed entry costs miniz a compressor (about
+ *   300 KB of dictionary and hash chains) and I/O buffers,
+ *   allocated then freed. Through these functions, installed
+ *   as the allocator of a zip writer, large blocks are kept
+ *   by the thread that freed them and handed back at the next
+ *   request of a similar size instead of going to the heap.
+ *
+ *   Blocks must be freed through the pool. Archives finalized
+ *   in memory are freed with free() by their users, so the
+ *   pool is only installed on writers to files and streams.
+ */
+#ifndef MZPOOL_H
+
+#define MZPOOL_H
+
+#include <stddef.h>
+
+#include "miniz.h"
+
+#define MZPOOL_MIN     32768     // Smaller blocks aren't kept
+#define MZPOOL_SLOTS   8         // Blocks kept per thread
+
+typedef struct mzpool_stats {
+          unsigned long long allocs;        // Large blocks requested
+          unsigned long long reused;        // Served by the pool
+          unsigned long long bytes_new;     // Allocated from the heap
+          unsigned long long bytes_reused;  // Saved
+         } MZPOOL_STATS_T;
+
+// Same signatures as mz_alloc_func, mz_free_func, mz_realloc_func
+// (the opaque pointer is unused)
+extern void *mzpool_alloc(void *opaque, size_t items, size_t size);
+extern void  mzpool_free(void *opaque, void *p);
+extern void *mzpool_realloc(void *opaque, void *p, size_t items,
+                            size_t size);
+// Makes a zip archive allocate through the pool (before init)
+extern void  mzpool_use(mz_zip_archive *pzip);
+// Totals over all threads so far
+extern void  mzpool_stats(MZPOOL_STATS_T *st);
+
+#endif
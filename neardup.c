@@ -0,0 +1,445 @@
+/// \file  neardup.c
+/// \brief Near-duplicate detection with MinHash and LSH.
+/* -------------------------------------------------------------*
+
+   Each stem is cut into overlapping ND_SHINGLE-character
+   shingles; the signature keeps, for ND_HASHES different hash
+   functions, the smallest hash of any shingle. The fraction of
+   equal signature values estimates the Jaccard similarity of
+   the two sets of shingles.
+
+   To avoid comparing all pairs, signatures are cut into bands
+   of rows; questions whose band is identical land in the same
+   bucket (sort on the band hash) and only those are compared.
+   The number of rows per band is chosen from the threshold, so
+   that pairs above it are very likely to share a bucket.
+
+   Signing and bucketing are spread over threads; matching
+   pairs are merged into groups with a union-find.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "chrclass.h"
+#include "neardup.h"
+
+#define ND_ALLOC      1024
+
+typedef struct nd_bucket {
+          uint64_t  key;
+          long      idx;
+         } ND_BUCKET_T;
+
+typedef struct nd_pair {
+          long  a;
+          long  b;
+         } ND_PAIR_T;
+
+typedef struct nd_job {
+          NEAR_DUP_T      *nd;
+          uint32_t        *sigs;
+          double           threshold;
+          int              rows;
+          int              bands;
+          // Work distribution
+          pthread_mutex_t *lock;
+          long            *next;        // Next item (signing) or band
+          // Results of bucketing
+          ND_PAIR_T       *pairs;
+          long             pair_cnt;
+          long             pair_alloc;
+         } ND_JOB_T;
+
+static uint64_t G_nd_mul[ND_HASHES];
+static uint64_t G_nd_seed[ND_HASHES];
+
+static uint64_t mix64(uint64_t z) {
+   z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+   z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+   return z ^ (z >> 31);
+}
+
+static uint64_t shingle_hash(const char *s, int len) {
+   // FNV-1a, then mixed
+   uint64_t h = 0xCBF29CE484222325ULL;
+   int      i;
+
+   for (i = 0; i < len; i++) {
+     h ^= (unsigned char)s[i];
+     h *= 0x100000001B3ULL;
+   }
+   return mix64(h);
+}
+
+extern void neardup_init(NEAR_DUP_T *nd) {
+   if (nd) {
+     nd->items = NULL;
+     nd->cnt = 0;
+     nd->alloc = 0;
+     nd->last_fname = NULL;
+   }
+}
+
+extern void neardup_add(NEAR_DUP_T *nd, const char *text,
+                        const char *fname, int line) {
+   char  *t;
+   char  *p;
+   char   pending_space = 0;
+
+   if (!nd || !text) {
+     return;
+   }
+   if (nd->cnt == nd->alloc) {
+     if ((nd->items = (ND_ITEM_T *)realloc(nd->items,
+                       sizeof(ND_ITEM_T) * (nd->alloc + ND_ALLOC))) == NULL) {
+       perror("realloc");
+       exit(1);
+     }
+     nd->alloc += ND_ALLOC;
+   }
+   if ((t = (char *)malloc(strlen(text) + 1)) == NULL) {
+     perror("malloc");
+     exit(1);
+   }
+   // Same normalization as for exact duplicates
+   p = t;
+   while (CC_ISSPACE(*text)) {
+     text++;
+   }
+   while (*text) {
+     if (CC_ISSPACE(*text)) {
+       pending_space = 1;
+     } else {
+       if (pending_space) {
+         *p++ = ' ';
+         pending_space = 0;
+       }
+       *p++ = CC_TOLOWER(*text);
+     }
+     text++;
+   }
+   *p = '\0';
+   if (!nd->last_fname || strcmp(nd->last_fname, fname)) {
+     nd->last_fname = strdup(fname);
+   }
+   nd->items[nd->cnt].text = t;
+   nd->items[nd->cnt].fname = nd->last_fname;
+   nd->items[nd->cnt].line = line;
+   (nd->cnt)++;
+}
+
+static void sign(const char *text, uint32_t *sig) {
+   uint64_t h;
+   uint32_t v;
+   int      len = strlen(text);
+   int      i;
+   int      k;
+
+   for (k = 0; k < ND_HASHES; k++) {
+     sig[k] = 0xFFFFFFFFU;
+   }
+   i = 0;
+   do {
+     h = shingle_hash(text + i, (len < ND_SHINGLE ? len : ND_SHINGLE));
+     // Multiply-shift: one multiply per hash function
+     for (k = 0; k < ND_HASHES; k++) {
+       v = (uint32_t)((h * G_nd_mul[k] + G_nd_seed[k]) >> 32);
+       if (v < sig[k]) {
+         sig[k] = v;
+       }
+     }
+     i++;
+   } while (i + ND_SHINGLE <= len);
+}
+
+static double similarity(const uint32_t *s1, const uint32_t *s2) {
+   int k;
+   int same = 0;
+
+   for (k = 0; k < ND_HASHES; k++) {
+     same += (s1[k] == s2[k]);
+   }
+   return (double)same / ND_HASHES;
+}
+
+static long next_work(ND_JOB_T *job, long step) {
+   long n;
+
+   pthread_mutex_lock(job->lock);
+   n = *(job->next);
+   *(job->next) += step;
+   pthread_mutex_unlock(job->lock);
+   return n;
+}
+
+#define SIGN_BATCH   256
+
+static void *sign_worker(void *arg) {
+   ND_JOB_T *job = (ND_JOB_T *)arg;
+   long      start;
+   long      i;
+
+   while ((start = next_work(job, SIGN_BATCH)) < job->nd->cnt) {
+     for (i = start; (i < start + SIGN_BATCH) && (i < job->nd->cnt); i++) {
+       sign(job->nd->items[i].text, &(job->sigs[i * ND_HASHES]));
+       free(job->nd->items[i].text);
+       job->nd->items[i].text = NULL;
+     }
+   }
+   return NULL;
+}
+
+static int bucket_cmp(const void *b1, const void *b2) {
+   const ND_BUCKET_T *x = (const ND_BUCKET_T *)b1;
+   const ND_BUCKET_T *y = (const ND_BUCKET_T *)b2;
+
+   if (x->key != y->key) {
+     return (x->key < y->key ? -1 : 1);
+   }
+   return (x->idx < y->idx ? -1 : (x->idx > y->idx));
+}
+
+static void add_pair(ND_JOB_T *job, long a, long b) {
+   if (job->pair_cnt == job->pair_alloc) {
+     if ((job->pairs = (ND_PAIR_T *)realloc(job->pairs,
+                  sizeof(ND_PAIR_T) * (job->pair_alloc + ND_ALLOC))) == NULL) {
+       perror("realloc");
+       exit(1);
+     }
+     job->pair_alloc += ND_ALLOC;
+   }
+   job->pairs[job->pair_cnt].a = a;
+   job->pairs[job->pair_cnt].b = b;
+   (job->pair_cnt)++;
+}
+
+static void *band_worker(void *arg) {
+   ND_JOB_T    *job = (ND_JOB_T *)arg;
+   long         n = job->nd->cnt;
+   ND_BUCKET_T *b;
+   long         band;
+   long         i;
+   long         j;
+   int          r;
+
+   if ((b = (ND_BUCKET_T *)malloc(sizeof(ND_BUCKET_T) * n)) == NULL) {
+     perror("malloc");
+     exit(1);
+   }
+   while ((band = next_work(job, 1)) < job->bands) {
+     for (i = 0; i < n; i++) {
+       uint64_t h = (uint64_t)band * 0x9E3779B97F4A7C15ULL;
+
+       for (r = 0; r < job->rows; r++) {
+         h = mix64(h ^ job->sigs[i * ND_HASHES + band * job->rows + r]);
+       }
+       b[i].key = h;
+       b[i].idx = i;
+     }
+     qsort(b, n, sizeof(ND_BUCKET_T), bucket_cmp);
+     i = 0;
+     while (i < n) {
+       // Compare the members of a bucket with its first one
+       j = i + 1;
+       while ((j < n) && (b[j].key == b[i].key)) {
+         if (similarity(&(job->sigs[b[i].idx * ND_HASHES]),
+                        &(job->sigs[b[j].idx * ND_HASHES]))
+                 >= job->threshold) {
+           add_pair(job, b[i].idx, b[j].idx);
+         }
+         j++;
+       }
+       i = j;
+     }
+   }
+   free(b);
+   return NULL;
+}
+
+static long uf_find(long *parent, long x) {
+   long root = x;
+   long next;
+
+   while (parent[root] != root) {
+     root = parent[root];
+   }
+   while (parent[x] != root) {
+     next = parent[x];
+     parent[x] = root;
+     x = next;
+   }
+   return root;
+}
+
+static int member_cmp(const void *m1, const void *m2) {
+   const ND_PAIR_T *x = (const ND_PAIR_T *)m1;
+   const ND_PAIR_T *y = (const ND_PAIR_T *)m2;
+
+   if (x->a != y->a) {
+     return (x->a < y->a ? -1 : 1);
+   }
+   return (x->b < y->b ? -1 : (x->b > y->b));
+}
+
+static int choose_rows(double threshold) {
+   // With b bands of r rows, the probability of sharing a bucket
+   // climbs steeply around (1/b)^(1/r). Take the most selective
+   // banding whose threshold stays comfortably below ours.
+   static const double band_threshold[] = {0.0,  // placeholder
+                                           0.177, 0.5, 0.771, 0.917};
+   int r = 8;   // 8 bands of 8 rows
+   int k = 3;
+
+   while ((k > 1) && (band_threshold[k] > 0.9 * threshold)) {
+     k--;
+     r /= 2;
+   }
+   return r;
+}
+
+extern long neardup_report(NEAR_DUP_T *nd, double threshold,
+                           int nthreads, FILE *out) {
+   pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+   pthread_t       *tids;
+   ND_JOB_T        *jobs;
+   uint32_t        *sigs;
+   long            *parent;
+   ND_PAIR_T       *members; // (group, question), sorted
+   long             member_cnt = 0;
+   long             next;
+   long             found = 0;
+   long             i;
+   long             k;
+   long             root;
+   int              t;
+
+   if (!nd || (nd->cnt < 2)) {
+     return 0;
+   }
+   if (nthreads < 1) {
+     nthreads = 1;
+   }
+   for (t = 0; t < ND_HASHES; t++) {
+     G_nd_mul[t] = mix64(0x13198A2E03707344ULL + (uint64_t)t) | 1;
+     G_nd_seed[t] = mix64(0x243F6A8885A308D3ULL + (uint64_t)t);
+   }
+   if (((sigs = (uint32_t *)malloc(sizeof(uint32_t) * ND_HASHES * nd->cnt))
+               == NULL)
+       || ((tids = (pthread_t *)malloc(sizeof(pthread_t) * nthreads))
+               == NULL)
+       || ((jobs = (ND_JOB_T *)calloc(nthreads, sizeof(ND_JOB_T)))
+               == NULL)) {
+     perror("malloc");
+     exit(1);
+   }
+   for (t = 0; t < nthreads; t++) {
+     jobs[t].nd = nd;
+     jobs[t].sigs = sigs;
+     jobs[t].threshold = threshold;
+     jobs[t].rows = choose_rows(threshold);
+     jobs[t].bands = ND_HASHES / jobs[t].rows;
+     jobs[t].lock = &lock;
+     jobs[t].next = &next;
+   }
+   // Signatures
+   next = 0;
+   for (t = 0; t < nthreads; t++) {
+     if (pthread_create(&(tids[t]), NULL, sign_worker, &(jobs[t]))) {
+       perror("pthread_create");
+       exit(1);
+     }
+   }
+   for (t = 0; t < nthreads; t++) {
+     pthread_join(tids[t], NULL);
+   }
+   // Buckets, one band at a time
+   next = 0;
+   for (t = 0; t < nthreads; t++) {
+     if (pthread_create(&(tids[t]), NULL, band_worker, &(jobs[t]))) {
+       perror("pthread_create");
+       exit(1);
+     }
+   }
+   for (t = 0; t < nthreads; t++) {
+     pthread_join(tids[t], NULL);
+   }
+   // Groups
+   if (((parent = (long *)malloc(sizeof(long) * nd->cnt)) == NULL)
+       || ((members = (ND_PAIR_T *)malloc(sizeof(ND_PAIR_T) * nd->cnt))
+                == NULL)) {
+     perror("malloc");
+     exit(1);
+   }
+   for (i = 0; i < nd->cnt; i++) {
+     parent[i] = i;
+   }
+   for (t = 0; t < nthreads; t++) {
+     for (k = 0; k < jobs[t].pair_cnt; k++) {
+       long a = uf_find(parent, jobs[t].pairs[k].a);
+       long b = uf_find(parent, jobs[t].pairs[k].b);
+
+       if (a != b) {
+         // Smallest index as root, so groups list in input order
+         if (a < b) {
+           parent[b] = a;
+         } else {
+           parent[a] = b;
+         }
+       }
+     }
+     free(jobs[t].pairs);
+   }
+   for (i = 0; i < nd->cnt; i++) {
+     if ((root = uf_find(parent, i)) != i) {
+       members[member_cnt].a = root;
+       members[member_cnt].b = i;
+       member_cnt++;
+     }
+   }
+   qsort(members, member_cnt, sizeof(ND_PAIR_T), member_cmp);
+   for (k = 0; k < member_cnt; k++) {
+     root = members[k].a;
+     i = members[k].b;
+     if ((k == 0) || (members[k - 1].a != root)) {
+       fprintf(out, "-- Near-duplicates (similarity >= %.2f):\n",
+                    threshold);
+       fprintf(out, "   %s, line %d\n",
+                    nd->items[root].fname, nd->items[root].line);
+       found++;
+     }
+     fprintf(out, "   %s, line %d (%.2f)\n",
+                  nd->items[i].fname, nd->items[i].line,
+                  similarity(&(sigs[root * ND_HASHES]),
+                             &(sigs[i * ND_HASHES])));
+     found++;
+   }
+   free(members);
+   free(parent);
+   free(jobs);
+   free(tids);
+   free(sigs);
+   return found;
+}
+
+extern void neardup_dispose(NEAR_DUP_T *nd) {
+   long  i;
+   char *f = NULL;
+
+   if (nd && nd->items) {
+     for (i = 0; i < nd->cnt; i++) {
+       if (nd->items[i].text) {
+         free(nd->items[i].text);
+       }
+       if (nd->items[i].fname != f) {
+         f = nd->items[i].fname;
+         free(f);
+       }
+     }
+     free(nd->items);
+     neardup_init(nd);
+   }
+}
@@ -0,0 +1,41 @@
+/*
+ *   Near-duplicate question detection (MinHash + LSH)
+ *
+ *   Question stems are collected while files are parsed, then
+ *   neardup_report() signs them in parallel and lists groups of
+ *   questions whose estimated Jaccard similarity (on character
+ *   shingles) reaches a threshold.
+ */
+#ifndef NEARDUP_H
+
+#define NEARDUP_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define ND_HASHES          64   // MinHash signature length
+#define ND_SHINGLE          5   // Characters per shingle
+
+typedef struct nd_item {
+          char     *text;     // Normalized stem, freed once signed
+          char     *fname;    // Shared with the other items of a file
+          int       line;
+         } ND_ITEM_T;
+
+typedef struct near_dup {
+          ND_ITEM_T *items;
+          long       cnt;
+          long       alloc;
+          char      *last_fname;
+         } NEAR_DUP_T;
+
+extern void neardup_init(NEAR_DUP_T *nd);
+extern void neardup_add(NEAR_DUP_T *nd, const char *text,
+                        const char *fname, int line);
+// Writes groups of near-duplicates to out, returns the number
+// of questions found to have a near-duplicate.
+extern long neardup_report(NEAR_DUP_T *nd, double threshold,
+                           int nthreads, FILE *out);
+extern void neardup_dispose(NEAR_DUP_T *nd);
+
+#endif
@@ -0,0 +1,434 @@
+/// \file  qtiread.c
+/// \brief Streaming reader of the assessment XML.
+/* -------------------------------------------------------------*
+
+   Bytes are split into tags (between < and >) and text. A
+   tag or a piece of text may be cut between two calls, so
+   it is collected in tok until it is complete; text is only
+   collected where it matters (question, choice, answer), so
+   that nothing accumulates between items.
+
+   What txt2qti writes is simple enough: no CDATA, no
+   comments, no '>' in attribute values. Anything in text
+   that isn't a tag is escaped, which is why a '<' can always
+   be taken as the start of a tag.
+
+   An item is:
+
+     <item title=... ident=...>
+       ... <mattext>question</mattext>
+       <response_lid rcardinality="Single|Multiple">
+         <response_label ident="q1_a."> ... <mattext>choice</mattext>
+         ...
+       <varequal ...>q1_a.</varequal>      correct
+       <not><varequal ...>q1_b.</varequal></not>   not correct
+     </item>
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chrclass.h"
+#include "fasthash.h"
+#include "qtiread.h"
+
+#define QTI_NAME_LEN     32
+#define QTI_CHOICE_ALLOC  8
+#define QTI_ENTITY_LEN   10    // &#x10FFFF;
+
+static void add_utf8(STRBUF *sb, unsigned long c) {
+   if (c < 0x80) {
+     strbuf_addc(sb, (int)c);
+   } else if (c < 0x800) {
+     strbuf_addc(sb, 0xC0 | (int)(c >> 6));
+     strbuf_addc(sb, 0x80 | (int)(c & 0x3F));
+   } else if (c < 0x10000) {
+     strbuf_addc(sb, 0xE0 | (int)(c >> 12));
+     strbuf_addc(sb, 0x80 | (int)((c >> 6) & 0x3F));
+     strbuf_addc(sb, 0x80 | (int)(c & 0x3F));
+   } else {
+     strbuf_addc(sb, 0xF0 | (int)(c >> 18));
+     strbuf_addc(sb, 0x80 | (int)((c >> 12) & 0x3F));
+     strbuf_addc(sb, 0x80 | (int)((c >> 6) & 0x3F));
+     strbuf_addc(sb, 0x80 | (int)(c & 0x3F));
+   }
+}
+
+static unsigned long char_ref(const char *s, char **endp) {
+   // Number after &#, decimal or (after x) hexadecimal
+   if ((*s == 'x') || (*s == 'X')) {
+     return strtoul(s + 1, endp, 16);
+   }
+   return strtoul(s, endp, 10);
+}
+
+static void decode(STRBUF *sb, const char *s, size_t len) {
+   // Appends s to sb, entities replaced by what they stand for
+   const char    *end = s + len;
+   const char    *p;
+   const char    *semi;
+   char          *numend;
+   unsigned long  c;
+
+   while ((p = memchr(s, '&', end - s)) != NULL) {
+     strbuf_nadd(sb, (char *)s, p - s);
+     semi = memchr(p, ';', ((end - p) < QTI_ENTITY_LEN ? (end - p)
+                                                      : QTI_ENTITY_LEN));
+     s = p + 1;
+     if (semi == NULL) {
+       strbuf_addc(sb, '&');
+       continue;
+     }
+     if ((semi - p == 3) && (strncmp(p, "&lt", 3) == 0)) {
+       strbuf_addc(sb, '<');
+     } else if ((semi - p == 3) && (strncmp(p, "&gt", 3) == 0)) {
+       strbuf_addc(sb, '>');
+     } else if ((semi - p == 4) && (strncmp(p, "&amp", 4) == 0)) {
+       strbuf_addc(sb, '&');
+     } else if ((semi - p == 5) && (strncmp(p, "&quot", 5) == 0)) {
+       strbuf_addc(sb, '"');
+     } else if ((semi - p == 5) && (strncmp(p, "&apos", 5) == 0)) {
+       strbuf_addc(sb, '\'');
+     } else if ((p[1] == '#')
+                && ((c = char_ref(p + 2, &numend)) > 0)
+                && (numend == semi) && (c <= 0x10FFFF)) {
+       add_utf8(sb, c);
+     } else {
+       // Not an entity we know, keep it
+       strbuf_addc(sb, '&');
+       continue;
+     }
+     s = semi + 1;
+   }
+   strbuf_nadd(sb, (char *)s, end - s);
+}
+
+static void attr(const char *s, const char *name, char *dest, size_t size) {
+   // Value of attribute name in tag s, "" if not there
+   size_t      n = strlen(name);
+   const char *p = s;
+   const char *q;
+   STRBUF      v;
+
+   dest[0] = '\0';
+   while ((p = strstr(p, name)) != NULL) {
+     if ((p > s) && CC_ISSPACE(p[-1])
+         && (p[n] == '=') && (p[n + 1] == '"')
+         && ((q = strchr(p + n + 2, '"')) != NULL)) {
+       strbuf_init(&v);
+       decode(&v, p + n + 2, q - (p + n + 2));
+       if (v.s) {
+         strncpy(dest, v.s, size - 1);
+         dest[size - 1] = '\0';
+       }
+       strbuf_dispose(&v);
+       return;
+     }
+     p += n;
+   }
+}
+
+static STRBUF *sink(QTI_READER_T *r) {
+   // Where text goes, NULL if nowhere
+   if (!r->in_item) {
+     return NULL;
+   }
+   if (r->in_varequal) {
+     return &(r->value);
+   }
+   if (r->in_mattext) {
+     if (r->in_label && r->item.choice_cnt) {
+       return &(r->item.choices[r->item.choice_cnt - 1].text);
+     }
+     if (!r->in_label) {
+       return &(r->item.text);
+     }
+   }
+   return NULL;
+}
+
+static void item_clear(QTI_ITEM_T *item) {
+   int i;
+
+   for (i = 0; i < item->choice_cnt; i++) {
+     strbuf_dispose(&(item->choices[i].text));
+   }
+   item->choice_cnt = 0;
+   strbuf_clear(&(item->text));
+   item->title[0] = '\0';
+   item->ident[0] = '\0';
+   item->multiple = 0;
+   item->answer_cnt = 0;
+   item->bad_answers = 0;
+}
+
+static void open_tag(QTI_READER_T *r, const char *name, const char *attrs) {
+   QTI_ITEM_T   *item = &(r->item);
+   QTI_CHOICE_T *c;
+   char          v[QTI_ID_LEN];
+
+   if (strcmp(name, "item") == 0) {
+     if (r->in_item) {
+       r->err = QTI_BROKEN;
+       return;
+     }
+     item_clear(item);
+     attr(attrs, "title", item->title, QTI_ID_LEN);
+     attr(attrs, "ident", item->ident, QTI_ID_LEN);
+     item->start = r->tokstart;
+     r->in_item = 1;
+   } else if (!r->in_item) {
+     return;
+   } else if (strcmp(name, "response_lid") == 0) {
+     attr(attrs, "rcardinality", v, QTI_ID_LEN);
+     item->multiple = (strcmp(v, "Multiple") == 0);
+   } else if (strcmp(name, "response_label") == 0) {
+     if (item->choice_cnt == item->choice_alloc) {
+       item->choice_alloc += QTI_CHOICE_ALLOC;
+       if ((item->choices = (QTI_CHOICE_T *)realloc(item->choices,
+                               sizeof(QTI_CHOICE_T) * item->choice_alloc))
+              == NULL) {
+         perror("realloc");
+         exit(1);
+       }
+     }
+     c = &(item->choices[(item->choice_cnt)++]);
+     attr(attrs, "ident", c->id, QTI_ID_LEN);
+     strbuf_init(&(c->text));
+     c->correct = 0;
+     r->in_label = 1;
+   } else if (strcmp(name, "mattext") == 0) {
+     r->in_mattext = 1;
+   } else if (strcmp(name, "not") == 0) {
+     r->in_not = 1;
+   } else if (strcmp(name, "varequal") == 0) {
+     r->in_varequal = 1;
+     strbuf_clear(&(r->value));
+   }
+}
+
+static void close_tag(QTI_READER_T *r, const char *name) {
+   QTI_ITEM_T *item = &(r->item);
+   int         i;
+
+   if (strcmp(name, "item") == 0) {
+     if (!r->in_item) {
+       r->err = QTI_BROKEN;
+       return;
+     }
+     item->end = r->ofs;
+     r->in_item = 0;
+     r->in_label = 0;
+     r->in_mattext = 0;
+     r->in_not = 0;
+     r->in_varequal = 0;
+     (r->items)++;
+     if (r->func && r->func(r->opaque, item)) {
+       r->err = QTI_STOPPED;
+     }
+   } else if (!r->in_item) {
+     return;
+   } else if (strcmp(name, "response_label") == 0) {
+     r->in_label = 0;
+   } else if (strcmp(name, "mattext") == 0) {
+     r->in_mattext = 0;
+   } else if (strcmp(name, "not") == 0) {
+     r->in_not = 0;
+   } else if (strcmp(name, "varequal") == 0) {
+     r->in_varequal = 0;
+     if (!r->in_not) {
+       for (i = 0; i < item->choice_cnt; i++) {
+         if (r->value.s && (strcmp(item->choices[i].id, r->value.s) == 0)) {
+           break;
+         }
+       }
+       if (i < item->choice_cnt) {
+         item->choices[i].correct = 1;
+         (item->answer_cnt)++;
+       } else {
+         (item->bad_answers)++;
+       }
+     }
+   }
+}
+
+static void tag(QTI_READER_T *r) {
+   // Complete tag (without < and >) in tok
+   char   *s = r->tok.s;
+   char    name[QTI_NAME_LEN];
+   size_t  len;
+   int     i = 0;
+   char    closing = 0;
+
+   if (!s || (*s == '?') || (*s == '!')) {
+     // Declaration, comment
+     return;
+   }
+   if (*s == '/') {
+     closing = 1;
+     s++;
+   }
+   while (s[i] && !CC_ISSPACE(s[i]) && (s[i] != '/')
+          && (i < QTI_NAME_LEN - 1)) {
+     name[i] = s[i];
+     i++;
+   }
+   name[i] = '\0';
+   if (closing) {
+     close_tag(r, name);
+   } else {
+     open_tag(r, name, s + i);
+     len = strlen(s);
+     if (len && (s[len - 1] == '/')) {
+       close_tag(r, name);
+     }
+   }
+}
+
+extern void qtiread_init(QTI_READER_T *r, QTI_ITEM_FUNC func, void *opaque) {
+   memset(r, 0, sizeof(QTI_READER_T));
+   strbuf_init(&(r->tok));
+   strbuf_init(&(r->value));
+   strbuf_init(&(r->item.text));
+   r->func = func;
+   r->opaque = opaque;
+}
+
+extern int qtiread_feed(QTI_READER_T *r, const char *buf, size_t len) {
+   const char *p = buf;
+   const char *end = buf + len;
+   const char *q;
+   STRBUF     *sb;
+
+   while ((p < end) && !r->err) {
+     if (r->in_tag) {
+       if ((q = memchr(p, '>', end - p)) == NULL) {
+         strbuf_nadd(&(r->tok), (char *)p, end - p);
+         r->ofs += end - p;
+         break;
+       }
+       strbuf_nadd(&(r->tok), (char *)p, q - p);
+       r->ofs += q - p + 1;
+       p = q + 1;
+       r->in_tag = 0;
+       tag(r);
+       strbuf_clear(&(r->tok));
+     } else {
+       if ((q = memchr(p, '<', end - p)) == NULL) {
+         q = end;
+       }
+       if (sink(r)) {
+         strbuf_nadd(&(r->tok), (char *)p, q - p);
+       }
+       r->ofs += q - p;
+       p = q;
+       if (p < end) {
+         // Text complete
+         if (((sb = sink(r)) != NULL) && r->tok.curlen) {
+           decode(sb, r->tok.s, r->tok.curlen);
+         }
+         strbuf_clear(&(r->tok));
+         r->tokstart = r->ofs;
+         r->in_tag = 1;
+         r->ofs++;
+         p++;
+       }
+     }
+   }
+   return (r->err ? -1 : 0);
+}
+
+extern int qtiread_end(QTI_READER_T *r) {
+   if (!r->err && (r->in_item || r->in_tag)) {
+     r->err = QTI_BROKEN;
+   }
+   return (r->err ? -1 : 0);
+}
+
+extern void qtiread_dispose(QTI_READER_T *r) {
+   item_clear(&(r->item));
+   if (r->item.choices) {
+     free(r->item.choices);
+   }
+   strbuf_dispose(&(r->item.text));
+   strbuf_dispose(&(r->tok));
+   strbuf_dispose(&(r->value));
+   memset(r, 0, sizeof(QTI_READER_T));
+}
+
+extern void qtiread_hash(QTI_ITEM_T *item, unsigned char *digest) {
+   FH128_CTX ctx;
+   int       i;
+
+   FH128_Init(&ctx);
+   FH128_Update(&ctx, item->title, (unsigned long)strlen(item->title) + 1);
+   if (item->text.s) {
+     FH128_Update(&ctx, item->text.s, (unsigned long)item->text.curlen);
+   }
+   FH128_Update(&ctx, &(item->multiple), 1);
+   for (i = 0; i < item->choice_cnt; i++) {
+     FH128_Update(&ctx, item->choices[i].id,
+                  (unsigned long)strlen(item->choices[i].id) + 1);
+     if (item->choices[i].text.s) {
+       FH128_Update(&ctx, item->choices[i].text.s,
+                    (unsigned long)item->choices[i].text.curlen + 1);
+     } else {
+       FH128_Update(&ctx, "", 1);
+     }
+     FH128_Update(&ctx, &(item->choices[i].correct), 1);
+   }
+   FH128_Final(digest, &ctx);
+}
+
+static void print_trimmed(FILE *fp, const char *s) {
+   const char *end;
+
+   if (s) {
+     while (CC_ISSPACE(*s)) {
+       s++;
+     }
+     end = s + strlen(s);
+     while ((end > s) && CC_ISSPACE(end[-1])) {
+       end--;
+     }
+     fwrite(s, 1, end - s, fp);
+   }
+}
+
+static const char *label(const char *id) {
+   // q12_b. -> b.
+   const char *p = strchr(id, '_');
+
+   return (p ? p + 1 : id);
+}
+
+extern void qtiread_print(FILE *fp, QTI_ITEM_T *item) {
+   const char *l;
+   int         len;
+   int         i;
+   int         n = 0;
+
+   print_trimmed(fp, item->text.s);
+   fputc('\n', fp);
+   for (i = 0; i < item->choice_cnt; i++) {
+     fprintf(fp, "%s ", label(item->choices[i].id));
+     print_trimmed(fp, item->choices[i].text.s);
+     fputc('\n', fp);
+   }
+   for (i = 0; i < item->choice_cnt; i++) {
+     if (item->choices[i].correct) {
+       // Without the separator
+       l = label(item->choices[i].id);
+       len = strlen(l);
+       while ((len > 1) && CC_ISPUNCT(l[len - 1])) {
+         len--;
+       }
+       fprintf(fp, "%s%.*s", (n++ ? ", " : "Answer: "), len, l);
+     }
+   }
+   if (n) {
+     fputc('\n', fp);
+   }
+}
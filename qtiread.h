@@ -0,0 +1,83 @@
+/*
+ *   Reading back the assessment XML that txt2qti writes.
+ *
+ *   The XML is given piece by piece, as it comes out of the
+ *   zip reader, and each item is handed to a callback as soon
+ *   as its closing tag has been seen, then forgotten: memory
+ *   use depends on the largest question, never on the size
+ *   of the package.
+ *
+ *   This isn't a general XML parser. Tags and text are told
+ *   apart, entities decoded, and only the elements that make
+ *   a question (item, mattext, response_label, varequal, not)
+ *   are looked at.
+ */
+#ifndef QTIREAD_H
+
+#define QTIREAD_H
+
+#include <stdio.h>
+
+#include "strbuf.h"
+
+#define QTI_ID_LEN      64
+
+#define QTI_OK           0
+#define QTI_BROKEN       1    // Not what txt2qti writes
+#define QTI_STOPPED      2    // By the callback
+
+typedef struct qti_choice {
+          char    id[QTI_ID_LEN];   // response_label ident
+          STRBUF  text;
+          char    correct;
+         } QTI_CHOICE_T;
+
+typedef struct qti_item {
+          char                title[QTI_ID_LEN];
+          char                ident[QTI_ID_LEN];
+          STRBUF              text;
+          char                multiple;      // Several answers
+          QTI_CHOICE_T       *choices;
+          int                 choice_cnt;
+          int                 choice_alloc;
+          int                 answer_cnt;
+          int                 bad_answers;   // Not one of the choices
+          unsigned long long  start;         // Offsets in the XML
+          unsigned long long  end;
+         } QTI_ITEM_T;
+
+// Returns 0 to go on, anything else to stop
+typedef int (*QTI_ITEM_FUNC)(void *opaque, QTI_ITEM_T *item);
+
+typedef struct qti_reader {
+          STRBUF              tok;          // Tag or text being read
+          char                in_tag;
+          char                in_item;
+          char                in_label;
+          char                in_mattext;
+          char                in_not;
+          char                in_varequal;
+          STRBUF              value;        // Of varequal
+          unsigned long long  ofs;          // Bytes seen
+          unsigned long long  tokstart;
+          QTI_ITEM_T          item;
+          long                items;
+          int                 err;
+          QTI_ITEM_FUNC       func;
+          void               *opaque;
+         } QTI_READER_T;
+
+extern void qtiread_init(QTI_READER_T *r, QTI_ITEM_FUNC func, void *opaque);
+// Next len bytes of the XML. Returns 0 if OK, -1 if the
+// callback stopped reading or the XML is broken (see err).
+extern int  qtiread_feed(QTI_READER_T *r, const char *buf, size_t len);
+// End of the XML. Returns -1 if an item was left open.
+extern int  qtiread_end(QTI_READER_T *r);
+extern void qtiread_dispose(QTI_READER_T *r);
+// Digest of what makes the question: title, text, choices
+// and which ones are correct - not identifiers.
+extern void qtiread_hash(QTI_ITEM_T *item, unsigned char *digest);
+// The question, in the format of the text files.
+extern void qtiread_print(FILE *fp, QTI_ITEM_T *item);
+
+#endif
@@ -0,0 +1,181 @@
+/// \file  spill.c
+/// \brief Generated text moved to a temporary file past a budget.
+/* -------------------------------------------------------------*
+
+   A large region of address space is reserved (PROT_NONE, no
+   memory behind it) the first time the budget is exceeded.
+   The file grows by SPILL_GROW bytes at a time, each new
+   stretch being mapped read-only, MAP_FIXED, over the next
+   part of the reservation; text is written with pwrite(),
+   which goes through the same page cache, and read back
+   through the mapping. Pointers handed out therefore stay
+   valid until spill_end().
+
+   The file is unlinked as soon as created: nothing is left
+   behind, whatever way the program ends.
+
+   Only the main thread (the parser) spills; the counters are
+   nevertheless protected, text being freed elsewhere.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "spill.h"
+
+#define SPILL_GROW      (64 * 1024 * 1024)
+#define SPILL_RESERVE   (1ULL << 40)     // 1 TB of address space,
+                                         // less if refused (ulimit -v)
+
+static SPILL_STATS_T    G_spill;
+static pthread_mutex_t  G_spill_lock = PTHREAD_MUTEX_INITIALIZER;
+static int              G_spill_fd = -1;
+static char            *G_spill_base = NULL;
+static size_t           G_spill_reserved = 0;
+static size_t           G_spill_mapped = 0;
+static char             G_spill_failed = 0;
+
+static int spill_open(void) {
+   // Temporary file and reserved address space
+   char        path[FILENAME_MAX];
+   const char *dir;
+
+   if ((dir = getenv("TMPDIR")) == NULL) {
+     dir = "/tmp";
+   }
+   snprintf(path, FILENAME_MAX, "%s/txt2qti-XXXXXX", dir);
+   if ((G_spill_fd = mkstemp(path)) == -1) {
+     fprintf(stderr, "*** WARNING *** %s: %s - --memory-limit ignored\n",
+                     path, strerror(errno));
+     return -1;
+   }
+   (void)unlink(path);
+   G_spill_reserved = (size_t)SPILL_RESERVE;
+   while (((G_spill_base = (char *)mmap(NULL, G_spill_reserved, PROT_NONE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS
+                                          | MAP_NORESERVE,
+                                        -1, 0)) == MAP_FAILED)
+          && (G_spill_reserved > 4 * SPILL_GROW)) {
+     G_spill_reserved /= 2;
+   }
+   if (G_spill_base == MAP_FAILED) {
+     fprintf(stderr, "*** WARNING *** mmap: %s - --memory-limit"
+                     " ignored\n", strerror(errno));
+     G_spill_base = NULL;
+     close(G_spill_fd);
+     G_spill_fd = -1;
+     return -1;
+   }
+   return 0;
+}
+
+static int spill_grow(size_t upto) {
+   // Maps the file at least up to offset upto
+   size_t grow;
+
+   if (upto <= G_spill_mapped) {
+     return 0;
+   }
+   grow = ((upto - G_spill_mapped + SPILL_GROW - 1) / SPILL_GROW)
+          * SPILL_GROW;
+   if ((G_spill_mapped + grow > G_spill_reserved)
+       || (ftruncate(G_spill_fd, (off_t)(G_spill_mapped + grow)) == -1)
+       || (mmap(G_spill_base + G_spill_mapped, grow, PROT_READ,
+                MAP_SHARED | MAP_FIXED, G_spill_fd,
+                (off_t)G_spill_mapped) == MAP_FAILED)) {
+     fprintf(stderr, "*** WARNING *** spill file: %s - questions now"
+                     " kept in memory\n", strerror(errno));
+     return -1;
+   }
+   // Read back once, from start to end
+   (void)madvise(G_spill_base + G_spill_mapped, grow, MADV_SEQUENTIAL);
+   G_spill_mapped += grow;
+   return 0;
+}
+
+static char *spill_write(char *s, size_t len) {
+   // Copy of s at the end of the file, NULL if it fails
+   size_t  ofs = (size_t)G_spill.spilled;
+   size_t  done = 0;
+   ssize_t n;
+
+   if (spill_grow(ofs + len) == -1) {
+     return NULL;
+   }
+   while (done < len) {
+     if ((n = pwrite(G_spill_fd, s + done, len - done,
+                     (off_t)(ofs + done))) <= 0) {
+       if ((n == -1) && (errno == EINTR)) {
+         continue;
+       }
+       fprintf(stderr, "*** WARNING *** spill file: %s - questions now"
+                       " kept in memory\n",
+                       (n == -1 ? strerror(errno) : "short write"));
+       return NULL;
+     }
+     done += (size_t)n;
+   }
+   G_spill.spilled += len;
+   G_spill.frags++;
+   return G_spill_base + ofs;
+}
+
+extern void spill_init(unsigned long long limit) {
+   memset(&G_spill, 0, sizeof(SPILL_STATS_T));
+   G_spill.limit = limit;
+}
+
+extern char *spill_keep(char *s, size_t len, char *spilledp) {
+   char *p = NULL;
+
+   pthread_mutex_lock(&G_spill_lock);
+   if (G_spill.limit
+       && !G_spill_failed
+       && (G_spill.held + len > G_spill.limit)) {
+     if ((G_spill_base == NULL) && (spill_open() == -1)) {
+       G_spill_failed = 1;
+     } else if ((p = spill_write(s, len)) == NULL) {
+       G_spill_failed = 1;
+     }
+   }
+   if (p) {
+     free(s);
+     *spilledp = 1;
+   } else {
+     G_spill.held += len;
+     p = s;
+     *spilledp = 0;
+   }
+   pthread_mutex_unlock(&G_spill_lock);
+   return p;
+}
+
+extern void spill_release(size_t len) {
+   pthread_mutex_lock(&G_spill_lock);
+   G_spill.held -= len;
+   pthread_mutex_unlock(&G_spill_lock);
+}
+
+extern void spill_stats(SPILL_STATS_T *st) {
+   pthread_mutex_lock(&G_spill_lock);
+   memcpy(st, &G_spill, sizeof(SPILL_STATS_T));
+   pthread_mutex_unlock(&G_spill_lock);
+}
+
+extern void spill_end(void) {
+   if (G_spill_base) {
+     (void)munmap(G_spill_base, G_spill_reserved);
+     G_spill_base = NULL;
+     G_spill_mapped = 0;
+   }
+   if (G_spill_fd != -1) {
+     close(G_spill_fd);
+     G_spill_fd = -1;
+   }
+}
@@ -0,0 +1,41 @@
+/*
+ *   Questions kept on disk under --memory-limit.
+ *
+ *   Past the budget, generated text goes to an unlinked
+ *   temporary file instead of the heap. The file is mapped
+ *   read-only into address space reserved at the start, so
+ *   what was spilled is still reached through ordinary
+ *   pointers (fragments don't need to know), and the
+ *   compressor, which reads it sequentially, only brings it
+ *   back a few pages at a time: they are file pages that the
+ *   kernel can write out and drop again, where heap memory
+ *   gets the process killed.
+ */
+#ifndef SPILL_H
+
+#define SPILL_H
+
+#include <stddef.h>
+
+typedef struct spill_stats {
+          unsigned long long limit;     // 0: no limit
+          unsigned long long held;      // Bytes in memory
+          unsigned long long spilled;   // Bytes in the file
+          long               frags;     // Pieces of text spilled
+         } SPILL_STATS_T;
+
+// Sets the budget (0: everything stays in memory)
+extern void  spill_init(unsigned long long limit);
+// Where the len bytes of the malloc'd s are to be kept: s
+// itself (*spilledp set to 0) while the budget allows, a copy
+// in the spill file otherwise (*spilledp set to 1, s freed).
+// Falls back to memory, once warned, if the file can't be
+// created.
+extern char *spill_keep(char *s, size_t len, char *spilledp);
+// len bytes returned by spill_keep() in memory were freed
+extern void  spill_release(size_t len);
+extern void  spill_stats(SPILL_STATS_T *st);
+// Unmaps and closes the file; spilled text is gone
+extern void  spill_end(void);
+
+#endif
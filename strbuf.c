@@ -11,9 +11,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 
 #include "strbuf.h"
+#include "chrclass.h"
 
 #define CHUNK    256
 
@@ -43,7 +43,7 @@ extern void strbuf_clear(STRBUF *sb) {
 }
 
 extern void strbuf_unquote(STRBUF *sb) {
-   int i;
+   size_t i;
 
    if (sb && sb->len && (sb->curlen > 1)) {
       if (((sb->s[0] == '\'')
@@ -60,17 +60,17 @@ extern void strbuf_unquote(STRBUF *sb) {
 }
 
 extern void strbuf_trim(STRBUF *sb) {
-   int i;
-   int start;
+   size_t i;
+   size_t start;
 
    if (sb && sb->len && sb->curlen) {
       while (sb->curlen
-             && isspace(sb->s[sb->curlen - 1])) {
+             && CC_ISSPACE(sb->s[sb->curlen - 1])) {
         (sb->curlen)--;
       }
       sb->s[sb->curlen] = '\0';
       i = 0;
-      while (isspace(sb->s[i])) {
+      while (CC_ISSPACE(sb->s[i])) {
         i++;
       }
       start = i;
@@ -85,92 +85,74 @@ extern void strbuf_trim(STRBUF *sb) {
    }
 }
 
+static void strbuf_room(STRBUF *sb, size_t required) {
+   // The size at least doubles, so that building a long string
+   // piece by piece doesn't copy it over and over
+   size_t newlen;
+
+   if (required <= sb->len) {
+      return;
+   }
+   newlen = ((required % CHUNK) == 0 ? required
+              : (CHUNK * (1 + required/CHUNK)));
+   if (newlen < 2 * sb->len) {
+      newlen = 2 * sb->len;
+   }
+   if (0 == sb->len) {
+      if ((sb->s = (char *)malloc(newlen)) == (char *)NULL) {
+         perror("malloc()");
+         exit(1);
+      }
+   } else {
+      if ((sb->s = (char *)realloc(sb->s, newlen)) == (char *)NULL) {
+         perror("realloc()");
+         exit(1);
+      }
+   }
+   sb->len = newlen;
+}
+
 extern void strbuf_add(STRBUF *sb,
                        char   *s) {
-   size_t required;
+   size_t len;
 
    if (sb && s) {
-      required = sb->curlen + strlen(s) + 1;
-      required = ((required % CHUNK) == 0 ? required
-                   : (CHUNK * (1 + (int)required/CHUNK)));
-      if (0 == sb->len) {
-         if ((sb->s = (char *)malloc(required)) == (char *)NULL) {
-            perror("malloc()");
-            exit(1);
-         }
-         sb->len = required;
-         strcpy(sb->s, s);
-      } else {
-         if (required > sb->len) {
-            if ((sb->s = (char *)realloc(sb->s, required)) == (char *)NULL) {
-               perror("realloc()");
-               exit(1);
-            }
-            sb->len = required;
-         }
-         strcat(sb->s, s);
-      }
-      sb->curlen = strlen(sb->s);
+      len = strlen(s);
+      strbuf_room(sb, sb->curlen + len + 1);
+      memcpy(&(sb->s[sb->curlen]), s, len + 1);
+      sb->curlen += len;
    }
 }
 
 extern void strbuf_nadd(STRBUF *sb,
                         char   *s,
                         size_t  len) {
-   size_t required;
-
    if (sb && s) {
-      required = sb->curlen + len + 1;
-      required = ((required % CHUNK) == 0 ? required
-                   : (CHUNK * (1 + (int)required/CHUNK)));
-      if (0 == sb->len) {
-         if ((sb->s = (char *)malloc(required)) == (char *)NULL) {
-            perror("malloc()");
-            exit(1);
-         }
-         sb->len = required;
-         strncpy(sb->s, s, len);
-         sb->s[len] = '\0';
-      } else {
-         if (required > sb->len) {
-            if ((sb->s = (char *)realloc(sb->s, required)) == (char *)NULL) {
-               perror("realloc()");
-               exit(1);
-            }
-            sb->len = required;
-         }
-         strncat(sb->s, s, sb->curlen + len);
-         sb->s[sb->curlen + len] = '\0';
-      }
-      sb->curlen = strlen(sb->s);
+      // Never copy beyond the end of s
+      len = strnlen(s, len);
+      strbuf_room(sb, sb->curlen + len + 1);
+      memcpy(&(sb->s[sb->curlen]), s, len);
+      sb->curlen += len;
+      sb->s[sb->curlen] = '\0';
    }
 }
 
 extern void strbuf_addc(STRBUF *sb, int c) {
-  size_t required;
-
   if (sb) {
-    if (sb->curlen >= (sb->len - 1)) {
-      required = sb->len + CHUNK;
-      if (0 == sb->len) {
-        if ((sb->s = (char *)malloc(required)) == (char *)NULL) {
-          perror("malloc()");
-          exit(1);
-        }
-      } else {
-        if ((sb->s = (char *)realloc(sb->s, required)) == (char *)NULL) {
-          perror("realloc()");
-          exit(1);
-        }
-      }
-      sb->len = required;
-    }
+    strbuf_room(sb, sb->curlen + 2);
     sb->s[sb->curlen] = (char)c;
     (sb->curlen)++;
     sb->s[sb->curlen] = '\0';
   }
 }
 
+extern void strbuf_reserve(STRBUF *sb,
+                           size_t  len) {
+   if (sb) {
+      strbuf_room(sb, sb->curlen + len + 1);
+   }
+}
+
 extern void strbuf_concat(STRBUF *sb1,
                           STRBUF *sb2) {
    if (sb1 && sb2) {
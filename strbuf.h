@@ -21,6 +21,9 @@ extern void strbuf_add(STRBUF *sb, char *s);
 extern void strbuf_addc(STRBUF *sb, int c);
 extern void strbuf_nadd(STRBUF *sb, char *s, size_t len);
 extern void strbuf_concat(STRBUF *sb1, STRBUF *sb2);
+// Make room for len more characters at once, when the size of
+// what is going to be added is roughly known
+extern void strbuf_reserve(STRBUF *sb, size_t len);
 
 // Remove a pair of simple or double quotes
 // that enclose the string.
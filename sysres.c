@@ -0,0 +1,252 @@
+/// \file  sysres.c
+/// \brief CPUs and memory available, container limits included.
+/* -------------------------------------------------------------*
+
+   The cgroup of the process is read from /proc/self/cgroup.
+   With cgroup v2 (a "0::" line), limits are in cpu.max
+   ("max 100000" or "quota period", in microseconds) and
+   memory.max of its directory under /sys/fs/cgroup and of
+   every directory above it, the strictest one applying. With
+   cgroup v1, they are in cpu.cfs_quota_us / cpu.cfs_period_us
+   and memory.limit_in_bytes under the cpu and memory
+   hierarchies. Inside a container with its own cgroup
+   namespace, the path given may not exist under the mount
+   point: the mount point itself is then the cgroup.
+
+   The load average is only taken into account when there is
+   no quota: on a host, threads beyond the idle CPUs would
+   just wait, but in a container the load average is that of
+   the whole host and tells nothing about the quota.
+
+ * -------------------------------------------------------------*/
+
+#define _GNU_SOURCE       // sched_getaffinity()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sysres.h"
+
+#ifndef CGROUP_MOUNT
+#define CGROUP_MOUNT   "/sys/fs/cgroup"
+#endif
+#define PATH_LEN       1024
+
+static int read_line(const char *dir, const char *file,
+                     char *buf, int size) {
+   char  path[PATH_LEN];
+   FILE *fp;
+   int   ok;
+
+   snprintf(path, PATH_LEN, "%s/%s", dir, file);
+   if ((fp = fopen(path, "r")) == NULL) {
+     return -1;
+   }
+   ok = (fgets(buf, size, fp) != NULL);
+   fclose(fp);
+   return (ok ? 0 : -1);
+}
+
+static int has_controller(char *list, const char *controller) {
+   // list: controllers separated by commas
+   char *p;
+
+   for (p = strtok(list, ","); p; p = strtok(NULL, ",")) {
+     if (strcmp(p, controller) == 0) {
+       return 1;
+     }
+   }
+   return 0;
+}
+
+static int cgroup_of(const char *controller, char *rel, int size) {
+   // Path of the cgroup for controller ("" for cgroup v2).
+   // Returns 0 if found, -1 otherwise.
+   char  line[PATH_LEN];
+   char *p;
+   char *q;
+   FILE *fp;
+   int   ret = -1;
+
+   if ((fp = fopen("/proc/self/cgroup", "r")) == NULL) {
+     return -1;
+   }
+   while (fgets(line, PATH_LEN, fp)) {
+     // id:controllers:path
+     if (((p = strchr(line, ':')) == NULL)
+         || ((q = strchr(p + 1, ':')) == NULL)) {
+       continue;
+     }
+     p++;
+     *q++ = '\0';
+     if ((*controller == '\0') ? (*p == '\0')
+                               : has_controller(p, controller)) {
+       q[strcspn(q, "\n")] = '\0';
+       snprintf(rel, size, "%s", q);
+       ret = 0;
+       break;
+     }
+   }
+   fclose(fp);
+   return ret;
+}
+
+static void limit_cpu(SYS_RES_T *r, double quota) {
+   if ((quota > 0) && ((r->quota == 0) || (quota < r->quota))) {
+     r->quota = quota;
+   }
+}
+
+static void limit_mem(SYS_RES_T *r, unsigned long long limit) {
+   if ((limit > 0) && ((r->mem_limit == 0) || (limit < r->mem_limit))) {
+     r->mem_limit = limit;
+   }
+}
+
+static void read_dir(SYS_RES_T *r, const char *dir, int v2, int leaf) {
+   // Limits set on one cgroup directory
+   char               buf[128];
+   char               buf2[128];
+   long long          quota;
+   long long          period;
+   unsigned long long n;
+
+   if (v2) {
+     if ((read_line(dir, "cpu.max", buf, sizeof(buf)) == 0)
+         && (sscanf(buf, "%lld %lld", &quota, &period) == 2)
+         && (period > 0)) {
+       limit_cpu(r, (double)quota / period);
+     }
+     if ((read_line(dir, "memory.max", buf, sizeof(buf)) == 0)
+         && (sscanf(buf, "%llu", &n) == 1)) {
+       limit_mem(r, n);
+     }
+     if (leaf
+         && (read_line(dir, "memory.current", buf, sizeof(buf)) == 0)) {
+       (void)sscanf(buf, "%llu", &(r->mem_used));
+     }
+   } else {
+     if ((read_line(dir, "cpu.cfs_quota_us", buf, sizeof(buf)) == 0)
+         && (read_line(dir, "cpu.cfs_period_us", buf2,
+                       sizeof(buf2)) == 0)
+         && (sscanf(buf, "%lld", &quota) == 1)
+         && (sscanf(buf2, "%lld", &period) == 1)
+         && (quota > 0) && (period > 0)) {
+       limit_cpu(r, (double)quota / period);
+     }
+     if ((read_line(dir, "memory.limit_in_bytes", buf,
+                    sizeof(buf)) == 0)
+         && (sscanf(buf, "%llu", &n) == 1)) {
+       limit_mem(r, n);
+     }
+     if (leaf
+         && (read_line(dir, "memory.usage_in_bytes", buf,
+                       sizeof(buf)) == 0)) {
+       (void)sscanf(buf, "%llu", &(r->mem_used));
+     }
+   }
+}
+
+static void walk(SYS_RES_T *r, const char *mount, const char *rel,
+                 int v2) {
+   // From the cgroup of the process up to the mount point
+   char        dir[PATH_LEN];
+   char       *p;
+   struct stat st;
+   size_t      mlen = strlen(mount);
+   int         leaf = 1;
+
+   if (stat(mount, &st) == -1) {
+     return;
+   }
+   snprintf(dir, PATH_LEN, "%s%s", mount, rel);
+   if (stat(dir, &st) == -1) {
+     // Own cgroup namespace
+     snprintf(dir, PATH_LEN, "%s", mount);
+   }
+   for (;;) {
+     read_dir(r, dir, v2, leaf);
+     leaf = 0;
+     if (((p = strrchr(dir, '/')) == NULL)
+         || ((size_t)(p - dir) < mlen)) {
+       break;
+     }
+     *p = '\0';
+   }
+}
+
+extern void sysres_read(SYS_RES_T *r) {
+   char               rel[PATH_LEN];
+   cpu_set_t          set;
+   double             load;
+   unsigned long long phys;
+   long               pages;
+   long               pagesize;
+   int                n;
+
+   memset(r, 0, sizeof(SYS_RES_T));
+   if ((r->online = (int)sysconf(_SC_NPROCESSORS_ONLN)) < 1) {
+     r->online = 1;
+   }
+   r->affinity = r->online;
+   CPU_ZERO(&set);
+   if (sched_getaffinity(0, sizeof(cpu_set_t), &set) == 0) {
+     r->affinity = CPU_COUNT(&set);
+   }
+   // Hybrid setups have a 0:: line too, with v1 controllers
+   // mounted under /sys/fs/cgroup
+   if ((cgroup_of("", rel, PATH_LEN) == 0)
+       && (access(CGROUP_MOUNT "/cgroup.controllers", F_OK) == 0)) {
+     walk(r, CGROUP_MOUNT, rel, 1);
+   }
+   if ((r->quota == 0) && (cgroup_of("cpu", rel, PATH_LEN) == 0)) {
+     walk(r, CGROUP_MOUNT "/cpu", rel, 0);
+     if (r->quota == 0) {
+       walk(r, CGROUP_MOUNT "/cpu,cpuacct", rel, 0);
+     }
+   }
+   if ((r->mem_limit == 0) && (cgroup_of("memory", rel, PATH_LEN) == 0)) {
+     walk(r, CGROUP_MOUNT "/memory", rel, 0);
+   }
+   // "No limit" is a huge number with cgroup v1
+   pages = sysconf(_SC_PHYS_PAGES);
+   pagesize = sysconf(_SC_PAGESIZE);
+   if ((pages > 0) && (pagesize > 0)) {
+     phys = (unsigned long long)pages * (unsigned long long)pagesize;
+     if (r->mem_limit >= phys) {
+       r->mem_limit = 0;
+     }
+   }
+   if (r->mem_limit == 0) {
+     r->mem_used = 0;
+   }
+   r->cpus = r->affinity;
+   if (r->quota > 0) {
+     // 2.5 CPUs: 3 threads
+     n = (int)r->quota;
+     if (r->quota > (double)n) {
+       n++;
+     }
+     if (n < r->cpus) {
+       r->cpus = n;
+     }
+   }
+   if (r->cpus < 1) {
+     r->cpus = 1;
+   }
+   r->jobs = r->cpus;
+   if (getloadavg(&load, 1) == 1) {
+     r->load = load;
+     if (r->quota == 0) {
+       // CPUs already busy, but never less than half of them
+       r->jobs = r->cpus - (int)load;
+       if (r->jobs < (r->cpus + 1) / 2) {
+         r->jobs = (r->cpus + 1) / 2;
+       }
+     }
+   }
+}
@@ -0,0 +1,29 @@
+/*
+ *   CPUs and memory that the process may actually use.
+ *
+ *   In a container, the number of processors online is that
+ *   of the host: a pod limited to 4 CPUs on a 64-core machine
+ *   would otherwise start 64 threads that the scheduler then
+ *   throttles. What counts is the smallest of the CPUs the
+ *   process may run on (sched_getaffinity), of the CPU quota
+ *   of its cgroup and of those above it (cgroup v2 cpu.max,
+ *   or v1 cfs quota), and, for memory, the cgroup limit.
+ */
+#ifndef SYSRES_H
+
+#define SYSRES_H
+
+typedef struct sys_res {
+          int                online;     // Processors online
+          int                affinity;   // Those the process may use
+          double             quota;      // In CPUs, 0 if none
+          double             load;       // 1-minute load average
+          int                cpus;       // What all that allows
+          int                jobs;       // Suggested worker threads
+          unsigned long long mem_limit;  // cgroup limit, 0 if none
+          unsigned long long mem_used;   // Already charged to it
+         } SYS_RES_T;
+
+extern void sysres_read(SYS_RES_T *r);
+
+#endif
@@ -0,0 +1,171 @@
+/// \file  tagscan.c
+/// \brief Single-pass scanner for <pre>/<block> tags.
+/* -------------------------------------------------------------*
+
+   Lines used to be searched four times (</pre>, <pre>, <block>,
+   </block>). Here we jump from '<' to '<' with memchr() and
+   only look at what follows.
+
+   Written by Stephane Faroult
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chrclass.h"
+#include "tagscan.h"
+
+#define TAG_ALLOC   8
+
+static const char *G_tag_text[] = {NULL,
+                                   "<pre>",
+                                   "</pre>",
+                                   "<block>",
+                                   "</block>"};
+
+// Returns the tag that starts at s, TAG_NONE if there is none,
+// or -1 if the n bytes available are the beginning of a tag.
+static int tag_match(const char *s, size_t n, short *lenp) {
+   const char *t;
+   int         tag;
+   size_t      i;
+
+   if ((n < 2) || (*s != '<')) {
+     return ((n == 1) && (*s == '<')) ? -1 : TAG_NONE;
+   }
+   switch (CC_TOLOWER(s[1])) {
+     case 'p':
+          tag = TAG_PRE;
+          break;
+     case 'b':
+          tag = TAG_BLOCK;
+          break;
+     case '/':
+          if (n < 3) {
+            return -1;
+          }
+          switch (CC_TOLOWER(s[2])) {
+            case 'p':
+                 tag = TAG_END_PRE;
+                 break;
+            case 'b':
+                 tag = TAG_END_BLOCK;
+                 break;
+            default:
+                 return TAG_NONE;
+          }
+          break;
+     default:
+          return TAG_NONE;
+   }
+   t = G_tag_text[tag];
+   for (i = 0; t[i]; i++) {
+     if (i == n) {
+       return -1;
+     }
+     if (CC_TOLOWER(s[i]) != t[i]) {
+       return TAG_NONE;
+     }
+   }
+   *lenp = (short)i;
+   return tag;
+}
+
+extern void taglist_init(TAG_LIST_T *list) {
+   if (list) {
+     list->hits = NULL;
+     list->cnt = 0;
+     list->alloc = 0;
+   }
+}
+
+extern void taglist_clear(TAG_LIST_T *list) {
+   if (list) {
+     list->cnt = 0;
+   }
+}
+
+extern void taglist_dispose(TAG_LIST_T *list) {
+   if (list && list->hits) {
+     free(list->hits);
+     taglist_init(list);
+   }
+}
+
+extern void taglist_add(TAG_LIST_T *list, short tag, long pos, short len) {
+   if (list) {
+     if (list->cnt == list->alloc) {
+       if ((list->hits = (TAG_HIT_T *)realloc(list->hits,
+                          sizeof(TAG_HIT_T) * (list->alloc + TAG_ALLOC)))
+                == NULL) {
+         perror("realloc()");
+         exit(1);
+       }
+       list->alloc += TAG_ALLOC;
+     }
+     list->hits[list->cnt].tag = tag;
+     list->hits[list->cnt].pos = pos;
+     list->hits[list->cnt].len = len;
+     (list->cnt)++;
+   }
+}
+
+extern void tagscan_init(TAG_SCANNER_T *ts) {
+   if (ts) {
+     ts->partial_len = 0;
+   }
+}
+
+extern int tagscan(TAG_SCANNER_T *ts, const char *s, size_t len,
+                   TAG_LIST_T *list) {
+   const char *p;
+   const char *end;
+   char        tmp[2 * TAG_MAXLEN];
+   size_t      n;
+   short       taglen;
+   int         tag;
+
+   if (!ts || !s || !list) {
+     return 0;
+   }
+   taglist_clear(list);
+   p = s;
+   end = s + len;
+   if (ts->partial_len) {
+     // Try to complete the tag cut at the end of the previous chunk
+     n = (len < TAG_MAXLEN ? len : TAG_MAXLEN);
+     memcpy(tmp, ts->partial, ts->partial_len);
+     memcpy(&(tmp[ts->partial_len]), s, n);
+     tag = tag_match(tmp, ts->partial_len + n, &taglen);
+     if (tag > 0) {
+       taglist_add(list, (short)tag, -(long)ts->partial_len, taglen);
+       p = s + (taglen - ts->partial_len);
+       ts->partial_len = 0;
+     } else if ((tag < 0) && (ts->partial_len + n < TAG_MAXLEN)) {
+       // Still incomplete (tiny chunk)
+       memcpy(&(ts->partial[ts->partial_len]), s, n);
+       ts->partial_len += n;
+       return 0;
+     } else {
+       ts->partial_len = 0;
+     }
+   }
+   while ((p < end)
+          && ((p = (const char *)memchr(p, '<', end - p)) != NULL)) {
+     tag = tag_match(p, end - p, &taglen);
+     if (tag > 0) {
+       taglist_add(list, (short)tag, (long)(p - s), taglen);
+       p += taglen;
+     } else if (tag < 0) {
+       // Beginning of a tag at the very end of the chunk
+       ts->partial_len = (int)(end - p);
+       memcpy(ts->partial, p, ts->partial_len);
+       break;
+     } else {
+       p++;
+     }
+   }
+   return list->cnt;
+}
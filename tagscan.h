@@ -0,0 +1,50 @@
+/*
+ *   Single-pass detection of the tags txt2qti cares about:
+ *   <pre>, </pre>, <block> and </block> (any case).
+ *
+ *   Written by Stephane Faroult
+ */
+#ifndef TAGSCAN_H
+
+#define TAGSCAN_H
+
+#define TAG_NONE        0
+#define TAG_PRE         1
+#define TAG_END_PRE     2
+#define TAG_BLOCK       3
+#define TAG_END_BLOCK   4
+
+#define TAG_MAXLEN      8     // strlen("</block>")
+
+typedef struct tag_hit {
+          short  tag;
+          long   pos;   // Offset of '<' - negative if the tag
+                        // started at the end of the previous chunk
+          short  len;
+         } TAG_HIT_T;
+
+typedef struct tag_list {
+          TAG_HIT_T *hits;
+          int        cnt;
+          int        alloc;
+         } TAG_LIST_T;
+
+typedef struct tag_scanner {
+          char  partial[TAG_MAXLEN];  // Tag cut at the end of a chunk
+          int   partial_len;
+         } TAG_SCANNER_T;
+
+extern void tagscan_init(TAG_SCANNER_T *ts);
+// Finds all tags in s (len bytes) in one pass and stores them,
+// in order, in list (which is cleared first). A tag cut at the
+// end of s is remembered and completed by the next call.
+// Returns the number of tags found.
+extern int  tagscan(TAG_SCANNER_T *ts, const char *s, size_t len,
+                    TAG_LIST_T *list);
+
+extern void taglist_init(TAG_LIST_T *list);
+extern void taglist_clear(TAG_LIST_T *list);
+extern void taglist_dispose(TAG_LIST_T *list);
+extern void taglist_add(TAG_LIST_T *list, short tag, long pos, short len);
+
+#endif
@@ -0,0 +1,181 @@
+/// \file  textin.c
+/// \brief Normalization of the input text.
+/* -------------------------------------------------------------*
+
+   Text is read and rewritten in place, the write position
+   never being ahead of the read position (a BOM or a CR LF
+   only makes text shorter), except when a Windows-1252 byte
+   turns into a two- or three-byte UTF-8 sequence: the text
+   is then moved to a buffer large enough for the worst case
+   and the pass goes on there.
+
+   Most of the input is plain ASCII without CR. With SSE2,
+   16 bytes at a time are checked for a high bit or a CR and
+   copied (only if something before them was removed); the
+   byte-by-byte path only sees what needs looking at.
+
+   UTF-8 sequences are checked as in RFC 3629: no overlong
+   forms, no surrogates, nothing above U+10FFFF.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "textin.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Windows-1252 0x80 to 0x9F (the rest is as in Latin-1).
+// Undefined positions give the replacement character.
+static const unsigned short G_cp1252[32] = {
+          0x20AC, 0xFFFD, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+          0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0xFFFD, 0x017D, 0xFFFD,
+          0xFFFD, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+          0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0xFFFD, 0x017E, 0x0178};
+
+static size_t utf8_len(const unsigned char *s, size_t avail) {
+   // Length of the valid UTF-8 sequence at s, 0 if there is none
+   size_t n;
+   size_t i;
+   unsigned char lo = 0x80;
+   unsigned char hi = 0xBF;
+
+   if ((*s >= 0xC2) && (*s <= 0xDF)) {
+     n = 2;
+   } else if ((*s >= 0xE0) && (*s <= 0xEF)) {
+     n = 3;
+     if (*s == 0xE0) {
+       lo = 0xA0;         // Overlong
+     } else if (*s == 0xED) {
+       hi = 0x9F;         // Surrogates
+     }
+   } else if ((*s >= 0xF0) && (*s <= 0xF4)) {
+     n = 4;
+     if (*s == 0xF0) {
+       lo = 0x90;         // Overlong
+     } else if (*s == 0xF4) {
+       hi = 0x8F;         // Above U+10FFFF
+     }
+   } else {
+     return 0;
+   }
+   if (avail < n) {
+     return 0;
+   }
+   if ((s[1] < lo) || (s[1] > hi)) {
+     return 0;
+   }
+   for (i = 2; i < n; i++) {
+     if ((s[i] & 0xC0) != 0x80) {
+       return 0;
+     }
+   }
+   return n;
+}
+
+static size_t cp1252_put(unsigned char *out, unsigned char c) {
+   // UTF-8 for a Windows-1252 byte above 0x7F
+   unsigned int u = (c < 0xA0 ? G_cp1252[c - 0x80] : c);
+
+   if (u < 0x800) {
+     out[0] = (unsigned char)(0xC0 | (u >> 6));
+     out[1] = (unsigned char)(0x80 | (u & 0x3F));
+     return 2;
+   }
+   out[0] = (unsigned char)(0xE0 | (u >> 12));
+   out[1] = (unsigned char)(0x80 | ((u >> 6) & 0x3F));
+   out[2] = (unsigned char)(0x80 | (u & 0x3F));
+   return 3;
+}
+
+extern char *textin_normalize(char *data, size_t *sizep, TEXTIN_T *t) {
+   unsigned char *s = (unsigned char *)data;
+   unsigned char *out = s;
+   size_t         size = *sizep;
+   size_t         r = 0;
+   size_t         w = 0;
+   size_t         n;
+   size_t         i;
+#ifdef __SSE2__
+   __m128i        cr = _mm_set1_epi8('\r');
+   __m128i        v;
+   int            m;
+#endif
+
+   memset(t, 0, sizeof(TEXTIN_T));
+   if ((size >= 3) && (s[0] == 0xEF) && (s[1] == 0xBB) && (s[2] == 0xBF)) {
+     t->bom = 1;
+     r = 3;
+   }
+   while (r < size) {
+#ifdef __SSE2__
+     // Runs of ASCII without CR
+     while (r + 16 <= size) {
+       v = _mm_loadu_si128((const __m128i *)(const void *)(s + r));
+       m = _mm_movemask_epi8(v)
+           | _mm_movemask_epi8(_mm_cmpeq_epi8(v, cr));
+       if (m) {
+         n = (size_t)__builtin_ctz((unsigned int)m);
+         if (out + w != s + r) {
+           memmove(out + w, s + r, n);
+         }
+         w += n;
+         r += n;
+         break;
+       }
+       if (out + w != s + r) {
+         _mm_storeu_si128((__m128i *)(void *)(out + w), v);
+       }
+       w += 16;
+       r += 16;
+     }
+     if (r >= size) {
+       break;
+     }
+#endif
+     if (s[r] == '\r') {
+       out[w++] = '\n';
+       r++;
+       if ((r < size) && (s[r] == '\n')) {
+         r++;
+       }
+       t->cr++;
+     } else if (s[r] < 0x80) {
+       out[w++] = s[r++];
+     } else if ((n = utf8_len(s + r, size - r)) != 0) {
+       for (i = 0; i < n; i++) {
+         out[w++] = s[r++];
+       }
+     } else {
+       if (out == s) {
+         // Room for the worst case, then go on there
+         if ((out = (unsigned char *)malloc(w + 3 * (size - r) + 1))
+               == NULL) {
+           perror("malloc");
+           exit(1);
+         }
+         memcpy(out, s, w);
+       }
+       if (t->cp1252 == 0) {
+         t->line = 1;
+         for (i = 0; i < w; i++) {
+           if (out[i] == '\n') {
+             t->line++;
+           }
+         }
+       }
+       w += cp1252_put(out + w, s[r++]);
+       t->cp1252++;
+     }
+   }
+   out[w] = '\0';
+   if (out != s) {
+     free(s);
+   }
+   *sizep = w;
+   return (char *)out;
+}
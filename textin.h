@@ -0,0 +1,31 @@
+/*
+ *   Normalization of the input text.
+ *
+ *   Files written with Windows editors often start with a byte
+ *   order mark, end their lines with CR LF and, once in a while,
+ *   hold Windows-1252 (or Latin-1) bytes that aren't valid in
+ *   the UTF-8 declared by the XML. All of this is fixed in a
+ *   single pass over the buffer, before the parser sees it:
+ *   the BOM is dropped, CR LF and lone CR become LF, and any
+ *   byte that doesn't start a valid UTF-8 sequence is read as
+ *   Windows-1252. Valid UTF-8 text is left as it is.
+ */
+#ifndef TEXTIN_H
+
+#define TEXTIN_H
+
+#include <stddef.h>
+
+typedef struct text_in {
+          char   bom;        // Byte order mark removed
+          long   cr;         // Line ends changed
+          long   cp1252;     // Bytes read as Windows-1252
+          long   line;       // Line of the first of them
+         } TEXTIN_T;
+
+// Normalizes the *sizep bytes of data (malloc'd, NUL-terminated)
+// and updates *sizep. Returns data, or a larger buffer when
+// Windows-1252 characters had to be widened (data is then freed).
+extern char *textin_normalize(char *data, size_t *sizep, TEXTIN_T *t);
+
+#endif
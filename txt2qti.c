@@ -9,29 +9,82 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <getopt.h>
 #include <string.h>
 #include <time.h>
-#include <ctype.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "strbuf.h"
+#include "chrclass.h"
+#include "tagscan.h"
 #include "miniz.h"
 #include "md5.h"
+#include "fasthash.h"
+#include "dedup.h"
+#include "neardup.h"
+#include "media.h"
+#include "zipout.h"
+#include "infiles.h"
+#include "watch.h"
+#include "qtiread.h"
+#include "textin.h"
+#include "mzpool.h"
+#include "deflate.h"
+#include "frags.h"
+#include "spill.h"
+#include "sysres.h"
+#include "wsched.h"
 
-#define OPTIONS         "?hamvdt:"
+#define OPTIONS         "?hamvdt:j:o:"
+
+// Long-only options
+#define OPT_REPRODUCIBLE  1000
+#define OPT_DEDUP         1001
+#define OPT_NEAR_DUP      1002
+#define OPT_WATCH         1003
+#define OPT_SHARD_SIZE    1004
+#define OPT_SHARD_QUESTIONS 1005
+#define OPT_VERIFY        1006
+#define OPT_STATS         1007
+#define OPT_DEFLATE_ENGINE 1008
+#define OPT_MEMORY_LIMIT  1009
+
+#define NEAR_DUP_DEFAULT  0.8
+
+// Manifest, header and footer of the assessment, zip records
+#define SHARD_OVERHEAD    4096
+
+// Larger entries are deflated in pieces of this size, in parallel
+#define ENTRY_PIECE       (1024 * 1024)
+#define ENTRY_TASK        -2      // Otherwise a piece, or -1: the CRC
+
+// DOS timestamps start in 1980
+#define DOS_EPOCH      315532800L
 
 #define START_CODE      "<pre>"
 #define END_CODE        "</pre>"
 
+// Characters that html_safe_nadd() replaces by an entity
+#define HTML_SPECIAL(c) (((c) == '<') || ((c) == '>') || ((c) == '"') \
+                         || ((c) == '#') || ((c) == '&'))
+
+// Room reserved for an item: markup, then markup of each choice.
+// Escaped text grows a little, assumed by no more than 1/8.
+#define ITEM_MARKUP      1024
+#define CHOICE_MARKUP     512
+
 #define LINE_LEN        4000
 #define BUFFER_LEN       250
-#define CHOICE_ID_LEN     10
+#define CHOICE_ID_LEN     20
 #define CHOICE_ALLOC       5
 #define IDENT_LEN         50
 #define ZIP_SIZE       10240
 #define ZIP_ALLOC       5120
-#define MAX_ROMAN         20
+#define MAX_ROMAN       3999
+#define LABEL_MAXLEN      16     // MMMDCCCLXXXVIII is the longest roman
+#define LABEL_ALLOC      256
 
 // Question types
 #define  QTYPE_UNKNOWN     0
@@ -71,11 +124,128 @@ typedef struct num_fmt {
            char  sep;
           } NUM_FMT_T; 
 
+// Labels for one numbering style, built once and stored
+// one after the other, each one preceded by its length.
+typedef struct label_tab {
+           char   *buf;
+           size_t  size;
+           size_t  used;
+           size_t *ofs;    // Where label n starts in buf
+           int     cnt;
+          } LABEL_TAB_T;
+
+// An input file and what came out of it, kept between
+// rebuilds with --watch. Parsing depends on the question
+// format found so far: the formats before and after are
+// recorded, so that a file after one that changed is parsed
+// again only if it would now start from a different format.
+typedef struct src_file {
+           char      *name;
+           char      *data;       // Content, kept with --watch
+           size_t     size;
+           FRAGS_T    items;      // Its questions, one fragment each
+           char       stat_ok;
+           char       changed;    // To read (again)
+           NUM_FMT_T  fmt_in[2];  // Question and choice formats
+           NUM_FMT_T  fmt_out[2];
+          } SRC_FILE_T;
+
+// A run of consecutive questions that goes to its own archive
+typedef struct shard {
+           FRAGS_T *body;      // Media not resolved
+           int      first;     // Fragment (question) indexes
+           int      cnt;
+           long     qcnt;
+           int      ret;
+          } SHARD_T;
+
+typedef struct shard_job {
+           SHARD_T         *shards;
+           int              cnt;
+           int              next;      // Next one to write
+           char            *zipname;
+           char            *title;
+           unsigned char   *digest;    // Of the whole
+           pthread_mutex_t  lock;
+          } SHARD_JOB_T;
+
+// A text entry of the archive, deflated before being added
+typedef struct zip_entry {
+           char          *name;
+           FRAGS_T       *data;
+           char          *what;       // For messages
+           size_t         len;
+           int            pieces;     // Deflated separately
+           int           *first;      // First fragment of each piece
+           void         **out;        // Deflated pieces
+           size_t        *outlen;
+           unsigned int   crc;
+          } ZIP_ENTRY_T;
+
+// An archive read back by --verify, and what it should hold.
+// Questions of the source are read one fragment at a time,
+// as those of the archive come.
+typedef struct verify {
+           char               *zipname;
+           mz_zip_archive      zip;
+           FRAGS_T            *body;      // Questions from the text
+           int                 next;      // Next fragment to read
+           int                 last;      // Past the last one
+           QTI_READER_T        src;       // Reads them
+           char               *text;      // Fragment read, media
+           size_t              len;       //   names resolved
+           char                resolved;  // text is a copy
+           unsigned long long  base;      // Offset of text in src
+           unsigned char      *expected;  // Digests of its questions
+           unsigned long long *where;     // Start, end in src
+           int                 head;      // First not compared yet
+           int                 cnt;
+           int                 alloc;
+           long                seen;      // Questions read back
+           long                bad;       // Problems found
+          } VERIFY_T;
+
 // Global flags
 static char         G_mixed_format = 0;
 static char         G_no_answers = 0;
 static char         G_verbose = 0;
 static char         G_debug = 0;
+static char         G_reproducible = 0;
+static char         G_watch = 0;          // Rebuild when files change
+static unsigned long long G_shard_size = 0;   // Bytes per archive
+static long         G_shard_questions = 0;    // Questions per archive
+static char         G_verify = 0;         // Read archives instead
+static char         G_stats = 0;          // Report resources used
+static unsigned long long G_memory_limit = 0; // For the questions
+static time_t      *G_entry_time = NULL;  // NULL means "now"
+static time_t       G_fixed_time;
+static DEDUP_INDEX_T *G_dedup = NULL;     // Index of known questions
+static long         G_dup_cnt = 0;
+static double       G_near_dup = 0;       // Similarity threshold
+static NEAR_DUP_T   G_stems;              // Collected for --near-dup
+static int          G_jobs = 0;           // Worker threads
+static SYS_RES_T    G_res;                // CPUs and memory available
+static char         G_jobs_auto = 0;      // -j chosen from G_res
+static char         G_memory_auto = 0;    // --memory-limit=auto
+static MEDIA_SET_T  G_media;              // Files referenced by questions
+static int          G_file_pos = 0;       // Of the file parsed, in the list
+
+static struct option G_long_options[] = {
+                   {"reproducible", no_argument, NULL, OPT_REPRODUCIBLE},
+                   {"dedup", required_argument, NULL, OPT_DEDUP},
+                   {"near-dup", optional_argument, NULL, OPT_NEAR_DUP},
+                   {"watch", no_argument, NULL, OPT_WATCH},
+                   {"shard-size", required_argument, NULL, OPT_SHARD_SIZE},
+                   {"shard-questions", required_argument, NULL,
+                                                   OPT_SHARD_QUESTIONS},
+                   {"verify", no_argument, NULL, OPT_VERIFY},
+                   {"stats", no_argument, NULL, OPT_STATS},
+                   {"deflate-engine", required_argument, NULL,
+                                                   OPT_DEFLATE_ENGINE},
+                   {"memory-limit", required_argument, NULL,
+                                                   OPT_MEMORY_LIMIT},
+                   {"help", no_argument, NULL, 'h'},
+                   {NULL, 0, NULL, 0}};
 
 // Formats (numbering)
 static NUM_FMT_T    G_qformat = {FMT_UNKNOWN, '.'}; // Question format
@@ -83,11 +253,7 @@ static NUM_FMT_T    G_cformat = {FMT_UNKNOWN, '.'}; // Choice format
 
 // Other global variables
 static char        G_first_choice[CHOICE_ID_LEN] = "";
-static const char *G_roman[MAX_ROMAN] =
-                  {"I", "II", "III", "IV", "V",
-                   "V", "VII", "VIII", "IX", "X",
-                   "XI", "XII", "XIII", "XIV", "XV",
-                   "XVI", "XVII", "XVIII", "XIX", "XX"};
+static LABEL_TAB_T  G_labels[FMT_LROMAN + 1];
 static const char *G_statename[] =
                   {"Undefined state",
                    "Question",
@@ -100,7 +266,7 @@ static void trimstr(char *p) {
 
     if (p) {
        len = strlen(p);
-       while (len && isspace(p[len-1])) {
+       while (len && CC_ISSPACE(p[len-1])) {
          len--;
        }
        p[len] = '\0';
@@ -112,22 +278,35 @@ static void trimstr2(char *p) {
 
     if (p) {
        len = strlen(p);
-       while (len && (isspace(p[len-1]) || ispunct(p[len-1]))) {
+       while (len && (CC_ISSPACE(p[len-1]) || CC_ISPUNCT(p[len-1]))) {
          len--;
        }
        p[len] = '\0';
     }
 }
 
-static void html_safe_stradd(STRBUF *sp, char *s) {
+static void html_safe_nadd(STRBUF *sp, char *s, size_t len) {
     char *p;
+    char *q;
+    char *end;
 
     if (G_debug) {
-      fprintf(stderr, "> html_safe_stradd\n");
+      fprintf(stderr, "> html_safe_nadd\n");
     }
     if (sp && s) {
       p = s;
-      while (*p) {
+      end = s + len;
+      while ((p < end) && *p) {
+        // Characters that need no entity are copied by runs
+        q = p;
+        while ((q < end) && *q && !HTML_SPECIAL(*q)) {
+          q++;
+        }
+        if (q > p) {
+          strbuf_nadd(sp, p, (size_t)(q - p));
+          p = q;
+          continue;
+        }
         switch(*p) {
           case '<' :
                strbuf_add(sp, "&lt;");
@@ -152,55 +331,175 @@ static void html_safe_stradd(STRBUF *sp, char *s) {
       }
     }
     if (G_debug) {
-      fprintf(stderr, "< html_safe_stradd\n");
+      fprintf(stderr, "< html_safe_nadd\n");
     }
 }
 
-static char *next_fmt(int num, char *next, NUM_FMT_T format) {
-    // num is the current number
-    if (next) {
-      if ((format.style == FMT_NONE)
-          || (format.style == FMT_UNKNOWN)) {
-        return NULL;
-      }
-      switch(format.style) {
-        case FMT_NUMERICAL:
-             sprintf(next, "%d%c", num + 1, format.sep);
-             break;
-        case FMT_ULETTER:
-             sprintf(next, "%c%c", 'A' + num, format.sep);
-             break;
-        case FMT_LLETTER:
-             sprintf(next, "%c%c", 'a' + num, format.sep);
-             break;
-        case FMT_UROMAN:
-             if (num < MAX_ROMAN) {
-               sprintf(next, "%s%c", G_roman[num], format.sep);
+static void html_safe_stradd(STRBUF *sp, char *s) {
+    if (s) {
+      html_safe_nadd(sp, s, strlen(s));
+    }
+}
+
+static void label_text(char *dest, int num, char style) {
+    // Spell label num (0-based) without its separator.
+    // Only used when building the label tables.
+    static const char *roman_sym[] = {"M", "CM", "D", "CD", "C", "XC",
+                                      "L", "XL", "X", "IX", "V", "IV", "I"};
+    static const int   roman_val[] = {1000, 900, 500, 400, 100, 90,
+                                      50, 40, 10, 9, 5, 4, 1};
+    char  tmp[LABEL_MAXLEN];
+    char *p;
+    int   n;
+    int   i;
+
+    n = num + 1;
+    switch(style) {
+      case FMT_NUMERICAL:
+           sprintf(dest, "%d", n);
+           break;
+      case FMT_ULETTER:
+      case FMT_LLETTER:
+           // A .. Z, then AA, AB ... like spreadsheet columns
+           p = tmp;
+           while (n > 0) {
+             n--;
+             *p++ = (style == FMT_ULETTER ? 'A' : 'a') + (n % 26);
+             n /= 26;
+           }
+           while (p > tmp) {
+             *dest++ = *--p;
+           }
+           *dest = '\0';
+           break;
+      case FMT_UROMAN:
+      case FMT_LROMAN:
+           *dest = '\0';
+           for (i = 0; i < 13; i++) {
+             while (n >= roman_val[i]) {
+               strcat(dest, roman_sym[i]);
+               n -= roman_val[i];
              }
-             break;
-        case FMT_LROMAN:
-             if (num < MAX_ROMAN) {
-               char  lowroman[10];
-               char *p = lowroman;
-               strncpy(lowroman, G_roman[num], 10);
-               while (*p) {
-                 *p = tolower(*p);
-                 p++;
-               }
-               sprintf(next, "%s%c", lowroman, format.sep);
+           }
+           if (style == FMT_LROMAN) {
+             for (p = dest; *p; p++) {
+               *p = CC_TOLOWER(*p);
              }
-             break;
-        default:
-             return NULL;
+           }
+           break;
+      default:
+           *dest = '\0';
+           break;
+    }
+}
+
+static void label_tab_extend(char style, int cnt) {
+    // Make labels 0 to cnt - 1 available for a style
+    LABEL_TAB_T *tab = &(G_labels[(int)style]);
+    char         text[LABEL_MAXLEN];
+    size_t       needed;
+    int          len;
+    int          i;
+
+    if ((style == FMT_UROMAN) || (style == FMT_LROMAN)) {
+      if (cnt > MAX_ROMAN) {
+        cnt = MAX_ROMAN;
+      }
+    }
+    if (cnt <= tab->cnt) {
+      return;
+    }
+    if ((tab->ofs = (size_t *)realloc(tab->ofs, cnt * sizeof(size_t)))
+               == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+    // Each label takes one length byte plus at most LABEL_MAXLEN - 1 chars
+    needed = tab->used + (cnt - tab->cnt) * LABEL_MAXLEN;
+    if (needed > tab->size) {
+      if ((tab->buf = (char *)realloc(tab->buf, needed)) == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+      tab->size = needed;
+    }
+    for (i = tab->cnt; i < cnt; i++) {
+      label_text(text, i, style);
+      len = strlen(text);
+      tab->ofs[i] = tab->used;
+      tab->buf[tab->used] = (char)len;
+      memcpy(&(tab->buf[tab->used + 1]), text, len);
+      tab->used += 1 + len;
+    }
+    tab->cnt = cnt;
+}
+
+static const char *label_get(int num, NUM_FMT_T format, int *lenp) {
+    // Returns label num (0-based) for the format, without the
+    // separator, and its length in *lenp. NULL if there is none.
+    LABEL_TAB_T *tab;
+    const char  *l;
+
+    if ((format.style <= FMT_UNKNOWN)
+        || (format.style > FMT_LROMAN)
+        || (num < 0)) {
+      return NULL;
+    }
+    tab = &(G_labels[(int)format.style]);
+    if (num >= tab->cnt) {
+      // Grow geometrically, a table is only built once
+      label_tab_extend(format.style,
+                       (num < LABEL_ALLOC ? LABEL_ALLOC : 2 * num));
+      if (num >= tab->cnt) {
+        return NULL;
+      }
+    }
+    l = &(tab->buf[tab->ofs[num]]);
+    if (lenp) {
+      *lenp = (unsigned char)*l;
+    }
+    return l + 1;
+}
+
+static int label_match(char *s, int num, NUM_FMT_T format) {
+    // Checks whether s starts with label num followed by the
+    // separator. Returns the length matched, 0 otherwise.
+    const char *l;
+    int         len;
+
+    if (s && ((l = label_get(num, format, &len)) != NULL)
+        && !strncmp(s, l, len)
+        && (s[len] == format.sep)) {
+      return len + 1;
+    }
+    return 0;
+}
+
+static void label_copy(char *dest, int num, NUM_FMT_T format) {
+    // Copy label num and its separator to dest
+    // (at least CHOICE_ID_LEN bytes)
+    const char *l;
+    int         len;
+
+    if (dest) {
+      if ((l = label_get(num, format, &len)) != NULL) {
+        memcpy(dest, l, len);
+        dest[len] = format.sep;
+        dest[len + 1] = '\0';
+      } else {
+        *dest = '\0';
       }
     }
-    return next;
 }
 
-static char *manifest_qti_1_2(char *manifestid,
-                              char *identifier,
-                              char *title) {
-  STRBUF     b;
+static char *manifest_qti_1_2(char        *manifestid,
+                              char        *identifier,
+                              char        *title,
+                              MEDIA_SET_T *media,
+                              long        *files,   // Media to list
+                              long         filecnt) {
+  STRBUF        b;
+  long          n;
 
   if (G_debug) {
     fprintf(stderr, "> manifest_qti_1_2\n");
@@ -238,6 +537,11 @@ static char *manifest_qti_1_2(char *manifestid,
     strbuf_add(&b, "			<file href=\"");
     strbuf_add(&b, identifier);
     strbuf_add(&b, ".xml\"/>\n");
+    for (n = 0; n < filecnt; n++) {
+      strbuf_add(&b, "			<file href=\"");
+      strbuf_add(&b, media->files[files[n]]->name);
+      strbuf_add(&b, "\"/>\n");
+    }
     strbuf_add(&b, "		</resource>\n");
     strbuf_add(&b, "	</resources>\n");
     strbuf_add(&b, "</manifest>\n");
@@ -291,26 +595,41 @@ static char * qti_1_2_footer() {
   return s.s;
 }
 
-static char * qti_1_2(int       qnum,
+static char * qti_1_2(long      qnum,
                       short     qtype,
                       char     *qtext,
                       CHOICE_T *qchoices,
-                      short     qchoicecnt,
-                      char     *ident) {
+                      int       qchoicecnt,
+                      char     *ident,
+                      size_t   *lenp) {
   int    i;
   STRBUF s;
+  size_t room;
+  char  *p;
   char   buffer[BUFFER_LEN];
   char   numstr[BUFFER_LEN];
 
   if (G_debug) {
     fprintf(stderr, "> qti_1_2\n");
-    fprintf(stderr, "  choices: %hd\n", qchoicecnt);
+    fprintf(stderr, "  choices: %d\n", qchoicecnt);
   }
   strbuf_init(&s);
+  // Allocated once, rather than grown (and copied) as the item
+  // is built, then cut to size
+  room = ITEM_MARKUP + strlen(ident);
+  if (qtext) {
+    room += strlen(qtext) * 9 / 8;
+  }
+  for (i = 0; i < qchoicecnt; i++) {
+    if (qchoices[i].id) {
+      room += CHOICE_MARKUP + strlen(qchoices[i].text) * 9 / 8;
+    }
+  }
+  strbuf_reserve(&s, room);
   //  qtype is either QTYPE_MULTCHOICE (one correct answer)
   //  or QTYPE_MULTANSW (n correct answers)
   strbuf_add(&s, "<item title=\"Question ");
-  sprintf(numstr, "%d", qnum);
+  sprintf(numstr, "%ld", qnum);
   strbuf_add(&s, numstr);
   strbuf_add(&s, "\" ident=\"txt2qti_");
   strbuf_add(&s, ident);
@@ -413,18 +732,149 @@ static char * qti_1_2(int       qnum,
   if (G_debug) {
     fprintf(stderr, "< qti_1_2\n");
   }
+  *lenp = s.curlen;
+  // Shrinking is done in place
+  if ((p = (char *)realloc(s.s, s.curlen + 1)) != NULL) {
+    s.s = p;
+  }
   return s.s;
 }
 
-static char *process_question(int       qnum,
+static void question_hash(int            pos,
+                          char          *qtext,
+                          CHOICE_T      *qchoices,
+                          int            qchoicecnt,
+                          unsigned char *digest) {
+   // Content hash of a question (text, choices and answers) of
+   // the file at position pos in the list. Question numbers
+   // restart with each file: with the position, two copies of
+   // a question at the same place in two files still get
+   // different identifiers.
+   FH128_CTX     ctx;
+   unsigned char posbuf[4];
+   char          sep[2];
+   int           i;
+
+   FH128_Init(&ctx);
+   posbuf[0] = (unsigned char)(pos & 0xff);
+   posbuf[1] = (unsigned char)((pos >> 8) & 0xff);
+   posbuf[2] = (unsigned char)((pos >> 16) & 0xff);
+   posbuf[3] = (unsigned char)((pos >> 24) & 0xff);
+   FH128_Update(&ctx, posbuf, 4);
+   if (qtext) {
+     FH128_Update(&ctx, qtext, (unsigned long)strlen(qtext));
+   }
+   for (i = 0; i < qchoicecnt; i++) {
+     if (qchoices[i].id) {
+       // Separator that can't appear in text, plus the answer flag
+       sep[0] = '\0';
+       sep[1] = (qchoices[i].correct ? '1' : '0');
+       FH128_Update(&ctx, sep, 2);
+       if (qchoices[i].text) {
+         FH128_Update(&ctx, qchoices[i].text,
+                      (unsigned long)strlen(qchoices[i].text));
+       }
+     }
+   }
+   FH128_Final(digest, &ctx);
+}
+
+static void normalized_hash_add(FH128_CTX *ctx, char *s) {
+   // Hash s with ASCII case folded and whitespace runs
+   // reduced to one space (none at either end)
+   char  buf[BUFFER_LEN];
+   int   n = 0;
+   char  pending_space = 0;
+
+   if (!s) {
+     return;
+   }
+   while (CC_ISSPACE(*s)) {
+     s++;
+   }
+   while (*s) {
+     if (CC_ISSPACE(*s)) {
+       pending_space = 1;
+     } else {
+       if (n > BUFFER_LEN - 2) {
+         FH128_Update(ctx, buf, n);
+         n = 0;
+       }
+       if (pending_space) {
+         buf[n++] = ' ';
+         pending_space = 0;
+       }
+       buf[n++] = CC_TOLOWER(*s);
+     }
+     s++;
+   }
+   if (n) {
+     FH128_Update(ctx, buf, n);
+   }
+}
+
+static char *skip_label(char *s) {
+   // Skip a question number such as "12.", "b)" or "iv-"
+   // (which only the very first question gets stripped of)
+   char *p;
+   int   n = 0;
+
+   while (CC_ISSPACE(*s)) {
+     s++;
+   }
+   p = s;
+   while ((n < CHOICE_ID_LEN) && (CC_ISDIGIT(*p) || CC_ISALPHA(*p))) {
+     p++;
+     n++;
+   }
+   if (n && (n < CHOICE_ID_LEN)
+       && ((*p == '.') || (*p == ')') || (*p == '-'))) {
+     return p + 1;
+   }
+   return s;
+}
+
+static int is_duplicate(char *qtext, CHOICE_T *qchoices, int qchoicecnt) {
+   // Looks up a normalized hash of the question in the index
+   // (adding it if it's new)
+   FH128_CTX     ctx;
+   unsigned char digest[16];
+   char          sep = '\0';
+   int           i;
+
+   FH128_Init(&ctx);
+   normalized_hash_add(&ctx, (qtext ? skip_label(qtext) : NULL));
+   for (i = 0; i < qchoicecnt; i++) {
+     if (qchoices[i].id) {
+       FH128_Update(&ctx, &sep, 1);
+       normalized_hash_add(&ctx, qchoices[i].text);
+     }
+   }
+   FH128_Final(digest, &ctx);
+   switch (dedup_check_add(G_dedup, digest)) {
+     case 1:
+          return 1;
+     case -1:
+          fprintf(stderr, "Duplicate index failure\n");
+          exit(1);
+     default:
+          break;
+   }
+   return 0;
+}
+
+static char *process_question(long      qnum,
                               char     *qtext,
                               CHOICE_T *qchoices,
-                              short     qchoicecnt,
-                              char     *ident) {
-   short  i;
-   short  correct_answers = 0;
+                              int       qchoicecnt,
+                              char     *ident,
+                              size_t   *lenp) {
+   int    i;
+   int    correct_answers = 0;
    short  qtype;
    char   *p;
+   unsigned char digest[16];
+   char   hashident[IDENT_LEN];
 
   if (G_debug) {
     fprintf(stderr, "> process_question\n");
@@ -442,21 +892,30 @@ static char *process_question(int       qnum,
    } else {
      qtype = QTYPE_MULTANSW;
    }
+   if (G_reproducible) {
+     // Item identifier derived from the question itself
+     // rather than from the file name
+     question_hash(G_file_pos, qtext, qchoices, qchoicecnt, digest);
+     for (i = 0; i < 16; i++) {
+       sprintf(&hashident[i*2], "%02x", digest[i]);
+     }
+     ident = hashident;
+   }
    p = qti_1_2(qnum, qtype, qtext,
-               qchoices, qchoicecnt, ident);
+               qchoices, qchoicecnt, ident, lenp);
    if (G_debug) {
     fprintf(stderr, "< process_question\n");
    }
    return p;
 }
 
-static short add_choice(CHOICE_T **choices_ptr,
-                        short     *choice_cnt,
-                        char      *id,
-                        char      *text,
-                        char       correct) {
-    short i = 0;
-    short j;
+static int add_choice(CHOICE_T **choices_ptr,
+                      int       *choice_cnt,
+                      char      *id,
+                      char      *text,
+                      char       correct) {
+    int   i = 0;
+    int   j;
     int   len;
 
     if (choices_ptr && id && text) {
@@ -515,8 +974,8 @@ static short add_choice(CHOICE_T **choices_ptr,
     return -1;
 }
 
-static void clear_choices(CHOICE_T *choices, short choice_cnt) {
-    short i;
+static void clear_choices(CHOICE_T *choices, int choice_cnt) {
+    int   i;
 
     for (i = 0; i < choice_cnt; i++) {
       if (choices[i].id) {
@@ -534,44 +993,80 @@ static void clear_choices(CHOICE_T *choices, short choice_cnt) {
     }
 }
 
-static char *encode_question(char *q) {
-    // Look for code blocks which must be made
-    // HTML-safe (entity replacement)
-    char   *p1 = q;
-    char   *p2;
+static void add_question_tags(TAG_LIST_T *qtags,
+                              TAG_LIST_T *ltags,
+                              long        from,
+                              long        to,
+                              long        delta) {
+    // Keep the code tags found in the part of a line (from .. to,
+    // to < 0 meaning up to the end) that goes into the question,
+    // with their position in the question text (offset delta).
+    int i;
+
+    for (i = 0; i < ltags->cnt; i++) {
+      if (((ltags->hits[i].tag == TAG_PRE)
+           || (ltags->hits[i].tag == TAG_END_PRE))
+          && ((ltags->hits[i].pos >= from)
+              || ((from == 0) && (ltags->hits[i].pos + delta >= 0)))
+          && ((to < 0) || (ltags->hits[i].pos < to))) {
+        taglist_add(qtags, ltags->hits[i].tag,
+                    ltags->hits[i].pos + delta, ltags->hits[i].len);
+      }
+    }
+}
+
+static char *encode_question(char *q, TAG_LIST_T *tags, char *fname) {
+    // Code blocks must be made HTML-safe (entity replacement).
+    // Where they are was recorded by the line scanner.
+    // Outside code, references to local media files are
+    // replaced by markers (resolved when all is read).
     STRBUF  mod_q;
+    size_t  from = 0;
+    int     i = 0;
+    int     j;
 
     strbuf_init(&mod_q);
-    while (p1 && *p1) {
-      p2 = strstr(p1, START_CODE);
-      if (p2) {
-        *p2 = '\0';
-        strbuf_add(&mod_q, p1);
+    if (q) {
+      strbuf_reserve(&mod_q, strlen(q) * 9 / 8);
+      while (i < tags->cnt) {
+        if (tags->hits[i].tag != TAG_PRE) {
+          // Stray end tag, kept as is
+          i++;
+          continue;
+        }
+        media_rewrite(&G_media, &mod_q, q + from,
+                      tags->hits[i].pos - from, fname);
         strbuf_add(&mod_q, START_CODE);
-        p1 = p2 + strlen(START_CODE);
-        p2 = strstr(p1, END_CODE);
-        if (p2) {
-          *p2 = '\0';
-          html_safe_stradd(&mod_q, p1);
+        from = tags->hits[i].pos + tags->hits[i].len;
+        j = i + 1;
+        while ((j < tags->cnt) && (tags->hits[j].tag != TAG_END_PRE)) {
+          j++;
+        }
+        if (j < tags->cnt) {
+          html_safe_nadd(&mod_q, q + from, tags->hits[j].pos - from);
           strbuf_add(&mod_q, END_CODE);
-          p1 = p2 + strlen(END_CODE);
+          from = tags->hits[j].pos + tags->hits[j].len;
+          i = j + 1;
         } else {
           // End tag missing
-          html_safe_stradd(&mod_q, p1);
+          html_safe_stradd(&mod_q, q + from);
           strbuf_add(&mod_q, END_CODE);
-          p1 = NULL;
+          from += strlen(q + from);
+          i = j;
         }
-      } else {
+      }
+      if (q[from]) {
         // No (or no more) code in the question
-        strbuf_add(&mod_q, p1);
-        p1 = NULL;
+        media_rewrite(&G_media, &mod_q, q + from, strlen(q + from), fname);
       }
     }
     return mod_q.s;
 }
 
-static char *process_file(FILE *fp, char *fname, int *qnump,
-                          mz_zip_archive *pzip, char *ident) {
+static void process_file(FILE *fp, char *fname, long *qnump,
+                         FRAGS_T *out, char *ident,
+                         FH128_CTX *content_hash) {
+   // Appends the questions of fp to out, one fragment each
    char      line[LINE_LEN];
    int       linenum = 0;
    char     *p;
@@ -579,13 +1074,14 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
    char     *s2;
    char     *q;
    char     *eq;
+   size_t    qlen;
    int       len;
    short     state = STATE_NONE;
    char      after_empty_line = 1;
    char      in_code = 0;
    char      in_block = 0;
    char      answer_known = 0;
-   int       qnum = *qnump;
+   long      qnum = *qnump;
    STRBUF    question;
    STRBUF    code;
    STRBUF    choice;
@@ -594,22 +1090,31 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
    char      maybe_correct = 0;
    int       choice_num;
    char      roman = 0;
-   short     choice_cnt = 0;
+   int       choice_cnt = 0;
    char      curr_choice[CHOICE_ID_LEN]; // Current choice id
-   char      next_choice[CHOICE_ID_LEN]; // Store the next choice id
-   char      next_question[CHOICE_ID_LEN]; // Store the next question id
-   STRBUF    xml;
+   int       label_len;
+   int       qline = 0;
+   long      qbase;
+   TAG_SCANNER_T tagscanner;
+   TAG_LIST_T    ltags;   // Tags in the current line
+   TAG_LIST_T    qtags;   // Code tags in the current question
+   int       t;
 
-   strbuf_init(&xml);
    if (fp) {
      strbuf_init(&question);
      strbuf_init(&code);
      strbuf_init(&choice);
+     tagscan_init(&tagscanner);
+     taglist_init(&ltags);
+     taglist_init(&qtags);
      while (fgets(line, LINE_LEN, fp)) {
        linenum++;
+       if (content_hash) {
+         FH128_Update(content_hash, line, (unsigned long)strlen(line));
+       }
        p = line;
        len = strlen(p);
-       while (isspace(*p)) {
+       while (CC_ISSPACE(*p)) {
          p++;
        }
        len = strlen(p);
@@ -624,26 +1129,30 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
          if (G_debug) {
            fprintf(stderr, "%s", line);
          }
-         s = p;
-         s2 = s;
-         // First look for code block
-         while ((s = strcasestr(s2, END_CODE)) != NULL) {
-           if (!in_code) {
-              fprintf(stderr, "*** WARNING *** %s - line %d ***"
-                              " %s found while not in a block\n",
-                              fname, linenum, END_CODE);
-           }
-           in_code = 0;
-           s += 7;
-           s2 = s;
-         }
-         if (strcasestr(s2, START_CODE)) {
-           if (in_code) {
-              fprintf(stderr, "*** WARNING *** %s - line %d ***"
-                              " %s found while still in a block\n",
-                              fname, linenum, START_CODE);
+         // Find all tags in one go, then follow code blocks
+         s2 = p;
+         (void)tagscan(&tagscanner, s2, strlen(s2), &ltags);
+         for (t = 0; t < ltags.cnt; t++) {
+           switch (ltags.hits[t].tag) {
+             case TAG_PRE:
+                  if (in_code) {
+                     fprintf(stderr, "*** WARNING *** %s - line %d ***"
+                                     " %s found while still in a block\n",
+                                     fname, linenum, START_CODE);
+                  }
+                  in_code = 1;
+                  break;
+             case TAG_END_PRE:
+                  if (!in_code) {
+                     fprintf(stderr, "*** WARNING *** %s - line %d ***"
+                                     " %s found while not in a block\n",
+                                     fname, linenum, END_CODE);
+                  }
+                  in_code = 0;
+                  break;
+             default:
+                  break;
            }
-           in_code = 1;
          }
          after_empty_line = 0;
          // Now analyze the line
@@ -696,28 +1205,26 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
                         G_qformat.style = FMT_NONE;
                         break;
                }
-             } else if (G_qformat.style != FMT_NONE) {
-               if ((s2 = next_fmt(qnum + 1,
-                                  next_question,
-                                  G_qformat)) == NULL) {
-                 fprintf(stderr, "Question format problem\n");
-                 return NULL;
-               }
-             } else {
-               // No numbering of questions
-               G_qformat.style = FMT_NONE;
              }
              state = STATE_QUESTION;
-             if (strncasecmp(p, "<block>", 7) == 0) {
-               if (in_block) {
-                 fprintf(stderr, "*** WARNING *** %s - line %d ***"
-                                 " <block> found while still in a block\n",
-                                 fname, linenum);
+             for (t = 0; t < ltags.cnt; t++) {
+               if ((ltags.hits[t].tag == TAG_BLOCK)
+                   && (ltags.hits[t].pos == (long)(p - s2))) {
+                 if (in_block) {
+                   fprintf(stderr, "*** WARNING *** %s - line %d ***"
+                                   " <block> found while still in a block\n",
+                                   fname, linenum);
+                 }
+                 in_block = 1;
+                 p += ltags.hits[t].len;
+                 break;
                }
-               in_block = 1;
-               p += 7;
              }
              qnum++;
+             qline = linenum;
+             qbase = (long)question.curlen;
+             add_question_tags(&qtags, &ltags, (long)(p - s2), -1,
+                               qbase - (long)(p - s2));
              strbuf_add(&question, p);
              answer_known = 0;
              correct = 0;
@@ -747,12 +1254,6 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
                correct = 0;
                in_code = 0;
                in_block = 0;
-               // Must copy the next choice. Depends on format.
-               if ((s2 = next_fmt(choice_num,
-                                  next_choice,
-                                  G_cformat)) == NULL) {
-                 fprintf(stderr, "Format problem\n");
-               }
              } else {
                // Either the format is mixed (we are not "remembering"
                // choice formats) or we don't know yet what the choice
@@ -770,7 +1271,7 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
                         if ((*s2 == '.')
                            || (*s2 == ')')
                            || (*s2 == '-')
-                           || (isspace(*s2)
+                           || (CC_ISSPACE(*s2)
                                && (*s != 'I')
                                && (*s != 'a')
                                && (*s != 'A'))) {
@@ -801,14 +1302,11 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
                           }
                           G_cformat.sep = *s2;
                           state = STATE_CHOICE;
-                          sprintf(curr_choice, "%c%c", *s, *s2);
-                          if ((s = next_fmt(choice_num,
-                                            next_choice,
-                                            G_cformat)) == NULL) {
-                            fprintf(stderr, "Format problem\n");
-                          }
+                          curr_choice[0] = *s;
+                          curr_choice[1] = *s2;
+                          curr_choice[2] = '\0';
                           p = s2 + 1;
-                          while (isspace(*p)) {
+                          while (CC_ISSPACE(*p)) {
                             p++;
                           }
                         } // Else still in the question
@@ -822,19 +1320,33 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
             if (state == STATE_QUESTION) {
               // Still in a question
               maybe_correct = 0;  // Was a false hope
-              if ((s = strcasestr(p, "</block>")) != NULL) {
+              qbase = (long)question.curlen;
+              t = 0;
+              while ((t < ltags.cnt)
+                     && ((ltags.hits[t].tag != TAG_END_BLOCK)
+                         || (ltags.hits[t].pos < (long)(p - s2)))) {
+                t++;
+              }
+              if (t < ltags.cnt) {
                 if (!in_block) {
                   fprintf(stderr, "*** WARNING *** %s - line %d ***"
                                   " </block> found while not in a block\n",
                                   fname, linenum);
                 }
                 in_block = 0;
+                s = s2 + ltags.hits[t].pos;
                 *s = '\0';
                 // Concatenate p to question
+                add_question_tags(&qtags, &ltags, (long)(p - s2),
+                                  ltags.hits[t].pos,
+                                  qbase - (long)(p - s2));
                 strbuf_add(&question, p);
-                p = s + 8;
+                qbase = (long)question.curlen;
+                p = s + ltags.hits[t].len;
               }
               if (*p) {
+                add_question_tags(&qtags, &ltags, (long)(p - s2), -1,
+                                  qbase - (long)(p - s2));
                 strbuf_add(&question, p);
               }
             } else {
@@ -858,29 +1370,26 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
                s++;
             }
             if (G_debug) {
-              fprintf(stderr, " -- Choice - expected: [%s] ",
-                              next_choice);
+              const char *l = label_get(choice_num, G_cformat, &label_len);
+
+              fprintf(stderr, " -- Choice - expected: [%.*s%c] ",
+                              (l ? label_len : 0), (l ? l : ""),
+                              G_cformat.sep);
             }
-            if (strncmp(s, next_choice, strlen(next_choice)) == 0) {
+            if ((label_len = label_match(s, choice_num, G_cformat)) > 0) {
               // Yes -- add the previous choice (curr_choice)
               (void)add_choice(&choices, &choice_cnt,
                                curr_choice, choice.s, correct);
               strbuf_clear(&choice);
-              strcpy(curr_choice, next_choice);
+              label_copy(curr_choice, choice_num, G_cformat);
               choice_num++;
               // Remove the label from the choice proper
-              s += strlen(next_choice);
+              s += label_len;
               p = s;
-              while (isspace(*p)) {
+              while (CC_ISSPACE(*p)) {
                 p++;
               }
               correct = 0;
-              // Prepare the next choice
-              if ((s = next_fmt(choice_num,
-                                next_choice,
-                                G_cformat)) == NULL) {
-                fprintf(stderr, "Format problem\n");
-              }
               if (G_debug) {
                 fprintf(stderr, "[%d] ", maybe_correct);
               }
@@ -894,14 +1403,14 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
               // No, same old or perhaps an answer.
               maybe_correct = 0;
               // Answer ?
-              if (strncasecmp(p, "answer", 6) == 0) {
+              if (cc_strncasecmp(p, "answer", 6) == 0) {
                 // Add the last choice
                 (void)add_choice(&choices, &choice_cnt,
                                  curr_choice, choice.s, correct);
                 strbuf_clear(&choice);
                 state = STATE_ANSWER;
                 p += 6;
-                while (isspace(*p) || ispunct(*p)) {
+                while (CC_ISSPACE(*p) || CC_ISPUNCT(*p)) {
                   p++;
                 }
                 if (*p) {
@@ -914,7 +1423,7 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
                       k = 0;
                       while ((k < choice_cnt)
                              && choices[k].id
-                             && strcasecmp(a, choices[k].id)) {
+                             && cc_strcasecmp(a, choices[k].id)) {
                         k++;
                       }
                       if ((k < choice_cnt) 
@@ -950,23 +1459,38 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
               (void)add_choice(&choices, &choice_cnt,
                                curr_choice, choice.s, correct);
             }
-            eq = encode_question(question.s);
-            // Process the question
-            q = process_question(qnum,
-                                 eq,
-                                 choices,
-                                 choice_cnt,
-                                 ident);
-            if (q) {
-              strbuf_add(&xml, q);
-              free(q);
-            }
-            if (eq) {
-              free(eq);
+            if (G_dedup
+                && is_duplicate(question.s, choices, choice_cnt)) {
+              G_dup_cnt++;
+              if (G_verbose) {
+                fprintf(stderr, "-- Duplicate question dropped (%s,"
+                                " line %d)\n", fname, qline);
+              }
+              qnum--;
+            } else {
+              if (G_near_dup > 0) {
+                neardup_add(&G_stems, skip_label(question.s),
+                            fname, qline);
+              }
+              eq = encode_question(question.s, &qtags, fname);
+              // Process the question
+              q = process_question(qnum,
+                                   eq,
+                                   choices,
+                                   choice_cnt,
+                                   ident,
+                                   &qlen);
+              if (q) {
+                frags_keep(out, q, qlen);
+              }
+              if (eq) {
+                free(eq);
+              }
             }
             clear_choices(choices, choice_cnt);
             strbuf_clear(&choice);
             strbuf_clear(&question);
+            taglist_clear(&qtags);
             state = STATE_NONE;
           }
         } else {
@@ -990,72 +1514,1274 @@ static char *process_file(FILE *fp, char *fname, int *qnump,
     strbuf_dispose(&choice);
     strbuf_dispose(&question);
     strbuf_dispose(&code);
+    taglist_dispose(&ltags);
+    taglist_dispose(&qtags);
     if (G_debug) {
       fprintf(stderr, "Done\n"); fflush(stderr);
     }
   }
-  return xml.s;
 }
 
-static void prepare_zip_qti_1_2(mz_zip_archive *pzip,
-                                char           *manifestid,
-                                char           *ident,
-                                char           *title) {
-   char  *m;
+static void deflate_entry_piece(ZIP_ENTRY_T *e, int k) {
+   // Piece k of the entry, or its CRC if k is -1
+   struct iovec *iov = e->data->iov;
+
+   if (k == -1) {
+     e->crc = deflate_crc32_iov(iov, e->data->cnt);
+   } else if (e->pieces == 1) {
+     e->out[0] = deflate_iov(iov, e->data->cnt, 0, &(e->outlen[0]));
+   } else {
+     e->out[k] = deflate_part(iov + e->first[k],
+                              e->first[k + 1] - e->first[k],
+                              (k == e->pieces - 1), &(e->outlen[k]));
+   }
+}
+
+static int cut_pieces(ZIP_ENTRY_T *e) {
+   // Pieces of about ENTRY_PIECE bytes, at fragment boundaries
+   // (a fragment is never split). Returns their number.
+   size_t size = 0;
+   int    n = 0;
+   int    i;
+
+   if ((e->first = (int *)malloc(sizeof(int)
+                                 * (e->data->cnt + 1))) == NULL) {
+     perror("malloc");
+     exit(1);
+   }
+   for (i = 0; i < e->data->cnt; i++) {
+     if (size == 0) {
+       e->first[n++] = i;
+     }
+     size += e->data->iov[i].iov_len;
+     if (size >= ENTRY_PIECE) {
+       size = 0;
+     }
+   }
+   e->first[n] = e->data->cnt;
+   return n;
+}
+
+static void entry_task(WSCHED_T *ws, int worker, WS_TASK_T *t) {
+   // A whole entry, split into its pieces and CRC if it has
+   // several, or one of these
+   ZIP_ENTRY_T *e = (ZIP_ENTRY_T *)t->obj;
+   int          k;
+
+   if (t->arg != ENTRY_TASK) {
+     deflate_entry_piece(e, (int)t->arg);
+   } else if (e->pieces > 1) {
+     ws_spawn(ws, worker, e, -1);
+     for (k = e->pieces - 1; k >= 0; k--) {
+       ws_spawn(ws, worker, e, k);
+     }
+   } else {
+     deflate_entry_piece(e, -1);
+     if (e->pieces) {
+       deflate_entry_piece(e, 0);
+     }
+   }
+}
+
+static void add_zip_entries(mz_zip_archive *pzip, ZIP_ENTRY_T *entries,
+                            int cnt, int jobs) {
+   // Entries (and pieces of the large ones) are deflated by up to
+   // jobs threads, largest first, then added in order as already
+   // compressed data, the pieces written one after the other.
+   WSCHED_T     ws;
+   ZIP_ENTRY_T *e;
+   char        *buf;
+   int          todo = 0;
+   int          i;
+   int          k;
+   mz_bool      ok;
 
-   if (pzip && ident) {
-     // Create the manifest
-     m = manifest_qti_1_2(manifestid, ident, title);
-     if (m) {
-       if (!mz_zip_writer_add_mem(pzip, "imsmanifest.xml",
-                                  m, strlen(m),
-                                  MZ_DEFAULT_COMPRESSION)) {
-         free(m);
-         fprintf(stderr, "Miniz error adding manifest\n");
-         exit(1);
+   for (i = 0; i < cnt; i++) {
+     e = &(entries[i]);
+     e->len = e->data->len;
+     if (e->len <= 3) {
+       e->pieces = 0;    // Stored by miniz anyway
+     } else if ((e->len > ENTRY_PIECE) && deflate_can_split()) {
+       e->pieces = cut_pieces(e);
+     } else {
+       e->pieces = 1;
+     }
+     if (((e->out = (void **)calloc(e->pieces + 1, sizeof(void *)))
+            == NULL)
+         || ((e->outlen = (size_t *)calloc(e->pieces + 1, sizeof(size_t)))
+               == NULL)) {
+       perror("calloc");
+       exit(1);
+     }
+     todo += e->pieces + 1;
+   }
+   // This thread is one of the deflaters
+   if (jobs > todo) {
+     jobs = todo;
+   }
+   ws_init(&ws, jobs, entry_task, NULL);
+   for (i = 0; i < cnt; i++) {
+     ws_submit(&ws, &(entries[i]), ENTRY_TASK, entries[i].len);
+   }
+   ws_start(&ws, 1);
+   ws_wait(&ws, 0);
+   ws_dispose(&ws);
+   for (i = 0; i < cnt; i++) {
+     e = &(entries[i]);
+     for (k = 0; k < e->pieces; k++) {
+       if (e->out[k] == NULL) {
+         break;
        }
-       free(m);
+     }
+     if (e->pieces && (k == e->pieces)) {
+       ok = mz_zip_writer_add_parts(pzip, e->name,
+                                    (const void * const *)e->out,
+                                    e->outlen, e->pieces, NULL, 0,
+                                    MZ_DEFAULT_LEVEL
+                                       | MZ_ZIP_FLAG_COMPRESSED_DATA,
+                                    e->len, e->crc, G_entry_time);
      } else {
-       fprintf(stderr, "Failed to create manifest\n");
+       buf = frags_gather(e->data);
+       ok = mz_zip_writer_add_mem_ex_v2(pzip, e->name, buf, e->len,
+                                        NULL, 0, MZ_DEFAULT_COMPRESSION,
+                                        0, 0, G_entry_time);
+       free(buf);
+     }
+     for (k = 0; k < e->pieces; k++) {
+       if (e->out[k]) {
+         free(e->out[k]);
+       }
+     }
+     free(e->out);
+     free(e->outlen);
+     if (e->first) {
+       free(e->first);
+     }
+     if (!ok) {
+       fprintf(stderr, "Miniz error adding %s\n", e->what);
        exit(1);
      }
    }
 }
 
+static void add_media_entries(mz_zip_archive *pzip, MEDIA_SET_T *media,
+                              long *files, long filecnt) {
+   // Deflated by the workers, or to be stored as they are
+   MEDIA_FILE_T *f;
+   long          n;
+   mz_bool       ok;
+
+   for (n = 0; n < filecnt; n++) {
+     f = media->files[files[n]];
+     if (f->stored) {
+       ok = mz_zip_writer_add_mem_ex_v2(pzip, f->name, f->data, f->size,
+                                        NULL, 0, MZ_NO_COMPRESSION,
+                                        0, 0, G_entry_time);
+     } else {
+       ok = mz_zip_writer_add_mem_ex_v2(pzip, f->name, f->data, f->size,
+                                        NULL, 0, MZ_DEFAULT_LEVEL
+                                           | MZ_ZIP_FLAG_COMPRESSED_DATA,
+                                        f->orig_size, f->crc,
+                                        G_entry_time);
+     }
+     if (!ok) {
+       fprintf(stderr, "Miniz error adding %s (%s)\n", f->name, f->path);
+       exit(1);
+     }
+   }
+}
+
+static char *prepare_zip_qti_1_2(char *manifestid,
+                                 char *ident,
+                                 char *title,
+                                 long *files,
+                                 long  filecnt) {
+   // Returns the manifest
+   char  *m;
+
+   m = manifest_qti_1_2(manifestid, ident, title, &G_media,
+                        files, filecnt);
+   if (m == NULL) {
+     fprintf(stderr, "Failed to create manifest\n");
+     exit(1);
+   }
+   return m;
+}
+
+static void set_entries(ZIP_ENTRY_T *entries, FRAGS_T *manifest,
+                        char *xmlname, FRAGS_T *xml) {
+   memset(entries, 0, 2 * sizeof(ZIP_ENTRY_T));
+   entries[0].name = "imsmanifest.xml";
+   entries[0].data = manifest;
+   entries[0].what = "manifest";
+   entries[1].name = xmlname;
+   entries[1].data = xml;
+   entries[1].what = "XML file";
+}
+
+static void make_identifiers(unsigned char *digest,
+                             char          *ident,
+                             char          *manifestident) {
+    int i;
+
+    strcpy(ident, "i");
+    strcpy(manifestident, "m");
+    for (i = 0; i < 16; i++) {
+      sprintf(&ident[1+i*2], "%02x", digest[i]);
+      sprintf(&manifestident[1+i*2], "%02x", digest[i]);
+    }
+    if (G_debug) {
+      fprintf(stderr, "ident = %s\n", ident);
+      fflush(stderr);
+    }
+}
+
+static void set_fixed_time(void) {
+    // Reproducible mode: honour SOURCE_DATE_EPOCH
+    // (https://reproducible-builds.org/specs/source-date-epoch/),
+    // otherwise use the earliest date a zip file can hold.
+    char *e;
+    char *end;
+    long  epoch;
+
+    G_fixed_time = (time_t)DOS_EPOCH;
+    if ((e = getenv("SOURCE_DATE_EPOCH")) != NULL) {
+      epoch = strtol(e, &end, 10);
+      if ((*e == '\0') || (*end != '\0') || (epoch < 0)) {
+        fprintf(stderr, "Invalid SOURCE_DATE_EPOCH \"%s\" ignored\n", e);
+      } else if (epoch < DOS_EPOCH) {
+        fprintf(stderr, "SOURCE_DATE_EPOCH before 1980 - using 1980\n");
+      } else {
+        G_fixed_time = (time_t)epoch;
+      }
+    }
+    // Zip timestamps are local times; don't let the time
+    // zone of the machine leak into the archive.
+    setenv("TZ", "UTC", 1);
+    tzset();
+    G_entry_time = &G_fixed_time;
+}
+
+static int parse_size(char *s, unsigned long long *sizep) {
+    // Number of bytes, possibly followed by k, M or G
+    char               *end;
+    unsigned long long  n;
+
+    errno = 0;
+    n = strtoull(s, &end, 10);
+    if ((end == s) || errno || (*s == '-')) {
+      return -1;
+    }
+    switch (*end) {
+      case 'k':
+      case 'K':
+           n <<= 10;
+           end++;
+           break;
+      case 'm':
+      case 'M':
+           n <<= 20;
+           end++;
+           break;
+      case 'g':
+      case 'G':
+           n <<= 30;
+           end++;
+           break;
+      default:
+           break;
+    }
+    if (*end) {
+      return -1;
+    }
+    *sizep = n;
+    return 0;
+}
+
+static char *normalize_text(char *name, char *data, size_t *sizep) {
+    // BOM, CR LF and Windows-1252 out of the way of the parser
+    TEXTIN_T t;
+
+    data = textin_normalize(data, sizep, &t);
+    if (t.cp1252) {
+      fprintf(stderr, "*** WARNING *** %s - line %ld *** not UTF-8,"
+                      " %ld byte%s read as Windows-1252\n",
+                      name, t.line, t.cp1252, (t.cp1252 > 1 ? "s" : ""));
+    }
+    if (G_verbose && t.bom) {
+      fprintf(stderr, "-- %s: byte order mark removed\n", name);
+    }
+    if (G_verbose && t.cr) {
+      fprintf(stderr, "-- %s: %ld CR line end%s\n",
+                      name, t.cr, (t.cr > 1 ? "s" : ""));
+    }
+    return data;
+}
+
+static char *read_stream(FILE *fp, size_t *sizep) {
+    // All of fp, NUL-terminated
+    char   *data = NULL;
+    size_t  alloc = 0;
+    size_t  size = 0;
+    size_t  n;
+
+    do {
+      if (size + 1 >= alloc) {
+        alloc = (alloc ? 2 * alloc : 65536);
+        if ((data = (char *)realloc(data, alloc)) == NULL) {
+          perror("realloc");
+          exit(1);
+        }
+      }
+      n = fread(data + size, 1, alloc - size - 1, fp);
+      size += n;
+    } while (n);
+    if (ferror(fp)) {
+      perror("read");
+    }
+    data[size] = '\0';
+    *sizep = size;
+    return data;
+}
+
+static void parse_source(char *name, char *base, char *data, size_t size,
+                         FRAGS_T *out, FH128_CTX *content_hash) {
+    // Questions of one file already in memory, appended to out.
+    // The base name, if NULL, is derived from the file name.
+    FILE *fp;
+    char  fname[FILENAME_MAX];
+    char *p = base;
+    char *q;
+    long  qnum = 0;
+
+    if (p == NULL) {
+      // Get the file base name and process it a bit
+      strncpy(fname, name, FILENAME_MAX - 1);
+      fname[FILENAME_MAX - 1] = '\0';
+      if ((p = strrchr(fname, '/')) == NULL) {
+        p = fname;
+      } else {
+        p++;
+      }
+      if ((q = strchr(p, '.')) != NULL) {
+        *q = '\0';
+      }
+      q = p;
+      while (*q) {
+        if (CC_ISSPACE(*q)) {
+          *q = '_';
+        }
+        q++;
+      }
+    }
+    // The parser reads lines from the buffer
+    if ((fp = fmemopen(data, size, "r")) == NULL) {
+      perror("fmemopen");
+      exit(1);
+    }
+    process_file(fp, name, &qnum, out, p, content_hash);
+    fclose(fp);
+}
+
+static void read_sources(SRC_FILE_T *src, int cnt,
+                         FH128_CTX *content_hash) {
+    // Reads the files marked as changed and parses them, as well
+    // as the files after them that now start from another format.
+    IN_FILES_T  in;
+    IN_FILE_T  *inf;
+    char      **names;
+    int         n = 0;
+    int         i;
+
+    if ((names = (char **)malloc(sizeof(char *) * (cnt + 1))) == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+    for (i = 0; i < cnt; i++) {
+      if (src[i].changed) {
+        names[n++] = src[i].name;
+      }
+    }
+    // Formats are found again from the first file
+    G_qformat.style = FMT_UNKNOWN;
+    G_qformat.sep = '.';
+    G_cformat = G_qformat;
+    // Files are read ahead, many at once, and parsed in order
+    infiles_open(&in, names, n);
+    if (G_verbose && n) {
+      fprintf(stderr, "-- Reading files with %s\n", infiles_method(&in));
+    }
+    for (i = 0; i < cnt; i++) {
+      if (src[i].changed) {
+        inf = infiles_next(&in);
+        src[i].stat_ok = inf->stat_ok;
+        if (src[i].data) {
+          free(src[i].data);
+          src[i].data = NULL;
+        }
+        src[i].size = 0;
+        if (inf->err) {
+          fprintf(stderr, "%s: %s\n", src[i].name, strerror(inf->err));
+        } else {
+          // Taken over from the reader
+          src[i].size = inf->size;
+          src[i].data = normalize_text(src[i].name, inf->data,
+                                       &(src[i].size));
+          inf->data = NULL;
+        }
+        infiles_release(inf);
+      } else if ((memcmp(&(src[i].fmt_in[0]), &G_qformat,
+                         sizeof(NUM_FMT_T)) == 0)
+                 && (memcmp(&(src[i].fmt_in[1]), &G_cformat,
+                            sizeof(NUM_FMT_T)) == 0)) {
+        // Same text, same starting point: same questions
+        G_qformat = src[i].fmt_out[0];
+        G_cformat = src[i].fmt_out[1];
+        continue;
+      }
+      src[i].fmt_in[0] = G_qformat;
+      src[i].fmt_in[1] = G_cformat;
+      frags_clear(&(src[i].items));
+      if (src[i].data) {
+        if (G_verbose) {
+          fprintf(stderr, "-- Processing %s\n", src[i].name);
+        }
+        if (src[i].size) {
+          G_file_pos = i;
+          parse_source(src[i].name, NULL, src[i].data, src[i].size,
+                       &(src[i].items), content_hash);
+        }
+        if (!G_watch) {
+          free(src[i].data);
+          src[i].data = NULL;
+        }
+      }
+      src[i].fmt_out[0] = G_qformat;
+      src[i].fmt_out[1] = G_cformat;
+      src[i].changed = 0;
+    }
+    infiles_close(&in);
+    free(names);
+}
+
+static int expect_item(void *opaque, QTI_ITEM_T *item) {
+    // A question generated from the text
+    VERIFY_T *v = (VERIFY_T *)opaque;
+
+    if (v->cnt == v->alloc) {
+      v->alloc = (v->alloc ? 2 * v->alloc : 256);
+      if (((v->expected = (unsigned char *)realloc(v->expected,
+                                                   16 * v->alloc)) == NULL)
+          || ((v->where = (unsigned long long *)realloc(v->where,
+                                2 * sizeof(unsigned long long) * v->alloc))
+                == NULL)) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    qtiread_hash(item, v->expected + 16 * v->cnt);
+    v->where[2 * v->cnt] = item->start;
+    v->where[2 * v->cnt + 1] = item->end;
+    v->cnt++;
+    return 0;
+}
+
+static void drop_source(VERIFY_T *v) {
+    if (v->resolved) {
+      free(v->text);
+    }
+    v->text = NULL;
+    v->resolved = 0;
+}
+
+static int next_expected(VERIFY_T *v) {
+    // Reads source fragments until one more question is known.
+    // Returns 0 if there is one (at v->head), -1 at the end.
+    char   *p;
+    size_t  len;
+
+    while (v->head == v->cnt) {
+      drop_source(v);
+      v->head = v->cnt = 0;
+      if (v->next == v->last) {
+        return -1;
+      }
+      v->text = (char *)v->body->iov[v->next].iov_base;
+      v->len = v->body->iov[v->next].iov_len;
+      v->next++;
+      if (G_media.cnt
+          && ((p = media_resolve(&G_media, v->text, v->len, &len))
+                != NULL)) {
+        v->text = p;
+        v->len = len;
+        v->resolved = 1;
+      }
+      v->base = v->src.ofs;
+      (void)qtiread_feed(&(v->src), v->text, v->len);
+    }
+    return 0;
+}
+
+static int print_item(void *opaque, QTI_ITEM_T *item) {
+    (void)opaque;
+    qtiread_print(stderr, item);
+    return 0;
+}
+
+static void check_refs(VERIFY_T *v, const char *s, long k) {
+    // Media files referenced in s must be in the archive
+    char        name[FILENAME_MAX];
+    const char *p;
+    const char *q;
+
+    while (s && ((p = strstr(s, "\"" MEDIA_DIR)) != NULL)) {
+      p++;
+      if (((q = strchr(p, '"')) == NULL) || (q - p >= FILENAME_MAX)) {
+        break;
+      }
+      memcpy(name, p, q - p);
+      name[q - p] = '\0';
+      if (mz_zip_reader_locate_file(&(v->zip), name, NULL, 0) < 0) {
+        fprintf(stderr, "%s: %s (question %ld) missing\n",
+                        v->zipname, name, k + 1);
+        v->bad++;
+      }
+      s = q + 1;
+    }
+}
+
+static int check_item(void *opaque, QTI_ITEM_T *item) {
+    // A question read back from the archive
+    VERIFY_T      *v = (VERIFY_T *)opaque;
+    QTI_READER_T   r;
+    unsigned char  digest[16];
+    long           k = v->seen++;
+    int            i;
+
+    qtiread_hash(item, digest);
+    if (next_expected(v) == -1) {
+      fprintf(stderr, "%s: question %ld (%s) isn't in the source\n",
+                      v->zipname, k + 1, item->title);
+      v->bad++;
+    } else if (memcmp(digest, v->expected + 16 * v->head, 16)) {
+      fprintf(stderr, "%s: question %ld (%s) differs from the source\n",
+                      v->zipname, k + 1, item->title);
+      v->bad++;
+      if (G_verbose) {
+        fprintf(stderr, "---- In the archive:\n");
+        qtiread_print(stderr, item);
+        fprintf(stderr, "---- From the source:\n");
+        qtiread_init(&r, print_item, NULL);
+        (void)qtiread_feed(&r, v->text + (v->where[2 * v->head] - v->base),
+                           (size_t)(v->where[2 * v->head + 1]
+                                    - v->where[2 * v->head]));
+        qtiread_dispose(&r);
+        fprintf(stderr, "----\n");
+      }
+    }
+    if (v->head < v->cnt) {
+      v->head++;
+    }
+    check_refs(v, item->text.s, k);
+    for (i = 0; i < item->choice_cnt; i++) {
+      check_refs(v, item->choices[i].text.s, k);
+    }
+    return 0;
+}
+
+static size_t xml_read(void *opaque, mz_uint64 ofs, const void *buf,
+                       size_t n) {
+    // Decompressed XML, as it comes
+    (void)ofs;
+    if (qtiread_feed((QTI_READER_T *)opaque, (const char *)buf, n) == -1) {
+      return 0;
+    }
+    return n;
+}
+
+static size_t media_read(void *opaque, mz_uint64 ofs, const void *buf,
+                         size_t n) {
+    (void)ofs;
+    FH128_Update((FH128_CTX *)opaque, buf, (unsigned long)n);
+    return n;
+}
+
+static void check_media(VERIFY_T *v, mz_uint idx, const char *name) {
+    // A media file is named after its content
+    FH128_CTX      ctx;
+    unsigned char  digest[16];
+    char           hex[40];
+    int            i;
+
+    FH128_Init(&ctx);
+    if (!mz_zip_reader_extract_to_callback(&(v->zip), idx, media_read,
+                                           &ctx, 0)) {
+      fprintf(stderr, "%s: %s is damaged\n", v->zipname, name);
+      v->bad++;
+      return;
+    }
+    FH128_Final(digest, &ctx);
+    for (i = 0; i < 16; i++) {
+      sprintf(hex + 2 * i, "%02x", digest[i]);
+    }
+    if (strncmp(name + strlen(MEDIA_DIR), hex, 32)) {
+      fprintf(stderr, "%s: %s doesn't match its name\n", v->zipname, name);
+      v->bad++;
+    }
+}
+
+static int verify_archive(char *zipname, FRAGS_T *body, int first,
+                          int cnt) {
+    // Reads zipname back and compares its questions with those
+    // of cnt fragments of body from first (generated from the
+    // text files), in step: a question of the source is only
+    // read (and its media names resolved) when that of the
+    // archive has come, so that besides the body, memory holds
+    // one question of each, whatever the size of the archive.
+    // Returns 0 if they match, -1 otherwise.
+    VERIFY_T                 v;
+    QTI_READER_T             r;
+    mz_zip_archive_file_stat st;
+    mz_uint                  i;
+    long                     xml_idx = -1;
+    char                     manifest = 0;
+    size_t                   len;
+    long                     left = 0;
+
+    memset(&v, 0, sizeof(VERIFY_T));
+    v.zipname = zipname;
+    v.body = body;
+    v.next = first;
+    v.last = first + cnt;
+    qtiread_init(&(v.src), expect_item, &v);
+    if (!mz_zip_reader_init_file(&(v.zip), zipname, 0)) {
+      fprintf(stderr, "%s: not a readable zip archive\n", zipname);
+      v.bad++;
+    } else {
+      for (i = 0; i < mz_zip_reader_get_num_files(&(v.zip)); i++) {
+        if (!mz_zip_reader_file_stat(&(v.zip), i, &st)) {
+          continue;
+        }
+        len = strlen(st.m_filename);
+        if (strcmp(st.m_filename, "imsmanifest.xml") == 0) {
+          manifest = 1;
+        } else if (strncmp(st.m_filename, MEDIA_DIR,
+                           strlen(MEDIA_DIR)) == 0) {
+          check_media(&v, i, st.m_filename);
+        } else if ((len > 4)
+                   && (strcmp(st.m_filename + len - 4, ".xml") == 0)) {
+          xml_idx = (long)i;
+        }
+      }
+      if (!manifest) {
+        fprintf(stderr, "%s: no manifest\n", zipname);
+        v.bad++;
+      }
+      if (xml_idx == -1) {
+        fprintf(stderr, "%s: no assessment\n", zipname);
+        v.bad++;
+      } else {
+        qtiread_init(&r, check_item, &v);
+        if (!mz_zip_reader_extract_to_callback(&(v.zip), (mz_uint)xml_idx,
+                                               xml_read, &r, 0)
+            || (qtiread_end(&r) == -1)) {
+          fprintf(stderr, "%s: the assessment is damaged\n", zipname);
+          v.bad++;
+        }
+        qtiread_dispose(&r);
+        // Questions of the source that didn't come
+        while (next_expected(&v) == 0) {
+          v.head++;
+          left++;
+        }
+        if (left) {
+          fprintf(stderr, "%s: %ld question%s missing\n", zipname,
+                          left, (left > 1 ? "s" : ""));
+          v.bad++;
+        }
+      }
+      mz_zip_reader_end(&(v.zip));
+    }
+    if (v.bad == 0) {
+      fprintf(stderr, "-- %s: %ld question%s, as in the source\n",
+                      zipname, v.seen, (v.seen > 1 ? "s" : ""));
+    }
+    drop_source(&v);
+    qtiread_dispose(&(v.src));
+    if (v.expected) {
+      free(v.expected);
+      free(v.where);
+    }
+    return (v.bad ? -1 : 0);
+}
+
+static void add_items(FRAGS_T *xml, FRAGS_T *body, int first, int cnt) {
+    // Appends questions of the body to xml. Those that reference
+    // media files are replaced by a copy with the archive names,
+    // the others are only pointed to.
+    char   *p;
+    size_t  len;
+    int     i;
+
+    for (i = first; i < first + cnt; i++) {
+      p = NULL;
+      if (G_media.cnt) {
+        p = media_resolve(&G_media, (char *)body->iov[i].iov_base,
+                          body->iov[i].iov_len, &len);
+      }
+      if (p) {
+        frags_take(xml, p, len);
+      } else {
+        frags_add(xml, (char *)body->iov[i].iov_base,
+                  body->iov[i].iov_len);
+      }
+    }
+}
+
+static void assessment_frags(FRAGS_T *xml, char *ident, char *title,
+                             FRAGS_T *body, int first, int cnt) {
+    // Header, questions and footer, as fragments
+    char *p;
+
+    frags_init(xml);
+    if ((p = qti_1_2_header(ident, title)) != NULL) {
+      frags_take(xml, p, strlen(p));
+    }
+    add_items(xml, body, first, cnt);
+    if ((p = qti_1_2_footer()) != NULL) {
+      frags_take(xml, p, strlen(p));
+    }
+}
+
+static void write_entries(mz_zip_archive *pzip, char *manifestident,
+                          char *ident, char *title, FRAGS_T *xml,
+                          long *files, long filecnt, int jobs) {
+    // Manifest, assessment and media files
+    ZIP_ENTRY_T  entries[2];
+    FRAGS_T      manifest;
+    char         archive_fname[FILENAME_MAX];
+    char        *m;
+
+    m = prepare_zip_qti_1_2(manifestident, ident, title, files, filecnt);
+    frags_init(&manifest);
+    frags_take(&manifest, m, strlen(m));
+    sprintf(archive_fname, "%s.xml", ident);
+    set_entries(entries, &manifest, archive_fname, xml);
+    add_zip_entries(pzip, entries, 2, jobs);
+    frags_dispose(&manifest);
+    add_media_entries(pzip, &G_media, files, filecnt);
+}
+
+static int cut_shards(FRAGS_T *body, SHARD_T **shardsp) {
+    // Questions go to the current shard until it's full.
+    // Returns the number of shards.
+    SHARD_T *shards = NULL;
+    int      cnt = 0;
+    int      alloc = 0;
+    long    *seen = NULL;     // Shard where a media file is
+    long     qnum = 0;
+    char    *p;
+    int      i;
+    size_t   item;
+    size_t   msize;
+    size_t   size = 0;
+
+    if (G_media.cnt
+        && ((seen = (long *)calloc(G_media.cnt, sizeof(long))) == NULL)) {
+      perror("calloc");
+      exit(1);
+    }
+    for (i = 0; i < body->cnt; i++) {
+      // One fragment per question
+      p = (char *)body->iov[i].iov_base;
+      item = body->iov[i].iov_len;
+      qnum++;
+      msize = ((seen && cnt) ? media_size(&G_media, p, item, seen, cnt) : 0);
+      if ((cnt == 0)
+          || (G_shard_questions
+              && (shards[cnt - 1].qcnt >= G_shard_questions))
+          || (G_shard_size && (size + item + msize > G_shard_size))) {
+        if (cnt == alloc) {
+          alloc += 16;
+          if ((shards = (SHARD_T *)realloc(shards, sizeof(SHARD_T) * alloc))
+                == NULL) {
+            perror("realloc");
+            exit(1);
+          }
+        }
+        memset(&(shards[cnt]), 0, sizeof(SHARD_T));
+        shards[cnt].body = body;
+        shards[cnt].first = i;
+        cnt++;
+        size = SHARD_OVERHEAD;
+        msize = (seen ? media_size(&G_media, p, item, seen, cnt) : 0);
+        if (G_shard_size && (size + item + msize > G_shard_size)) {
+          fprintf(stderr, "*** WARNING *** question %ld is larger than"
+                          " --shard-size on its own\n", qnum);
+        }
+      }
+      size += item + msize;
+      shards[cnt - 1].cnt++;
+      shards[cnt - 1].qcnt++;
+    }
+    if (cnt == 0) {
+      // No questions, still an archive
+      if ((shards = (SHARD_T *)calloc(1, sizeof(SHARD_T))) == NULL) {
+        perror("calloc");
+        exit(1);
+      }
+      shards[0].body = body;
+      cnt = 1;
+    }
+    if (seen) {
+      free(seen);
+    }
+    *shardsp = shards;
+    return cnt;
+}
+
+static void shard_name(char *dest, size_t size, char *zipname,
+                       int k, int cnt) {
+    // quiz.zip -> quiz-1.zip ... quiz-12.zip, numbers padded
+    // so that names sort
+    size_t len = strlen(zipname);
+    int    width = 1;
+    int    n;
+
+    for (n = cnt; n >= 10; n /= 10) {
+      width++;
+    }
+    if ((len > 4) && (cc_strcasecmp(zipname + len - 4, ".zip") == 0)) {
+      snprintf(dest, size, "%.*s-%0*d%s", (int)(len - 4), zipname,
+                           width, k + 1, zipname + len - 4);
+    } else {
+      snprintf(dest, size, "%s-%0*d", zipname, width, k + 1);
+    }
+}
+
+static int write_shard(SHARD_JOB_T *job, int k) {
+    SHARD_T        *sh = &(job->shards[k]);
+    char            name[FILENAME_MAX + 16];
+    char            title[FILENAME_MAX + 32];
+    char            ident[IDENT_LEN];
+    char            manifestident[IDENT_LEN];
+    unsigned char   buf[20];
+    unsigned char   digest[16];
+    mz_zip_archive  zip;
+    ZIP_OUT_T       out;
+    FRAGS_T         xml;
+    long           *files;
+    long            filecnt;
+    int             ret = 0;
+
+    shard_name(name, sizeof(name), job->zipname, k, job->cnt);
+    sprintf(title, "%s (%d/%d)", job->title, k + 1, job->cnt);
+    // Identifiers derived from those of the whole
+    memcpy(buf, job->digest, 16);
+    buf[16] = (unsigned char)(k & 0xff);
+    buf[17] = (unsigned char)((k >> 8) & 0xff);
+    buf[18] = (unsigned char)((k >> 16) & 0xff);
+    buf[19] = (unsigned char)((k >> 24) & 0xff);
+    fh128(buf, 20, digest);
+    make_identifiers(digest, ident, manifestident);
+    if (G_verify) {
+      return verify_archive(name, sh->body, sh->first, sh->cnt);
+    }
+    files = media_list(&G_media, sh->body->iov + sh->first, sh->cnt,
+                       &filecnt);
+    assessment_frags(&xml, ident, title, sh->body, sh->first, sh->cnt);
+    if (zipout_open(&out, &zip, name) == -1) {
+      frags_dispose(&xml);
+      free(files);
+      return -1;
+    }
+    // Shards are already written in parallel: threads left over
+    // (if there are fewer shards than threads) are shared
+    write_entries(&zip, manifestident, ident, title, &xml, files, filecnt,
+                  (G_jobs > job->cnt ? G_jobs / job->cnt : 1));
+    frags_dispose(&xml);
+    if (zipout_close(&out, NULL, NULL) == -1) {
+      fprintf(stderr, "Failed to write %s\n", name);
+      ret = -1;
+    } else if (G_verbose) {
+      fprintf(stderr, "-- %s: %ld question%s, %ld media file%s\n",
+                      name, sh->qcnt, (sh->qcnt > 1 ? "s" : ""),
+                      filecnt, (filecnt > 1 ? "s" : ""));
+    }
+    if (files) {
+      free(files);
+    }
+    return ret;
+}
+
+static void *shard_writer(void *arg) {
+    SHARD_JOB_T *job = (SHARD_JOB_T *)arg;
+    int          k;
+
+    for (;;) {
+      pthread_mutex_lock(&(job->lock));
+      k = job->next++;
+      pthread_mutex_unlock(&(job->lock));
+      if (k >= job->cnt) {
+        break;
+      }
+      job->shards[k].ret = write_shard(job, k);
+    }
+    return NULL;
+}
+
+static int write_shards(char *zipname, char *title, FRAGS_T *body,
+                        unsigned char *digest) {
+    // Splits the questions into archives bounded by --shard-size
+    // and/or --shard-questions, written by -j threads.
+    // Returns 0 if OK, -1 otherwise.
+    SHARD_JOB_T  job;
+    pthread_t   *tids;
+    int          n;
+    int          t;
+    int          k;
+    int          ret = 0;
+
+    memset(&job, 0, sizeof(SHARD_JOB_T));
+    job.cnt = cut_shards(body, &(job.shards));
+    job.zipname = zipname;
+    job.title = title;
+    job.digest = digest;
+    pthread_mutex_init(&(job.lock), NULL);
+    if (G_verbose) {
+      fprintf(stderr, "-- Questions split into %d archive%s\n",
+                      job.cnt, (job.cnt > 1 ? "s" : ""));
+    }
+    n = (G_jobs < job.cnt ? G_jobs : job.cnt);
+    if ((tids = (pthread_t *)malloc(sizeof(pthread_t) * n)) == NULL) {
+      perror("malloc");
+      exit(1);
+    }
+    for (t = 0; t < n; t++) {
+      if (pthread_create(&(tids[t]), NULL, shard_writer, &job)) {
+        perror("pthread_create");
+        exit(1);
+      }
+    }
+    for (t = 0; t < n; t++) {
+      pthread_join(tids[t], NULL);
+    }
+    for (k = 0; k < job.cnt; k++) {
+      if (job.shards[k].ret == -1) {
+        ret = -1;
+      }
+    }
+    free(tids);
+    free(job.shards);
+    pthread_mutex_destroy(&(job.lock));
+    return ret;
+}
+
+static int write_archive(char *zipname, char *title, FRAGS_T *body,
+                         MD5_CTX *md5ctx, FH128_CTX *contentctx) {
+    // Everything that follows parsing: media files, identifiers
+    // and the archive itself. The body holds one fragment per
+    // question. Returns 0 if OK, -1 otherwise.
+    char            ident[IDENT_LEN];
+    char            manifestident[IDENT_LEN];
+    unsigned char   digest[16];
+    mz_zip_archive  zip;
+    ZIP_OUT_T       out;
+    FRAGS_T         xml;
+    MEDIA_FILE_T   *mf;
+    SPILL_STATS_T   sp;
+    long            failed;
+    long            i;
+
+    // Wait for media files; their names are put in the
+    // questions when the assessment is assembled
+    failed = media_finish(&G_media);
+    if (G_media.cnt) {
+      media_select(&G_media, body->iov, body->cnt);
+    }
+    if (failed || (G_verbose && G_media.cnt)) {
+      fprintf(stderr, "-- %ld media file%s referenced, %ld stored\n",
+                      G_media.cnt, (G_media.cnt > 1 ? "s" : ""),
+                      G_media.distinct_cnt);
+    }
+    if (G_verbose && G_memory_limit) {
+      spill_stats(&sp);
+      if (sp.spilled) {
+        fprintf(stderr, "-- Over --memory-limit: %.1f MB of questions"
+                        " in memory, %.1f MB (%ld questions) spilled\n",
+                        sp.held / 1048576.0, sp.spilled / 1048576.0,
+                        sp.frags);
+      } else {
+        fprintf(stderr, "-- %.1f MB of questions, within"
+                        " --memory-limit\n", sp.held / 1048576.0);
+      }
+    }
+    if (G_reproducible) {
+      i = 0;
+      while ((mf = media_entry(&G_media, i++)) != NULL) {
+        FH128_Update(contentctx, mf->hash, 16);
+      }
+      FH128_Final(digest, contentctx);
+    } else {
+      MD5_Final(digest, md5ctx);
+    }
+    if (G_shard_size || G_shard_questions) {
+      return write_shards(zipname, title, body, digest);
+    }
+    make_identifiers(digest, ident, manifestident);
+    if (G_verify) {
+      return verify_archive(zipname, body, 0, body->cnt);
+    }
+    // Initialize the zip writer
+    if (zipout_open(&out, &zip, zipname) == -1) {
+      return -1;
+    }
+    assessment_frags(&xml, ident, title, body, 0, body->cnt);
+    write_entries(&zip, manifestident, ident, title, &xml,
+                  G_media.distinct, G_media.distinct_cnt, G_jobs);
+    frags_dispose(&xml);
+    // Close the zip writer
+    if (zipout_close(&out, NULL, NULL) == -1) {
+      fprintf(stderr, "Failed to write %s\n",
+                      (strcmp(zipname, "-") ? zipname : "the archive"));
+      return -1;
+    }
+    return 0;
+}
+
+static int build_archive(char *zipname, char *title,
+                         SRC_FILE_T *src, int cnt) {
+    MD5_CTX    md5ctx;       // For identifiers
+    FH128_CTX  contentctx;   // For identifiers derived from content
+    FRAGS_T    body;         // The questions of the files
+    int        i;
+    int        ret;
+
+    MD5_Init(&md5ctx);
+    FH128_Init(&contentctx);
+    // With --watch, files aren't all parsed each time: their
+    // content is kept, and hashed below
+    read_sources(src, cnt,
+                 ((G_reproducible && !G_watch) ? &contentctx : NULL));
+    frags_init(&body);
+    for (i = 0; i < cnt; i++) {
+      if (!G_reproducible && src[i].stat_ok) {
+        // The identifier is the MD5 checksum of parameters
+        // (those that are OK)
+        MD5_Update(&md5ctx, src[i].name,
+                   (unsigned long)strlen(src[i].name));
+      }
+      if (G_reproducible && G_watch && src[i].data) {
+        FH128_Update(&contentctx, src[i].data,
+                     (unsigned long)src[i].size);
+      }
+      if (G_watch) {
+        // Questions kept for the next rebuild
+        frags_append(&body, &(src[i].items), 0, src[i].items.cnt);
+      } else {
+        frags_splice(&body, &(src[i].items));
+        frags_dispose(&(src[i].items));
+      }
+    }
+    ret = write_archive(zipname, title, &body, &md5ctx, &contentctx);
+    frags_dispose(&body);
+    return ret;
+}
+
+static unsigned long long suggested_budget(void) {
+    // Half of what is left under the cgroup memory limit, 0 if
+    // there is none
+    if (G_res.mem_limit == 0) {
+      return 0;
+    }
+    return (G_res.mem_limit > G_res.mem_used ?
+            (G_res.mem_limit - G_res.mem_used) / 2 :
+            G_res.mem_limit / 8);
+}
+
+static void print_stats(void) {
+    // --stats: what was saved or used
+    MZPOOL_STATS_T st;
+    SPILL_STATS_T  sp;
+
+    fprintf(stderr, "-- CPUs: %d online, %d allowed", G_res.online,
+                    G_res.affinity);
+    if (G_res.quota > 0) {
+      fprintf(stderr, ", cgroup quota %.2f", G_res.quota);
+    }
+    fprintf(stderr, ", load %.2f - %d thread%s%s\n", G_res.load,
+                    G_jobs, (G_jobs > 1 ? "s" : ""),
+                    (G_jobs_auto ? " (automatic)" : ""));
+    if (G_res.mem_limit) {
+      fprintf(stderr, "-- Memory: cgroup limit %.1f MB, %.1f MB used"
+                      " at start\n", G_res.mem_limit / 1048576.0,
+                      G_res.mem_used / 1048576.0);
+      if (!G_memory_limit) {
+        fprintf(stderr, "-- Suggested --memory-limit: %.1f MB"
+                        " (--memory-limit=auto)\n",
+                        suggested_budget() / 1048576.0);
+      }
+    }
+    if (G_memory_limit) {
+      fprintf(stderr, "-- Questions kept in memory: up to %.1f MB%s\n",
+                      G_memory_limit / 1048576.0,
+                      (G_memory_auto ? " (automatic)" : ""));
+    }
+    mzpool_stats(&st);
+    fprintf(stderr, "-- Deflate engine: %s\n", deflate_name());
+    fprintf(stderr, "-- Compressor blocks: %llu requested, %llu reused"
+                    " from the pool\n", st.allocs, st.reused);
+    fprintf(stderr, "-- Compressor memory: %.1f MB allocated,"
+                    " %.1f MB reused\n",
+                    st.bytes_new / 1048576.0, st.bytes_reused / 1048576.0);
+    spill_stats(&sp);
+    if (sp.limit) {
+      fprintf(stderr, "-- Spilled to disk: %.1f MB (%ld question%s)\n",
+                      sp.spilled / 1048576.0, sp.frags,
+                      (sp.frags > 1 ? "s" : ""));
+    }
+}
+
+static int watch_sources(char *zipname, char *title,
+                         SRC_FILE_T *src, char **names, int cnt) {
+    // Builds the archive, then builds it again each time files
+    // change, parsing only what is needed. The archive is written
+    // aside and renamed, so that nobody ever sees half of it.
+    WATCH_T          w;
+    char             tmpname[FILENAME_MAX + 8];
+    char            *changed;
+    struct timespec  t0;
+    struct timespec  t1;
+    int              i;
+
+    if (watch_open(&w, names, cnt) == -1) {
+      return -1;
+    }
+    if ((changed = (char *)calloc(cnt, 1)) == NULL) {
+      perror("calloc");
+      exit(1);
+    }
+    sprintf(tmpname, "%s.tmp", zipname);
+    fprintf(stderr, "-- Watching %d file%s (Ctrl-C to stop)\n",
+                    cnt, (cnt > 1 ? "s" : ""));
+    for (;;) {
+      clock_gettime(CLOCK_MONOTONIC, &t0);
+      if (build_archive(tmpname, title, src, cnt) == 0) {
+        if (rename(tmpname, zipname) == -1) {
+          fprintf(stderr, "%s: %s\n", zipname, strerror(errno));
+        } else {
+          clock_gettime(CLOCK_MONOTONIC, &t1);
+          fprintf(stderr, "-- %s written (%.1f ms)\n", zipname,
+                          (t1.tv_sec - t0.tv_sec) * 1000.0
+                          + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+          if (G_stats) {
+            print_stats();
+          }
+        }
+      } else {
+        (void)unlink(tmpname);
+      }
+      // Media files found so far are watched too, after the
+      // sources, in the order of the set
+      while (w.cnt - cnt < G_media.cnt) {
+        (void)watch_add(&w, G_media.files[w.cnt - cnt]->path);
+      }
+      if ((changed = (char *)realloc(changed, w.cnt)) == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+      memset(changed, 0, w.cnt);
+      if (watch_wait(&w, changed) == -1) {
+        break;
+      }
+      for (i = 0; i < cnt; i++) {
+        if (changed[i]) {
+          src[i].changed = 1;
+        }
+      }
+      (void)media_refresh(&G_media, changed + cnt, w.cnt - cnt);
+    }
+    free(changed);
+    watch_close(&w);
+    return -1;
+}
+
 static void usage(char *progname) {
   fprintf(stderr, "Usage: %s [flags] filename [ fielname ... ]\n", progname);
   fprintf(stderr, "   or: %s [flags] < filename\n", progname);
+  fprintf(stderr, "Flags:\n");
+  fprintf(stderr, "  -t title         Quiz title (and name of the .zip)\n");
+  fprintf(stderr, "  -o file          Name of the .zip (- for standard"
+                  " output)\n");
+  fprintf(stderr, "  -a               No answers provided\n");
+  fprintf(stderr, "  -m               Mixed choice numbering formats\n");
+  fprintf(stderr, "  -v               Verbose\n");
+  fprintf(stderr, "  -d               Debug\n");
+  fprintf(stderr, "  --reproducible   Same input, same archive (fixed"
+                  " timestamps,\n");
+  fprintf(stderr, "                   identifiers derived from content;"
+                  " honours\n");
+  fprintf(stderr, "                   SOURCE_DATE_EPOCH)\n");
+  fprintf(stderr, "  --dedup=index    Drop questions already recorded in"
+                  " index\n");
+  fprintf(stderr, "                   (created if needed; new questions"
+                  " are added)\n");
+  fprintf(stderr, "  --near-dup[=s]   Report groups of questions with"
+                  " similar text\n");
+  fprintf(stderr, "                   (similarity s between 0 and 1,"
+                  " default %.1f)\n", NEAR_DUP_DEFAULT);
+  fprintf(stderr, "  -j jobs          Number of worker threads"
+                  " (default: CPUs available,\n");
+  fprintf(stderr, "                   container quota included)\n");
+  fprintf(stderr, "  --shard-size=n   Split into archives of at most n"
+                  " bytes (k, M, G\n");
+  fprintf(stderr, "                   suffixes allowed), named"
+                  " title-1.zip ...\n");
+  fprintf(stderr, "  --shard-questions=n\n");
+  fprintf(stderr, "                   Split into archives of at most n"
+                  " questions\n");
+  fprintf(stderr, "  --deflate-engine=e\n");
+  fprintf(stderr, "                   Compress with e (%s;"
+                  " default %s)\n", deflate_engines(), deflate_name());
+  fprintf(stderr, "  --memory-limit=n Keep at most n bytes of questions"
+                  " in memory (k, M,\n");
+  fprintf(stderr, "                   G suffixes allowed), the others"
+                  " in a temporary file\n");
+  fprintf(stderr, "                   (auto: half of what the cgroup"
+                  " memory limit leaves)\n");
+  fprintf(stderr, "  --stats          Report the memory saved and"
+                  " resources used\n");
+  fprintf(stderr, "  --verify         Read back the .zip (or the shards)"
+                  " and check\n");
+  fprintf(stderr, "                   that it holds the questions of the"
+                  " files\n");
+  fprintf(stderr, "  --watch          Keep running, and rewrite the .zip"
+                  " whenever\n");
+  fprintf(stderr, "                   an input file is saved\n");
 }
 
 int main(int argc, char **argv) {
-    FILE           *fp;
     int             i;
     int             c;
-    char            ident[IDENT_LEN];
-    char            manifestident[IDENT_LEN];
-    char            ident2[IDENT_LEN];
+    int             ret;
     char            timestamp[IDENT_LEN];
-    MD5_CTX         md5ctx;  // For identifiers
-    char            fname[FILENAME_MAX];
+    MD5_CTX         md5ctx;       // For identifiers
+    FH128_CTX       contentctx;   // For identifiers derived from content
     char            zipname[FILENAME_MAX];
-    char            archive_fname[FILENAME_MAX];
     char            title[FILENAME_MAX];
-    char            buff[BUFFER_LEN];
     char           *p;
-    char           *q;
-    char           *s;
     time_t          now;
     struct tm      *t;
-    mz_zip_archive  zip;
-    mz_bool         status;
-    struct stat     statbuf;
-    STRBUF          xml;
-    int             qnum = 0;
+    FRAGS_T         body;
+    SRC_FILE_T     *src;
+    char           *data;
+    size_t          size;
 
     title[0] = '\0';
-    strbuf_init(&xml);
+    zipname[0] = '\0';
     now = time(NULL);
-    while ((c = getopt(argc, argv, OPTIONS)) != -1) {
+    while ((c = getopt_long(argc, argv, OPTIONS,
+                            G_long_options, NULL)) != -1) {
       switch (c) {
         case 'a':  // Answerless
           G_no_answers = 1;
@@ -1066,11 +2792,72 @@ int main(int argc, char **argv) {
         case 't': // Title
           strncpy(title, optarg, FILENAME_MAX);
           break;
+        case 'o': // Output file, - for standard output
+          strncpy(zipname, optarg, FILENAME_MAX - 1);
+          break;
         case 'd':  // Debug - also verbose
           G_debug = 1;
         case 'v':  // Verbose
           G_verbose = 1;
           break;
+        case OPT_REPRODUCIBLE:
+          G_reproducible = 1;
+          break;
+        case 'j':  // Worker threads
+          if ((G_jobs = atoi(optarg)) < 1) {
+            fprintf(stderr, "Invalid number of jobs %s\n", optarg);
+            return 1;
+          }
+          break;
+        case OPT_NEAR_DUP:
+          G_near_dup = (optarg ? atof(optarg) : NEAR_DUP_DEFAULT);
+          if ((G_near_dup <= 0) || (G_near_dup > 1)) {
+            fprintf(stderr, "Near-duplicate threshold must be"
+                            " in ]0, 1]\n");
+            return 1;
+          }
+          break;
+        case OPT_WATCH:
+          G_watch = 1;
+          break;
+        case OPT_VERIFY:
+          G_verify = 1;
+          break;
+        case OPT_STATS:
+          G_stats = 1;
+          break;
+        case OPT_DEFLATE_ENGINE:
+          if (deflate_select(optarg) == -1) {
+            return 1;
+          }
+          break;
+        case OPT_SHARD_SIZE:
+          if ((parse_size(optarg, &G_shard_size) == -1)
+              || (G_shard_size == 0)) {
+            fprintf(stderr, "Invalid shard size %s\n", optarg);
+            return 1;
+          }
+          break;
+        case OPT_MEMORY_LIMIT:
+          if (strcmp(optarg, "auto") == 0) {
+            G_memory_auto = 1;
+          } else if ((parse_size(optarg, &G_memory_limit) == -1)
+              || (G_memory_limit == 0)) {
+            fprintf(stderr, "Invalid memory limit %s\n", optarg);
+            return 1;
+          }
+          break;
+        case OPT_SHARD_QUESTIONS:
+          if ((G_shard_questions = atol(optarg)) < 1) {
+            fprintf(stderr, "Invalid number of questions %s\n", optarg);
+            return 1;
+          }
+          break;
+        case OPT_DEDUP:
+          if ((G_dedup = dedup_open(optarg)) == NULL) {
+            return 1;
+          }
+          break;
         case 'h':
         case '?':
         default:
@@ -1083,8 +2870,22 @@ int main(int argc, char **argv) {
     }
     argc -= optind;
     argv += optind;
+    sysres_read(&G_res);
+    if (G_jobs == 0) {
+      // As many threads as the CPUs (or CPU quota) allowed
+      G_jobs = G_res.jobs;
+      G_jobs_auto = 1;
+    }
+    neardup_init(&G_stems);
+    media_init(&G_media, G_jobs);
+    if (G_reproducible) {
+      set_fixed_time();
+      now = G_fixed_time;
+    }
     if (strlen(title) == 0) {
-      if ((t = localtime(&now)) != NULL) {
+      if (G_reproducible && !getenv("SOURCE_DATE_EPOCH")) {
+        strcpy(title, "Quiz");
+      } else if ((t = localtime(&now)) != NULL) {
         sprintf(title, "Quiz %4d-%02d-%02d %02d:%02d",
                        1900 + t->tm_year,
                        1 + t->tm_mon,
@@ -1095,142 +2896,137 @@ int main(int argc, char **argv) {
         strcpy(title, "Quiz");
       }
     }
-    strncpy(zipname, title, FILENAME_MAX - 5);
-    p = zipname;
-    while (*p) {
-      if (isspace(*p)) {
-        *p = '_';
+    if (zipname[0] == '\0') {
+      strncpy(zipname, title, FILENAME_MAX - 5);
+      p = zipname;
+      while (*p) {
+        if (CC_ISSPACE(*p)) {
+          *p = '_';
+        }
+        p++;
       }
-      p++;
+      strcat(zipname, ".zip");
     }
-    strcat(zipname, ".zip");
-    // Initialize the zip writer
-    memset(&zip, 0, sizeof(mz_zip_archive));
-    status = mz_zip_writer_init_file(&zip, zipname, 0);
-    if (!status) {
-      fprintf(stderr, "Failed to initialize the zip writer\n");
-      return -1;
+    if (G_verify
+        && (G_watch || G_dedup || (strcmp(zipname, "-") == 0))) {
+      // Questions already in the index would be missing
+      fprintf(stderr, "--verify can't be combined with --watch,"
+                      " --dedup or -o -\n");
+      return 1;
     }
-
-    // Initialize MD5
-    MD5_Init(&md5ctx);
-    // Beware, now the first argument of interest is
-    // at index 0
-    if (argc > 0) {
-      // Compute the identifier as the MD5 checksum of parameters
-      // (those that are OK)
-      for (i = 0; i < argc; i++) {
-        if (stat((const char *)argv[i], &statbuf) == 0) {
-          MD5_Update(&md5ctx, argv[i],
-                     (unsigned long)strlen(argv[i]));
-        }
+    if ((G_shard_size || G_shard_questions)
+        && (G_watch || (strcmp(zipname, "-") == 0))) {
+      fprintf(stderr, "Archives can't be split with --watch"
+                      " or -o -\n");
+      return 1;
+    }
+    if (G_watch) {
+      if (argc == 0) {
+        fprintf(stderr, "--watch needs files to watch\n");
+        return 1;
       }
-      MD5_Final((unsigned char *)ident2, &md5ctx);
-      strcpy(ident, "i");
-      strcpy(manifestident, "m");
-      for (i = 0; i < 16; i++) {
-        sprintf(&ident[1+i*2], "%02x", (unsigned char)ident2[i]);
-        sprintf(&manifestident[1+i*2], "%02x", (unsigned char)ident2[i]);
+      if (strcmp(zipname, "-") == 0) {
+        fprintf(stderr, "--watch can't write to standard output\n");
+        return 1;
       }
-      if (G_debug) {
-        fprintf(stderr, "ident = %s\n", (char *)ident);
-        fflush(stderr);
+      if (G_dedup || (G_near_dup > 0)) {
+        // Questions would be seen again at each rebuild
+        fprintf(stderr, "--watch can't be combined with --dedup"
+                        " or --near-dup\n");
+        return 1;
       }
-      // Start preparing the zip file
-      // Creates the manifest
-      prepare_zip_qti_1_2(&zip, manifestident, ident, title);
-      p = qti_1_2_header(ident, title);
-      if (p) {
-        strbuf_add(&xml, p);
-        free(p);
+      if (G_memory_limit || G_memory_auto) {
+        // The spill file would only grow
+        fprintf(stderr, "--watch can't be combined with"
+                        " --memory-limit\n");
+        return 1;
+      }
+    }
+    if (G_memory_auto) {
+      // In a container, questions beyond half of the memory left
+      // go to a temporary file rather than get the process killed;
+      // without a cgroup limit, everything stays in memory
+      G_memory_limit = suggested_budget();
+    }
+    spill_init(G_memory_limit);
+    // Beware, now the first argument of interest is
+    // at index 0
+    if (argc > 0) {
+      if ((src = (SRC_FILE_T *)calloc(argc, sizeof(SRC_FILE_T))) == NULL) {
+        perror("calloc");
+        exit(1);
       }
       for (i = 0; i < argc; i++) {
-        if ((fp = fopen(argv[i], "r")) == NULL) {
-          perror(argv[i]);
-        } else {
-          if (G_verbose) {
-            fprintf(stderr, "-- Processing %s\n", argv[i]);
-          }
-          // Get the file base name and process it a bit
-          strcpy(fname, argv[i]);
-          if ((p = strrchr(fname, '/')) == NULL) {
-            p = fname;
-          } else {
-            p++;
-          }
-          if ((q = strchr(p, '.')) != NULL) {
-            *q = '\0';
-          }
-          q = p;
-          while (*q) {
-            if (isspace(*q)) {
-              *q = '_';
-            }
-            q++;
-          }
-          s = process_file(fp, argv[i], &qnum, &zip, p);
-          if (s) {
-            strbuf_add(&xml, s);
-            free(s);
-          }
-          fclose(fp);
-        }
+        src[i].name = argv[i];
+        src[i].changed = 1;
       }
+      if (G_watch) {
+        ret = watch_sources(zipname, title, src, argv, argc);
+      } else {
+        ret = build_archive(zipname, title, src, argc);
+      }
+      free(src);
     } else {
+       // Initialize MD5 (names or time) and content hash
+       MD5_Init(&md5ctx);
+       FH128_Init(&contentctx);
        if (G_verbose) {
          fprintf(stderr, "-- Reading from standard input\n");
        }
-       // Create an identifier as "stdin" + timestamp
-       if ((t = localtime(&now)) != NULL) {
-         sprintf(timestamp, "stdin%4d%02d%02d%02d%02d%02d",
-                            1900 + t->tm_year,
-                            1 + t->tm_mon,
-                            t->tm_mday,
-                            t->tm_hour,
-                            t->tm_min,
-                            t->tm_sec);
-         MD5_Update(&md5ctx, timestamp,
-                    (unsigned long)strlen(timestamp));
-         MD5_Final((unsigned char *)ident2, &md5ctx);
-         strcpy(ident, "i");
-         strcpy(manifestident, "m");
-         for (i = 0; i < 16; i++) {
-           sprintf(&ident[1+i*2], "%02x", (unsigned char)ident2[i]);
-           sprintf(&manifestident[1+i*2], "%02x", (unsigned char)ident2[i]);
-         }
-         if (G_debug) {
-           fprintf(stderr, "ident = %s\n", (char *)ident);
-           fflush(stderr);
-         }
-         // Start preparing the zip file
-         // Creates the manifest
-         prepare_zip_qti_1_2(&zip, manifestident, ident, title);
-         // Read from standard input
-         s = process_file(stdin, "standard input", &qnum, &zip, "stdin");
-         if (s) {
-           strbuf_add(&xml, s);
-           free(s);
+       // Read from standard input
+       frags_init(&body);
+       data = read_stream(stdin, &size);
+       data = normalize_text("standard input", data, &size);
+       if (size) {
+         parse_source("standard input", "stdin", data, size, &body,
+                      (G_reproducible ? &contentctx : NULL));
+       }
+       free(data);
+       if (!G_reproducible) {
+         // Create an identifier as "stdin" + timestamp
+         if ((t = localtime(&now)) != NULL) {
+           sprintf(timestamp, "stdin%4d%02d%02d%02d%02d%02d",
+                              1900 + t->tm_year,
+                              1 + t->tm_mon,
+                              t->tm_mday,
+                              t->tm_hour,
+                              t->tm_min,
+                              t->tm_sec);
+           MD5_Update(&md5ctx, timestamp,
+                      (unsigned long)strlen(timestamp));
+         } else {
+           perror("localtime");
          }
-       } else {
-         perror("localtime");
        }
+       ret = write_archive(zipname, title, &body, &md5ctx, &contentctx);
+       frags_dispose(&body);
     }
-    sprintf(archive_fname, "%s.xml", ident);
-    p = qti_1_2_footer();
-    if (p) {
-      strbuf_add(&xml, p);
-      free(p);
-    }
-    status = mz_zip_writer_add_mem(&zip, archive_fname,
-                                   xml.s, strlen(xml.s),
-                                   MZ_DEFAULT_COMPRESSION);
-    if (!status) {
-      fprintf(stderr, "Failed to write XML file to zip archive\n");
-      return -1;
+    media_dispose(&G_media);
+    spill_end();
+    if (G_near_dup > 0) {
+      if (G_verbose) {
+        fprintf(stderr, "-- Looking for near-duplicates among %ld"
+                        " questions\n", G_stems.cnt);
+      }
+      (void)neardup_report(&G_stems, G_near_dup, G_jobs, stderr);
+      neardup_dispose(&G_stems);
     }
-    // Close the zip writer
-    (void)mz_zip_writer_finalize_archive(&zip);
-    (void)mz_zip_writer_end(&zip);
-    strbuf_dispose(&xml);
-    return 0;
+    if (G_dedup) {
+      // Questions only count as seen once they are in an archive
+      if ((ret != -1) && (dedup_commit(G_dedup) == -1)) {
+        fprintf(stderr, "Duplicate index failure\n");
+        ret = -1;
+      }
+      if (G_dup_cnt || G_verbose) {
+        fprintf(stderr, "-- %ld duplicate question%s dropped,"
+                        " %llu in index\n",
+                        G_dup_cnt, (G_dup_cnt > 1 ? "s" : ""),
+                        (unsigned long long)dedup_count(G_dedup));
+      }
+      dedup_close(G_dedup);
+    }
+    if (G_stats) {
+      print_stats();
+    }
+    return (ret == -1 ? 1 : 0);
 }
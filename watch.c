@@ -0,0 +1,177 @@
+/// \file  watch.c
+/// \brief Watching the input files for changes.
+/* -------------------------------------------------------------*
+
+   One inotify instance; one watch per directory (inotify
+   hands back the same watch descriptor when a directory is
+   added twice), events matched against the base names of
+   the files in that directory. Other files of the directory
+   (editor swap files, backups) are ignored.
+
+   Only events that end a modification are of interest: a
+   file closed after writing, or a name appearing or going
+   away. After the first one, events are read for as long
+   as some keep coming within WATCH_SETTLE_MS.
+
+   If the kernel queue overflows, every file is reported
+   as changed rather than guessing.
+
+   Files can be added once watching has started (media files
+   found in the questions); one whose directory can't be
+   watched keeps its place, with no watch descriptor, so that
+   files keep the index they were given.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/inotify.h>
+
+#include "watch.h"
+
+#define WATCH_EVENTS   (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM \
+                        | IN_DELETE)
+#define WATCH_BUF_LEN  8192
+#define WATCH_ALLOC    16
+
+extern int watch_open(WATCH_T *w, char **names, int cnt) {
+   int i;
+
+   memset(w, 0, sizeof(WATCH_T));
+   if ((w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+     perror("inotify_init1");
+     return -1;
+   }
+   for (i = 0; i < cnt; i++) {
+     if (watch_add(w, names[i]) == -1) {
+       watch_close(w);
+       return -1;
+     }
+   }
+   return 0;
+}
+
+extern int watch_add(WATCH_T *w, char *name) {
+   WATCH_FILE_T *f;
+   char         *dir;
+   char         *p;
+
+   if (w->cnt == w->alloc) {
+     w->alloc = (w->alloc ? 2 * w->alloc : WATCH_ALLOC);
+     if ((w->files = (WATCH_FILE_T *)realloc(w->files,
+                             sizeof(WATCH_FILE_T) * w->alloc)) == NULL) {
+       perror("realloc");
+       exit(1);
+     }
+   }
+   f = &(w->files[w->cnt++]);
+   if ((dir = strdup(name)) == NULL) {
+     perror("strdup");
+     exit(1);
+   }
+   if ((p = strrchr(dir, '/')) == NULL) {
+     f->base = strdup(dir);
+     strcpy(dir, ".");
+   } else {
+     f->base = strdup(p + 1);
+     if (p == dir) {
+       p++;   // Root directory
+     }
+     *p = '\0';
+   }
+   if (f->base == NULL) {
+     perror("strdup");
+     exit(1);
+   }
+   if ((f->wd = inotify_add_watch(w->fd, dir, WATCH_EVENTS)) == -1) {
+     fprintf(stderr, "Cannot watch %s: %s\n", dir, strerror(errno));
+     free(dir);
+     return -1;
+   }
+   free(dir);
+   return 0;
+}
+
+static int mark_changed(WATCH_T *w, char *changed,
+                        struct inotify_event *ev) {
+   int i;
+   int n = 0;
+
+   for (i = 0; i < w->cnt; i++) {
+     if ((ev->mask & IN_Q_OVERFLOW)
+         || ((ev->len > 0)
+             && (w->files[i].wd == ev->wd)
+             && (strcmp(w->files[i].base, ev->name) == 0))) {
+       if (!changed[i]) {
+         changed[i] = 1;
+         n++;
+       }
+     }
+   }
+   return n;
+}
+
+extern int watch_wait(WATCH_T *w, char *changed) {
+   union {
+     struct inotify_event  ev;         // For alignment
+     char                  buf[WATCH_BUF_LEN];
+   }                     u;
+   struct inotify_event *ev;
+   struct pollfd         pfd;
+   ssize_t               len;
+   char                 *p;
+   int                   n = 0;
+   int                   r;
+
+   pfd.fd = w->fd;
+   pfd.events = POLLIN;
+   for (;;) {
+     // Wait for ever for the first event, then until quiet
+     r = poll(&pfd, 1, (n ? WATCH_SETTLE_MS : -1));
+     if (r == -1) {
+       if (errno == EINTR) {
+         continue;
+       }
+       perror("poll");
+       return -1;
+     }
+     if (r == 0) {
+       return n;
+     }
+     if ((len = read(w->fd, u.buf, sizeof(u.buf))) == -1) {
+       if ((errno == EAGAIN) || (errno == EINTR)) {
+         continue;
+       }
+       perror("read");
+       return -1;
+     }
+     p = u.buf;
+     while (p < u.buf + len) {
+       ev = (struct inotify_event *)p;
+       n += mark_changed(w, changed, ev);
+       p += sizeof(struct inotify_event) + ev->len;
+     }
+   }
+}
+
+extern void watch_close(WATCH_T *w) {
+   int i;
+
+   if (w->fd != -1) {
+     close(w->fd);
+   }
+   if (w->files) {
+     for (i = 0; i < w->cnt; i++) {
+       if (w->files[i].base) {
+         free(w->files[i].base);
+       }
+     }
+     free(w->files);
+   }
+   memset(w, 0, sizeof(WATCH_T));
+   w->fd = -1;
+}
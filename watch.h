@@ -0,0 +1,46 @@
+/*
+ *   Watching the input files for changes (inotify).
+ *
+ *   Editors rarely write a file in place: many write a new
+ *   file and rename it over the old one, which a watch on
+ *   the file itself would miss. The directories holding the
+ *   files are watched instead, and events matched by name.
+ *
+ *   A save often comes as a burst of events (truncate, write,
+ *   rename, chmod ...), sometimes on several files at once.
+ *   They are collected until the directories have been quiet
+ *   for a short while, and reported as one change.
+ */
+#ifndef WATCH_H
+
+#define WATCH_H
+
+#define WATCH_SETTLE_MS   40   // Quiet time ending a burst
+
+typedef struct watch_file {
+          int   wd;           // Watch descriptor of its directory
+          char *base;         // Name in the directory
+         } WATCH_FILE_T;
+
+typedef struct watch {
+          int           fd;
+          WATCH_FILE_T *files;
+          int           cnt;
+          int           alloc;
+         } WATCH_T;
+
+// Starts watching the cnt files of names.
+// Returns 0 if OK, -1 (after printing why) otherwise.
+extern int  watch_open(WATCH_T *w, char **names, int cnt);
+// Adds a file after the others (index w->cnt - 1, even if
+// it can't be watched).
+// Returns 0 if OK, -1 (after printing why) otherwise.
+extern int  watch_add(WATCH_T *w, char *name);
+// Blocks until some of the files have changed and things
+// have settled. changed[i] is set to 1 for each file that
+// changed (and left alone for the others).
+// Returns the number of files changed, -1 on error.
+extern int  watch_wait(WATCH_T *w, char *changed);
+extern void watch_close(WATCH_T *w);
+
+#endif
@@ -0,0 +1,318 @@
+/// \file  wsched.c
+/// \brief Work-stealing scheduler.
+/* -------------------------------------------------------------*
+
+   A worker looks for a task at the bottom of its own deque
+   first (the last part it split off, whose data is still in
+   its cache), then at the top of the other deques (the
+   oldest, largest parts), and only then in the queue of
+   submitted tasks, a heap ordered by weight.
+
+   Deques have a lock each, so that a worker taking its own
+   parts doesn't contend with the others; the scheduler lock
+   protects the heap, the count of unfinished tasks and the
+   sleeping workers. A worker about to sleep looks at the
+   deques again under the scheduler lock, and tasks are
+   pushed under it: a task can't be pushed between the last
+   look and the wait without the worker being woken.
+
+   A part is counted as pending before it becomes visible to
+   thieves: it could otherwise be stolen and finished first,
+   and the count drop to zero while its parent still runs.
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wsched.h"
+
+#define WS_ALLOC   64
+
+static int before(WS_TASK_T *a, WS_TASK_T *b) {
+   // Whether a is to run before b
+   return ((a->weight > b->weight)
+           || ((a->weight == b->weight) && (a->seq < b->seq)));
+}
+
+static void heap_push(WSCHED_T *ws, WS_TASK_T *t) {
+   WS_TASK_T tmp;
+   long      i;
+   long      parent;
+
+   if (ws->heap_cnt == ws->heap_alloc) {
+     ws->heap_alloc = (ws->heap_alloc ? 2 * ws->heap_alloc : WS_ALLOC);
+     if ((ws->heap = (WS_TASK_T *)realloc(ws->heap,
+                             sizeof(WS_TASK_T) * ws->heap_alloc)) == NULL) {
+       perror("realloc");
+       exit(1);
+     }
+   }
+   i = ws->heap_cnt++;
+   ws->heap[i] = *t;
+   while (i > 0) {
+     parent = (i - 1) / 2;
+     if (!before(&(ws->heap[i]), &(ws->heap[parent]))) {
+       break;
+     }
+     tmp = ws->heap[i];
+     ws->heap[i] = ws->heap[parent];
+     ws->heap[parent] = tmp;
+     i = parent;
+   }
+}
+
+static int heap_pop(WSCHED_T *ws, WS_TASK_T *t) {
+   WS_TASK_T tmp;
+   long      i = 0;
+   long      c;
+
+   if (ws->heap_cnt == 0) {
+     return 0;
+   }
+   *t = ws->heap[0];
+   ws->heap[0] = ws->heap[--(ws->heap_cnt)];
+   while ((c = 2 * i + 1) < ws->heap_cnt) {
+     if ((c + 1 < ws->heap_cnt)
+         && before(&(ws->heap[c + 1]), &(ws->heap[c]))) {
+       c++;
+     }
+     if (!before(&(ws->heap[c]), &(ws->heap[i]))) {
+       break;
+     }
+     tmp = ws->heap[i];
+     ws->heap[i] = ws->heap[c];
+     ws->heap[c] = tmp;
+     i = c;
+   }
+   return 1;
+}
+
+static void deque_push(WS_DEQUE_T *d, WS_TASK_T *t) {
+   pthread_mutex_lock(&(d->lock));
+   if (d->tail == d->alloc) {
+     if (d->head > 0) {
+       memmove(d->tasks, d->tasks + d->head,
+               sizeof(WS_TASK_T) * (d->tail - d->head));
+       d->tail -= d->head;
+       d->head = 0;
+     } else {
+       d->alloc = (d->alloc ? 2 * d->alloc : WS_ALLOC);
+       if ((d->tasks = (WS_TASK_T *)realloc(d->tasks,
+                               sizeof(WS_TASK_T) * d->alloc)) == NULL) {
+         perror("realloc");
+         exit(1);
+       }
+     }
+   }
+   d->tasks[d->tail++] = *t;
+   pthread_mutex_unlock(&(d->lock));
+}
+
+static int deque_take(WS_DEQUE_T *d, WS_TASK_T *t, int bottom) {
+   int ret = 0;
+
+   pthread_mutex_lock(&(d->lock));
+   if (d->tail > d->head) {
+     *t = (bottom ? d->tasks[--(d->tail)] : d->tasks[(d->head)++]);
+     if (d->head == d->tail) {
+       d->head = d->tail = 0;
+     }
+     ret = 1;
+   }
+   pthread_mutex_unlock(&(d->lock));
+   return ret;
+}
+
+static int find_part(WSCHED_T *ws, int worker, WS_TASK_T *t,
+                     char *stolenp) {
+   // A part from the deques: the worker's own, then the others
+   int i;
+
+   *stolenp = 0;
+   if (deque_take(&(ws->deques[worker]), t, 1)) {
+     return 1;
+   }
+   for (i = 1; i < ws->nworkers; i++) {
+     if (deque_take(&(ws->deques[(worker + i) % ws->nworkers]), t, 0)) {
+       *stolenp = 1;
+       return 1;
+     }
+   }
+   return 0;
+}
+
+static void work(WSCHED_T *ws, int worker, int until_done) {
+   // Runs tasks until the scheduler stops or, if until_done is
+   // set, until none is left
+   WS_TASK_T t;
+   char      stolen;
+   int       found;
+
+   for (;;) {
+     found = find_part(ws, worker, &t, &stolen);
+     if (!found) {
+       pthread_mutex_lock(&(ws->lock));
+       while (!(found = heap_pop(ws, &t))
+              && !(found = find_part(ws, worker, &t, &stolen))
+              && !ws->closing
+              && !(until_done && (ws->pending == 0))) {
+         ws->sleeping++;
+         pthread_cond_wait(&(ws->work), &(ws->lock));
+         ws->sleeping--;
+       }
+       pthread_mutex_unlock(&(ws->lock));
+       if (!found) {
+         break;
+       }
+     }
+     ws->run(ws, worker, &t);
+     pthread_mutex_lock(&(ws->lock));
+     if (stolen) {
+       ws->steals++;
+     }
+     if (--(ws->pending) == 0) {
+       pthread_cond_broadcast(&(ws->done));
+       // Workers waiting in ws_wait() return
+       pthread_cond_broadcast(&(ws->work));
+     }
+     pthread_mutex_unlock(&(ws->lock));
+   }
+}
+
+static void *ws_thread(void *arg) {
+   WS_WORKER_T *w = (WS_WORKER_T *)arg;
+
+   work(w->ws, w->id, 0);
+   return NULL;
+}
+
+extern void ws_init(WSCHED_T *ws, int nworkers, WS_RUN_T run, void *ctx) {
+   int i;
+
+   memset(ws, 0, sizeof(WSCHED_T));
+   ws->nworkers = (nworkers > 0 ? nworkers : 1);
+   ws->run = run;
+   ws->ctx = ctx;
+   if ((ws->deques = (WS_DEQUE_T *)calloc(ws->nworkers,
+                                          sizeof(WS_DEQUE_T))) == NULL) {
+     perror("calloc");
+     exit(1);
+   }
+   for (i = 0; i < ws->nworkers; i++) {
+     pthread_mutex_init(&(ws->deques[i].lock), NULL);
+   }
+   pthread_mutex_init(&(ws->lock), NULL);
+   pthread_cond_init(&(ws->work), NULL);
+   pthread_cond_init(&(ws->done), NULL);
+}
+
+extern void ws_start(WSCHED_T *ws, int first) {
+   int i;
+
+   if (ws->workers) {
+     return;
+   }
+   if ((ws->workers = (WS_WORKER_T *)calloc(ws->nworkers,
+                                            sizeof(WS_WORKER_T))) == NULL) {
+     perror("calloc");
+     exit(1);
+   }
+   ws->first = first;
+   for (i = first; i < ws->nworkers; i++) {
+     ws->workers[i].ws = ws;
+     ws->workers[i].id = i;
+     if (pthread_create(&(ws->workers[i].tid), NULL, ws_thread,
+                        &(ws->workers[i]))) {
+       perror("pthread_create");
+       exit(1);
+     }
+   }
+}
+
+extern int ws_started(WSCHED_T *ws) {
+   return (ws->workers != NULL);
+}
+
+extern void ws_submit(WSCHED_T *ws, void *obj, long arg, size_t weight) {
+   WS_TASK_T t;
+
+   t.obj = obj;
+   t.arg = arg;
+   t.weight = weight;
+   pthread_mutex_lock(&(ws->lock));
+   t.seq = ws->seq++;
+   heap_push(ws, &t);
+   ws->pending++;
+   if (ws->sleeping) {
+     pthread_cond_signal(&(ws->work));
+   }
+   pthread_mutex_unlock(&(ws->lock));
+}
+
+extern void ws_spawn(WSCHED_T *ws, int worker, void *obj, long arg) {
+   WS_TASK_T t;
+
+   t.obj = obj;
+   t.arg = arg;
+   t.weight = 0;
+   t.seq = 0;
+   pthread_mutex_lock(&(ws->lock));
+   ws->pending++;
+   deque_push(&(ws->deques[worker]), &t);
+   if (ws->sleeping) {
+     pthread_cond_signal(&(ws->work));
+   }
+   pthread_mutex_unlock(&(ws->lock));
+}
+
+extern void ws_wait(WSCHED_T *ws, int worker) {
+   if ((worker >= 0) && (worker < ws->nworkers)) {
+     work(ws, worker, 1);
+   }
+   pthread_mutex_lock(&(ws->lock));
+   while (ws->pending) {
+     pthread_cond_wait(&(ws->done), &(ws->lock));
+   }
+   pthread_mutex_unlock(&(ws->lock));
+}
+
+extern void ws_stop(WSCHED_T *ws) {
+   int i;
+
+   if (ws->workers == NULL) {
+     return;
+   }
+   ws_wait(ws, -1);
+   pthread_mutex_lock(&(ws->lock));
+   ws->closing = 1;
+   pthread_cond_broadcast(&(ws->work));
+   pthread_mutex_unlock(&(ws->lock));
+   for (i = ws->first; i < ws->nworkers; i++) {
+     pthread_join(ws->workers[i].tid, NULL);
+   }
+   free(ws->workers);
+   ws->workers = NULL;
+   ws->closing = 0;
+}
+
+extern void ws_dispose(WSCHED_T *ws) {
+   int i;
+
+   ws_stop(ws);
+   for (i = 0; i < ws->nworkers; i++) {
+     if (ws->deques[i].tasks) {
+       free(ws->deques[i].tasks);
+     }
+     pthread_mutex_destroy(&(ws->deques[i].lock));
+   }
+   free(ws->deques);
+   if (ws->heap) {
+     free(ws->heap);
+   }
+   pthread_mutex_destroy(&(ws->lock));
+   pthread_cond_destroy(&(ws->work));
+   pthread_cond_destroy(&(ws->done));
+   memset(ws, 0, sizeof(WSCHED_T));
+}
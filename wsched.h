@@ -0,0 +1,86 @@
+/*
+ *   Work-stealing scheduler for tasks of very unequal sizes.
+ *
+ *   Handing out work in submission order leaves threads idle
+ *   at the end while one of them is still on the largest
+ *   task. Here tasks submitted from outside wait in a queue
+ *   that gives the largest one first, and a task being run
+ *   can split itself: the parts go to the deque of the worker
+ *   running it, which takes them back from the bottom, while
+ *   idle workers steal them from the top of the deque.
+ *
+ *   All tasks run the same function, that tells them apart
+ *   by the object and argument it's given.
+ */
+#ifndef WSCHED_H
+
+#define WSCHED_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+typedef struct ws_task {
+          void   *obj;
+          long    arg;
+          size_t  weight;    // Largest first, for submitted tasks
+          long    seq;       // Then in order of submission
+         } WS_TASK_T;
+
+// Tasks of one worker: the worker pushes and pops at the
+// bottom (tail), thieves take from the top (head)
+typedef struct ws_deque {
+          WS_TASK_T       *tasks;
+          long             head;
+          long             tail;
+          long             alloc;
+          pthread_mutex_t  lock;
+         } WS_DEQUE_T;
+
+struct wsched;
+typedef void (*WS_RUN_T)(struct wsched *ws, int worker, WS_TASK_T *t);
+
+typedef struct ws_worker {
+          struct wsched   *ws;
+          int              id;       // Index of its deque
+          pthread_t        tid;
+         } WS_WORKER_T;
+
+typedef struct wsched {
+          int              nworkers;
+          WS_DEQUE_T      *deques;     // One per worker
+          WS_TASK_T       *heap;       // Submitted tasks
+          long             heap_cnt;
+          long             heap_alloc;
+          long             seq;
+          long             pending;    // Not finished yet
+          long             steals;
+          int              sleeping;
+          char             closing;
+          WS_RUN_T         run;
+          void            *ctx;        // For run()
+          WS_WORKER_T     *workers;    // NULL: not started
+          int              first;      // First worker with a thread
+          pthread_mutex_t  lock;
+          pthread_cond_t   work;
+          pthread_cond_t   done;
+         } WSCHED_T;
+
+extern void ws_init(WSCHED_T *ws, int nworkers, WS_RUN_T run, void *ctx);
+// Starts threads for workers first to nworkers - 1 (worker 0
+// can be the calling thread, in ws_wait()). Does nothing if
+// they are already running.
+extern void ws_start(WSCHED_T *ws, int first);
+extern int  ws_started(WSCHED_T *ws);
+// A task from outside the workers (any thread)
+extern void ws_submit(WSCHED_T *ws, void *obj, long arg, size_t weight);
+// A part of the task being run by worker, for it or thieves
+extern void ws_spawn(WSCHED_T *ws, int worker, void *obj, long arg);
+// Returns once all tasks are done; the calling thread works
+// as worker meanwhile unless worker is -1.
+extern void ws_wait(WSCHED_T *ws, int worker);
+// Waits for the tasks and ends the threads; ws_start() can
+// start them again.
+extern void ws_stop(WSCHED_T *ws);
+extern void ws_dispose(WSCHED_T *ws);
+
+#endif
@@ -0,0 +1,248 @@
+/// \file  zip64test.c
+/// \brief Stress test of the Zip64 paths of the miniz writers.
+/* -------------------------------------------------------------*
+
+   make zip64test; ./zip64test [-k] [directory]
+
+   Writes, in directory (by default $TMPDIR, or /tmp), an
+   archive of more than 65535 entries and more than 4 GB:
+   small entries from memory, a 4.5 GB file (sparse, so it
+   costs little to create) added with mz_zip_writer_add_file(),
+   then small entries and a small file past the 4 GB mark.
+   A second archive is then made of all the entries of the
+   first one with mz_zip_writer_add_from_zip_reader(). Both
+   are read back: entry count, sizes, and the CRC of the
+   entries past 4 GB and of the large one.
+
+   It needs about 9 GB of free space and a few minutes; the
+   archives are removed at the end unless -k is given (to
+   check them with other tools, unzip -t for instance).
+
+ * -------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "miniz.h"
+
+#define SMALL_CNT    70000                      // Past 65535 entries
+#define LARGE_SIZE   (4608ULL * 1024 * 1024)    // 4.5 GB
+#define TAIL_CNT     10                         // Entries past 4 GB
+
+typedef struct crc_state {
+          mz_uint32  crc;
+          mz_uint64  len;
+         } CRC_STATE_T;
+
+static size_t crc_put(void *opaque, mz_uint64 ofs, const void *buf,
+                      size_t n) {
+   CRC_STATE_T *c = (CRC_STATE_T *)opaque;
+
+   (void)ofs;
+   c->crc = (mz_uint32)mz_crc32(c->crc, (const mz_uint8 *)buf, n);
+   c->len += n;
+   return n;
+}
+
+static int fail(const char *what, const char *name) {
+   fprintf(stderr, "*** FAILED *** %s (%s)\n", what, name);
+   return -1;
+}
+
+static int make_file(const char *name, mz_uint64 size, const char *text) {
+   int fd;
+
+   if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+     perror(name);
+     return -1;
+   }
+   if (text) {
+     if (write(fd, text, strlen(text)) != (ssize_t)strlen(text)) {
+       perror(name);
+       close(fd);
+       return -1;
+     }
+   } else if (ftruncate(fd, (off_t)size) == -1) {
+     perror(name);
+     close(fd);
+     return -1;
+   }
+   close(fd);
+   return 0;
+}
+
+static int write_first(const char *zipname, const char *large,
+                       const char *small) {
+   mz_zip_archive zip;
+   char           name[64];
+   char           text[64];
+   int            i;
+
+   memset(&zip, 0, sizeof(zip));
+   if (!mz_zip_writer_init_file(&zip, zipname, 0)) {
+     return fail("mz_zip_writer_init_file", zipname);
+   }
+   for (i = 0; i < SMALL_CNT; i++) {
+     sprintf(name, "small/%05d.txt", i);
+     sprintf(text, "Entry %d\n", i);
+     if (!mz_zip_writer_add_mem(&zip, name, text, strlen(text),
+                                MZ_DEFAULT_LEVEL)) {
+       mz_zip_writer_end(&zip);
+       return fail("mz_zip_writer_add_mem", name);
+     }
+   }
+   if (!mz_zip_writer_add_file(&zip, "large.bin", large, NULL, 0, 0)) {
+     mz_zip_writer_end(&zip);
+     return fail("mz_zip_writer_add_file", large);
+   }
+   for (i = 0; i < TAIL_CNT; i++) {
+     sprintf(name, "tail/%02d.txt", i);
+     sprintf(text, "Tail entry %d, past 4 GB\n", i);
+     if (!mz_zip_writer_add_mem(&zip, name, text, strlen(text),
+                                MZ_DEFAULT_LEVEL)) {
+       mz_zip_writer_end(&zip);
+       return fail("mz_zip_writer_add_mem", name);
+     }
+   }
+   if (!mz_zip_writer_add_file(&zip, "tail/file.txt", small, NULL, 0,
+                               MZ_DEFAULT_LEVEL)) {
+     mz_zip_writer_end(&zip);
+     return fail("mz_zip_writer_add_file", small);
+   }
+   if (!mz_zip_writer_finalize_archive(&zip)) {
+     mz_zip_writer_end(&zip);
+     return fail("mz_zip_writer_finalize_archive", zipname);
+   }
+   mz_zip_writer_end(&zip);
+   return 0;
+}
+
+static int write_copy(const char *zipname, const char *srcname) {
+   mz_zip_archive src;
+   mz_zip_archive zip;
+   mz_uint        i;
+   mz_uint        cnt;
+
+   memset(&src, 0, sizeof(src));
+   memset(&zip, 0, sizeof(zip));
+   if (!mz_zip_reader_init_file(&src, srcname, 0)) {
+     return fail("mz_zip_reader_init_file", srcname);
+   }
+   if (!mz_zip_writer_init_file(&zip, zipname, 0)) {
+     mz_zip_reader_end(&src);
+     return fail("mz_zip_writer_init_file", zipname);
+   }
+   cnt = mz_zip_reader_get_num_files(&src);
+   for (i = 0; i < cnt; i++) {
+     if (!mz_zip_writer_add_from_zip_reader(&zip, &src, i)) {
+       mz_zip_writer_end(&zip);
+       mz_zip_reader_end(&src);
+       return fail("mz_zip_writer_add_from_zip_reader", zipname);
+     }
+   }
+   mz_zip_reader_end(&src);
+   if (!mz_zip_writer_finalize_archive(&zip)) {
+     mz_zip_writer_end(&zip);
+     return fail("mz_zip_writer_finalize_archive", zipname);
+   }
+   mz_zip_writer_end(&zip);
+   return 0;
+}
+
+static int check(const char *zipname) {
+   mz_zip_archive           zip;
+   mz_zip_archive_file_stat st;
+   CRC_STATE_T              c;
+   mz_uint                  cnt;
+   mz_uint                  i;
+   int                      ret = 0;
+
+   memset(&zip, 0, sizeof(zip));
+   if (!mz_zip_reader_init_file(&zip, zipname, 0)) {
+     return fail("mz_zip_reader_init_file", zipname);
+   }
+   cnt = mz_zip_reader_get_num_files(&zip);
+   if (cnt != SMALL_CNT + TAIL_CNT + 2) {
+     mz_zip_reader_end(&zip);
+     return fail("entry count", zipname);
+   }
+   // The large entry, then everything after it
+   for (i = SMALL_CNT; (ret == 0) && (i < cnt); i++) {
+     if (!mz_zip_reader_file_stat(&zip, i, &st)) {
+       ret = fail("mz_zip_reader_file_stat", zipname);
+       break;
+     }
+     if ((i == SMALL_CNT) && (st.m_uncomp_size != LARGE_SIZE)) {
+       ret = fail("size of the large entry", st.m_filename);
+       break;
+     }
+     if ((i > SMALL_CNT) && (st.m_local_header_ofs <= 0xFFFFFFFFULL)) {
+       ret = fail("entry expected past 4 GB", st.m_filename);
+       break;
+     }
+     c.crc = MZ_CRC32_INIT;
+     c.len = 0;
+     if (!mz_zip_reader_extract_to_callback(&zip, i, crc_put, &c, 0)
+         || (c.crc != st.m_crc32) || (c.len != st.m_uncomp_size)) {
+       ret = fail("data or CRC", st.m_filename);
+     }
+   }
+   mz_zip_reader_end(&zip);
+   if (ret == 0) {
+     printf("%s: %u entries, OK\n", zipname, cnt);
+   }
+   return ret;
+}
+
+int main(int argc, char **argv) {
+   char  large[FILENAME_MAX];
+   char  small[FILENAME_MAX];
+   char  first[FILENAME_MAX];
+   char  copy[FILENAME_MAX];
+   char *dir;
+   int   keep = 0;
+   int   ret = 1;
+   int   ch;
+
+   while ((ch = getopt(argc, argv, "k")) != -1) {
+     switch (ch) {
+       case 'k':
+         keep = 1;
+         break;
+       default:
+         fprintf(stderr, "Usage: %s [-k] [directory]\n", argv[0]);
+         return 1;
+     }
+   }
+   if (optind < argc) {
+     dir = argv[optind];
+   } else if ((dir = getenv("TMPDIR")) == NULL) {
+     dir = "/tmp";
+   }
+   snprintf(large, sizeof(large), "%s/zip64test-large.bin", dir);
+   snprintf(small, sizeof(small), "%s/zip64test-small.txt", dir);
+   snprintf(first, sizeof(first), "%s/zip64test-1.zip", dir);
+   snprintf(copy, sizeof(copy), "%s/zip64test-2.zip", dir);
+   if ((make_file(large, LARGE_SIZE, NULL) == 0)
+       && (make_file(small, 0, "Small file, past 4 GB\n") == 0)) {
+     printf("Writing %s\n", first);
+     if ((write_first(first, large, small) == 0)
+         && (check(first) == 0)) {
+       printf("Copying to %s\n", copy);
+       if ((write_copy(copy, first) == 0)
+           && (check(copy) == 0)) {
+         ret = 0;
+       }
+     }
+   }
+   (void)unlink(large);
+   (void)unlink(small);
+   if (!keep) {
+     (void)unlink(first);
+     (void)unlink(copy);
+   }
+   return ret;
+}
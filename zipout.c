@@ -0,0 +1,441 @@
+/// \file  zipout.c
+/// \brief Output of the zip archive to a file, a stream or memory.
+/* -------------------------------------------------------------*
+
+   Files and memory are handled by miniz itself. For streams,
+   miniz is given a write function that accepts any offset
+   not yet sent: while an entry is being added, the archive
+   size recorded by miniz still points to the start of the
+   entry, so all bytes before that offset are final and are
+   written out as soon as something comes after them.
+
+   Only the current entry is ever held in memory, instead of
+   the whole archive, and nothing touches the filesystem.
+
+   Files are written with pwrite() by a writer thread, which
+   takes blocks from a queue in order. What miniz writes goes
+   to the current large buffer as long as it follows on (or
+   falls within it); a full buffer is queued and the next free
+   one taken, waiting for the writer if both are in flight.
+   When miniz goes back further, to the local header of an
+   entry already queued, the bytes go in a small block of
+   their own, written after what they overwrite since the
+   queue is in order. Space is reserved ahead with fallocate()
+   where the filesystem supports it, and the file cut to its
+   real size at the end. Without a thread, blocks are written
+   as soon as queued.
+
+ * -------------------------------------------------------------*/
+
+#define _GNU_SOURCE       // fallocate()
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "zipout.h"
+#include "mzpool.h"
+
+#define ZIPOUT_ALLOC     65536
+#define ZIPOUT_ALIGN     4096
+#define ZIPOUT_PREALLOC  (64 * 1024 * 1024)  // fallocate() step
+#define ZIPOUT_NO_PREALLOC  ((mz_uint64)-1)   // Not supported
+
+static int stream_flush(ZIP_OUT_T *out, mz_uint64 upto) {
+   // Send pending bytes up to offset upto
+   size_t n;
+
+   if (upto <= out->flushed) {
+     return 0;
+   }
+   n = (size_t)(upto - out->flushed);
+   if (n > out->used) {
+     n = out->used;
+   }
+   if (fwrite(out->pending, 1, n, out->fp) != n) {
+     return -1;
+   }
+   memmove(out->pending, out->pending + n, out->used - n);
+   out->used -= n;
+   out->flushed += n;
+   return 0;
+}
+
+static size_t stream_write(void *opaque, mz_uint64 ofs,
+                           const void *buf, size_t n) {
+   ZIP_OUT_T *out = (ZIP_OUT_T *)opaque;
+   size_t     end;
+   size_t     newalloc;
+
+   if (ofs < out->flushed) {
+     // Already sent - can't go back on a stream
+     return 0;
+   }
+   if (stream_flush(out, out->pzip->m_archive_size) == -1) {
+     return 0;
+   }
+   end = (size_t)(ofs - out->flushed) + n;
+   if (end > out->alloc) {
+     newalloc = (out->alloc ? out->alloc : ZIPOUT_ALLOC);
+     while (newalloc < end) {
+       newalloc *= 2;
+     }
+     if ((out->pending = (char *)realloc(out->pending, newalloc)) == NULL) {
+       perror("realloc");
+       exit(1);
+     }
+     out->alloc = newalloc;
+   }
+   if ((size_t)(ofs - out->flushed) > out->used) {
+     memset(out->pending + out->used, 0,
+            (size_t)(ofs - out->flushed) - out->used);
+   }
+   memcpy(out->pending + (ofs - out->flushed), buf, n);
+   if (end > out->used) {
+     out->used = end;
+   }
+   return n;
+}
+
+static int block_write(ZIP_OUT_T *out, ZIP_BLOCK_T *b) {
+   // Writes all of b, reserving space ahead.
+   // Returns 0 if OK, an errno value otherwise.
+   mz_uint64 end = b->ofs + b->len;
+   mz_uint64 step;
+   size_t    done = 0;
+   ssize_t   n;
+
+   if ((out->prealloc != ZIPOUT_NO_PREALLOC) && (end > out->prealloc)) {
+     step = ((end - out->prealloc + ZIPOUT_PREALLOC - 1) / ZIPOUT_PREALLOC)
+            * ZIPOUT_PREALLOC;
+     if (fallocate(out->fd, 0, (off_t)out->prealloc, (off_t)step) == 0) {
+       out->prealloc += step;
+     } else {
+       out->prealloc = ZIPOUT_NO_PREALLOC;
+     }
+   }
+   while (done < b->len) {
+     n = pwrite(out->fd, b->data + done, b->len - done,
+                (off_t)(b->ofs + done));
+     if (n == -1) {
+       if (errno == EINTR) {
+         continue;
+       }
+       return errno;
+     }
+     if (n == 0) {
+       return EIO;
+     }
+     done += (size_t)n;
+   }
+   return 0;
+}
+
+static void block_release(ZIP_OUT_T *out, ZIP_BLOCK_T *b) {
+   // Under the lock if threaded
+   if (b->pooled) {
+     out->free_bufs[out->free_cnt++] = b->data;
+   } else {
+     free(b->data);
+   }
+   free(b);
+}
+
+static void *file_writer(void *arg) {
+   ZIP_OUT_T   *out = (ZIP_OUT_T *)arg;
+   ZIP_BLOCK_T *b;
+   int          err;
+
+   pthread_mutex_lock(&(out->lock));
+   for (;;) {
+     while ((out->queue == NULL) && !out->stop) {
+       pthread_cond_wait(&(out->cond), &(out->lock));
+     }
+     if ((b = out->queue) == NULL) {
+       break;
+     }
+     if ((out->queue = b->next) == NULL) {
+       out->last = NULL;
+     }
+     err = out->err;
+     pthread_mutex_unlock(&(out->lock));
+     if (err == 0) {
+       // Nothing more is written after a failure
+       err = block_write(out, b);
+     }
+     pthread_mutex_lock(&(out->lock));
+     if (err && (out->err == 0)) {
+       out->err = err;
+     }
+     block_release(out, b);
+     pthread_cond_broadcast(&(out->cond));
+   }
+   pthread_mutex_unlock(&(out->lock));
+   return NULL;
+}
+
+static ZIP_BLOCK_T *block_new(char *data, mz_uint64 ofs, size_t len,
+                              char pooled) {
+   ZIP_BLOCK_T *b;
+
+   if ((b = (ZIP_BLOCK_T *)malloc(sizeof(ZIP_BLOCK_T))) == NULL) {
+     perror("malloc");
+     exit(1);
+   }
+   b->data = data;
+   b->ofs = ofs;
+   b->len = len;
+   b->pooled = pooled;
+   b->next = NULL;
+   return b;
+}
+
+static void block_queue(ZIP_OUT_T *out, ZIP_BLOCK_T *b) {
+   int err;
+
+   if (!out->threaded) {
+     if (((err = block_write(out, b)) != 0) && (out->err == 0)) {
+       out->err = err;
+     }
+     block_release(out, b);
+     return;
+   }
+   pthread_mutex_lock(&(out->lock));
+   if (out->last) {
+     out->last->next = b;
+   } else {
+     out->queue = b;
+   }
+   out->last = b;
+   pthread_cond_broadcast(&(out->cond));
+   pthread_mutex_unlock(&(out->lock));
+}
+
+static char *buffer_take(ZIP_OUT_T *out) {
+   // A free large buffer, once the writer has released one
+   char *buf;
+
+   if (out->threaded) {
+     pthread_mutex_lock(&(out->lock));
+     while (out->free_cnt == 0) {
+       pthread_cond_wait(&(out->cond), &(out->lock));
+     }
+   }
+   buf = out->free_bufs[--(out->free_cnt)];
+   if (out->threaded) {
+     pthread_mutex_unlock(&(out->lock));
+   }
+   return buf;
+}
+
+static int file_failed(ZIP_OUT_T *out) {
+   int err;
+
+   if (!out->threaded) {
+     return out->err;
+   }
+   pthread_mutex_lock(&(out->lock));
+   err = out->err;
+   pthread_mutex_unlock(&(out->lock));
+   return err;
+}
+
+static size_t file_write(void *opaque, mz_uint64 ofs,
+                         const void *buf, size_t n) {
+   ZIP_OUT_T   *out = (ZIP_OUT_T *)opaque;
+   ZIP_BLOCK_T *b;
+   const char  *p = (const char *)buf;
+   char        *data;
+   size_t       left = n;
+   size_t       k;
+
+   if (file_failed(out)) {
+     return 0;
+   }
+   while (left) {
+     b = out->cur;
+     if (b && (ofs >= b->ofs) && (ofs <= b->ofs + b->len)) {
+       // Follows on, or rewrites, the current buffer
+       k = ZIPOUT_BUFSIZE - (size_t)(ofs - b->ofs);
+       if (k == 0) {
+         block_queue(out, b);
+         out->cur = NULL;
+         continue;
+       }
+       if (k > left) {
+         k = left;
+       }
+       memcpy(b->data + (ofs - b->ofs), p, k);
+       if (ofs + k > b->ofs + b->len) {
+         b->len = (size_t)(ofs + k - b->ofs);
+       }
+     } else if (b && (ofs < b->ofs)) {
+       // Back to something already queued
+       k = (size_t)(b->ofs - ofs);
+       if (k > left) {
+         k = left;
+       }
+       if ((data = (char *)malloc(k)) == NULL) {
+         perror("malloc");
+         exit(1);
+       }
+       memcpy(data, p, k);
+       block_queue(out, block_new(data, ofs, k, 0));
+     } else {
+       if (b) {
+         block_queue(out, b);
+       }
+       out->cur = block_new(buffer_take(out), ofs, 0, 1);
+       continue;
+     }
+     ofs += k;
+     p += k;
+     left -= k;
+     if (ofs > out->size) {
+       out->size = ofs;
+     }
+   }
+   return n;
+}
+
+static int file_open(ZIP_OUT_T *out, const char *path) {
+   int i;
+
+   if ((out->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) == -1) {
+     perror(path);
+     return -1;
+   }
+   for (i = 0; i < ZIPOUT_BUFFERS; i++) {
+     if (posix_memalign((void **)&(out->bufs[i]), ZIPOUT_ALIGN,
+                        ZIPOUT_BUFSIZE)) {
+       perror("posix_memalign");
+       exit(1);
+     }
+     out->free_bufs[i] = out->bufs[i];
+   }
+   out->free_cnt = ZIPOUT_BUFFERS;
+   pthread_mutex_init(&(out->lock), NULL);
+   pthread_cond_init(&(out->cond), NULL);
+   out->threaded = (pthread_create(&(out->writer), NULL,
+                                   file_writer, out) == 0);
+   return 0;
+}
+
+static int file_close(ZIP_OUT_T *out) {
+   // Waits for the writer, returns 0 if everything was written
+   int ret = 0;
+   int i;
+
+   if (out->cur) {
+     block_queue(out, out->cur);
+     out->cur = NULL;
+   }
+   if (out->threaded) {
+     pthread_mutex_lock(&(out->lock));
+     out->stop = 1;
+     pthread_cond_broadcast(&(out->cond));
+     pthread_mutex_unlock(&(out->lock));
+     pthread_join(out->writer, NULL);
+   }
+   if (out->err) {
+     errno = out->err;
+     perror("write");
+     ret = -1;
+   }
+   if ((out->prealloc != ZIPOUT_NO_PREALLOC)
+       && (out->prealloc > out->size)
+       && (ftruncate(out->fd, (off_t)out->size) == -1)) {
+     perror("ftruncate");
+     ret = -1;
+   }
+   // Network filesystems may only report errors now
+   if (close(out->fd) == -1) {
+     perror("close");
+     ret = -1;
+   }
+   for (i = 0; i < ZIPOUT_BUFFERS; i++) {
+     free(out->bufs[i]);
+   }
+   pthread_mutex_destroy(&(out->lock));
+   pthread_cond_destroy(&(out->cond));
+   return ret;
+}
+
+extern int zipout_open(ZIP_OUT_T *out, mz_zip_archive *pzip,
+                       const char *path) {
+   mz_bool status;
+
+   memset(out, 0, sizeof(ZIP_OUT_T));
+   memset(pzip, 0, sizeof(mz_zip_archive));
+   out->pzip = pzip;
+   if (path == NULL) {
+     out->kind = ZIPOUT_HEAP;
+     status = mz_zip_writer_init_heap(pzip, 0, ZIPOUT_ALLOC);
+   } else if (strcmp(path, "-") == 0) {
+     out->kind = ZIPOUT_STREAM;
+     out->fp = stdout;
+     mzpool_use(pzip);
+     pzip->m_pWrite = stream_write;
+     pzip->m_pIO_opaque = out;
+     status = mz_zip_writer_init(pzip, 0);
+   } else {
+     out->kind = ZIPOUT_FILE;
+     if (file_open(out, path) == -1) {
+       status = MZ_FALSE;
+     } else {
+       mzpool_use(pzip);
+       pzip->m_pWrite = file_write;
+       pzip->m_pIO_opaque = out;
+       if (!(status = mz_zip_writer_init(pzip, 0))) {
+         (void)file_close(out);
+       }
+     }
+   }
+   if (!status) {
+     fprintf(stderr, "Failed to initialize the zip writer (%s)\n",
+                     (path ? path : "memory"));
+     return -1;
+   }
+   return 0;
+}
+
+extern int zipout_close(ZIP_OUT_T *out, void **bufp, size_t *sizep) {
+   int ret = 0;
+
+   if (out->kind == ZIPOUT_HEAP) {
+     if (!mz_zip_writer_finalize_heap_archive(out->pzip, &(out->heap),
+                                              &(out->heap_size))) {
+       ret = -1;
+     }
+     if (bufp && sizep) {
+       *bufp = out->heap;
+       *sizep = out->heap_size;
+     } else if (out->heap) {
+       free(out->heap);
+     }
+   } else {
+     if (!mz_zip_writer_finalize_archive(out->pzip)) {
+       ret = -1;
+     }
+     if ((out->kind == ZIPOUT_FILE) && (file_close(out) == -1)) {
+       ret = -1;
+     }
+     if (out->kind == ZIPOUT_STREAM) {
+       if ((stream_flush(out, out->flushed + out->used) == -1)
+           || (fflush(out->fp) == EOF)) {
+         perror("write");
+         ret = -1;
+       }
+       if (out->pending) {
+         free(out->pending);
+       }
+     }
+   }
+   if (!mz_zip_writer_end(out->pzip)) {
+     ret = -1;
+   }
+   return ret;
+}
@@ -0,0 +1,81 @@
+/*
+ *   Where the zip archive goes: a named file, a stream that
+ *   can't seek (standard output, a pipe to an upload
+ *   process) or memory.
+ *
+ *   miniz goes back to the local header of an entry once
+ *   the entry is compressed. For streams, the bytes of the
+ *   entry being written are kept until miniz moves to the
+ *   next one; everything before is final and sent at once.
+ *
+ *   Files are written by a thread of their own, from
+ *   ZIPOUT_BUFFERS large buffers used in turn, so that
+ *   compression goes on while the previous buffer is on its
+ *   way to the disk (or to a slow network filesystem).
+ */
+#ifndef ZIPOUT_H
+
+#define ZIPOUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "miniz.h"
+
+#define ZIPOUT_FILE     0
+#define ZIPOUT_STREAM   1
+#define ZIPOUT_HEAP     2
+
+#define ZIPOUT_BUFFERS  2
+#define ZIPOUT_BUFSIZE  (4 * 1024 * 1024)
+
+// Bytes to write at an offset, queued for the writer thread
+typedef struct zip_block {
+          char             *data;
+          mz_uint64         ofs;
+          size_t            len;
+          char              pooled;    // One of the large buffers
+          struct zip_block *next;
+         } ZIP_BLOCK_T;
+
+typedef struct zip_out {
+          short           kind;
+          mz_zip_archive *pzip;
+          FILE           *fp;        // Stream
+          mz_uint64       flushed;   // Stream bytes already sent
+          char           *pending;   // From offset flushed
+          size_t          used;
+          size_t          alloc;
+          void           *heap;      // Finished heap archive
+          size_t          heap_size;
+          // File
+          int             fd;
+          char           *bufs[ZIPOUT_BUFFERS];
+          char           *free_bufs[ZIPOUT_BUFFERS];
+          int             free_cnt;
+          ZIP_BLOCK_T    *cur;       // Being filled
+          ZIP_BLOCK_T    *queue;     // For the writer, oldest first
+          ZIP_BLOCK_T    *last;
+          mz_uint64       size;      // End of the furthest write
+          mz_uint64       prealloc;  // Reserved with fallocate()
+          char            threaded;  // Otherwise, written at once
+          char            stop;
+          int             err;       // errno of a failed write
+          pthread_t       writer;
+          pthread_mutex_t lock;
+          pthread_cond_t  cond;
+         } ZIP_OUT_T;
+
+// Starts a zip writer writing to path, to standard output
+// if path is "-", in memory if path is NULL. Writers to files
+// and streams allocate through the pool of mzpool.h.
+// Returns 0 if OK, -1 (after printing why) otherwise.
+extern int  zipout_open(ZIP_OUT_T *out, mz_zip_archive *pzip,
+                        const char *path);
+// Finalizes the archive and ends the writer. For a heap
+// archive, bufp and sizep (if not NULL) receive the archive,
+// to be freed by the caller. Returns 0 if OK, -1 otherwise.
+extern int  zipout_close(ZIP_OUT_T *out, void **bufp, size_t *sizep);
+
+#endif